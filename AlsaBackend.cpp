@@ -0,0 +1,504 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include <Pothos/Plugin.hpp>
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <algorithm> //min/max
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+/***********************************************************************
+ * Native ALSA backend
+ *
+ * The stream transfers samples directly between the Pothos buffers
+ * and the ring buffer of the PCM with snd_pcm_mmap_begin/commit(),
+ * so there is no intermediate copy like the read and write calls make.
+ * Blocking calls wait on the poll descriptors of the PCM,
+ * which are also handed to the I/O reactor in the reactor mode,
+ * and the available frames are timestamped with the status htstamp.
+ * Any ALSA PCM name can be used as the device name,
+ * including plugins like "null" for machines without audio hardware.
+ **********************************************************************/
+
+//the number of periods in the requested buffer latency
+static const unsigned ALSA_NUM_PERIODS = 4;
+
+//the channel limit reported for plugins that accept any channel count
+static const unsigned ALSA_MAX_CHANNELS = 64;
+
+//give up on a blocking call after this long without the device being ready
+static const int ALSA_POLL_TIMEOUT_MS = 2000;
+
+static double timespecToSeconds(const snd_htimestamp_t &ts)
+{
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static snd_pcm_format_t alsaFormat(const AudioSampleType type)
+{
+    switch (type)
+    {
+    case AUDIO_FLOAT32: return SND_PCM_FORMAT_FLOAT;
+    case AUDIO_INT32: return SND_PCM_FORMAT_S32;
+    case AUDIO_INT24: return SND_PCM_FORMAT_S24_3LE;
+    case AUDIO_INT16: return SND_PCM_FORMAT_S16;
+    case AUDIO_INT8: return SND_PCM_FORMAT_S8;
+    case AUDIO_UINT8: return SND_PCM_FORMAT_U8;
+    }
+    return SND_PCM_FORMAT_UNKNOWN;
+}
+
+/***********************************************************************
+ * Memory-mapped ALSA stream
+ **********************************************************************/
+class AlsaStream : public AudioStream
+{
+public:
+    AlsaStream(snd_pcm_t *pcm, const AudioStreamArgs &args):
+        _pcm(pcm),
+        _isSink(args.isSink),
+        _interleaved(args.interleaved),
+        _numChans(args.numChans),
+        _sampleBytes(audioSampleSize(args.sampleType)),
+        _rate(args.sampleRate),
+        _bufferFrames(0),
+        _periodFrames(0),
+        _xrun(false),
+        _availableTime(0.0)
+    {
+        this->setupHardware(args);
+        this->setupSoftware();
+
+        //the poll descriptors are allocated once for the blocking calls
+        const int count = snd_pcm_poll_descriptors_count(_pcm);
+        if (count <= 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_poll_descriptors_count: " + std::string(snd_strerror(count)));
+        _pollFds.resize(count);
+        snd_pcm_poll_descriptors(_pcm, _pollFds.data(), _pollFds.size());
+    }
+
+    ~AlsaStream(void)
+    {
+        snd_pcm_close(_pcm);
+    }
+
+    void start(void)
+    {
+        _xrun = false;
+        int err = snd_pcm_prepare(_pcm);
+        if (err < 0) throw Pothos::Exception("AlsaStream::start()", "snd_pcm_prepare: " + std::string(snd_strerror(err)));
+
+        //playback starts at the start threshold once the first period is written
+        if (_isSink) return;
+        err = snd_pcm_start(_pcm);
+        if (err < 0) throw Pothos::Exception("AlsaStream::start()", "snd_pcm_start: " + std::string(snd_strerror(err)));
+    }
+
+    void stop(void)
+    {
+        const int err = snd_pcm_drop(_pcm);
+        if (err < 0) throw Pothos::Exception("AlsaStream::stop()", "snd_pcm_drop: " + std::string(snd_strerror(err)));
+    }
+
+    long available(void)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(_pcm);
+        if (avail < 0)
+        {
+            //restart after an xrun and report it with the next transfer
+            const int err = this->recover(int(avail));
+            if (err < 0) return err;
+            avail = snd_pcm_avail_update(_pcm);
+            if (avail < 0) return long(avail);
+        }
+
+        //the hardware timestamp of the last pointer update
+        snd_pcm_uframes_t htAvail = 0;
+        snd_htimestamp_t tstamp;
+        if (snd_pcm_htimestamp(_pcm, &htAvail, &tstamp) == 0 and (tstamp.tv_sec != 0 or tstamp.tv_nsec != 0))
+        {
+            _availableTime = timespecToSeconds(tstamp);
+        }
+        else _availableTime = this->time();
+        return long(avail);
+    }
+
+    int read(void *buffer, const unsigned long frames)
+    {
+        return this->transfer(buffer, frames);
+    }
+
+    int write(const void *buffer, const unsigned long frames)
+    {
+        return this->transfer(const_cast<void *>(buffer), frames);
+    }
+
+    double time(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec*1e-9;
+    }
+
+    double availableTime(void)
+    {
+        return _availableTime;
+    }
+
+    double sampleRate(void)
+    {
+        return _rate;
+    }
+
+    double latency(void)
+    {
+        return _bufferFrames/_rate;
+    }
+
+    std::string errorText(const int status)
+    {
+        if (status == AUDIO_XRUN) return _isSink?"Output underflowed":"Input overflowed";
+        return snd_strerror(status);
+    }
+
+    std::vector<AudioPollFd> pollDescriptors(void)
+    {
+        std::vector<AudioPollFd> fds;
+        for (const auto &pfd : _pollFds)
+        {
+            AudioPollFd fd;
+            fd.fd = pfd.fd;
+            fd.events = pfd.events;
+            fd.revents = 0;
+            fds.push_back(fd);
+        }
+        return fds;
+    }
+
+    //! The PCM demangles the events, and an error is recovered before the next transfer
+    bool pollReady(std::vector<AudioPollFd> &fds)
+    {
+        for (size_t i = 0; i < fds.size() and i < _pollFds.size(); i++) _pollFds[i].revents = fds[i].revents;
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents(_pcm, _pollFds.data(), _pollFds.size(), &revents);
+        if ((revents & POLLERR) != 0) this->recover(-EPIPE);
+        return (revents & (POLLIN | POLLOUT | POLLERR)) != 0;
+    }
+
+private:
+    void setupHardware(const AudioStreamArgs &args)
+    {
+        snd_pcm_hw_params_t *hw = nullptr;
+        snd_pcm_hw_params_alloca(&hw);
+        int err = snd_pcm_hw_params_any(_pcm, hw);
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params_any: " + std::string(snd_strerror(err)));
+
+        //prefer the layout of the Pothos buffers, the copy handles any other layout
+        const auto preferred = _interleaved?SND_PCM_ACCESS_MMAP_INTERLEAVED:SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+        const auto fallback = _interleaved?SND_PCM_ACCESS_MMAP_NONINTERLEAVED:SND_PCM_ACCESS_MMAP_INTERLEAVED;
+        if (snd_pcm_hw_params_set_access(_pcm, hw, preferred) < 0 and
+            snd_pcm_hw_params_set_access(_pcm, hw, fallback) < 0 and
+            (err = snd_pcm_hw_params_set_access(_pcm, hw, SND_PCM_ACCESS_MMAP_COMPLEX)) < 0)
+        {
+            throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params_set_access: " + std::string(snd_strerror(err)));
+        }
+
+        err = snd_pcm_hw_params_set_format(_pcm, hw, alsaFormat(args.sampleType));
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params_set_format: " + std::string(snd_strerror(err)));
+
+        err = snd_pcm_hw_params_set_channels(_pcm, hw, unsigned(_numChans));
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params_set_channels: " + std::string(snd_strerror(err)));
+
+        unsigned rate = unsigned(args.sampleRate + 0.5);
+        err = snd_pcm_hw_params_set_rate(_pcm, hw, rate, 0);
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params_set_rate: " + std::string(snd_strerror(err)));
+
+        unsigned bufferTime = unsigned(args.latency*1e6);
+        unsigned periodTime = bufferTime/ALSA_NUM_PERIODS;
+        snd_pcm_hw_params_set_buffer_time_near(_pcm, hw, &bufferTime, nullptr);
+        snd_pcm_hw_params_set_period_time_near(_pcm, hw, &periodTime, nullptr);
+
+        err = snd_pcm_hw_params(_pcm, hw);
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_hw_params: " + std::string(snd_strerror(err)));
+
+        snd_pcm_hw_params_get_buffer_size(hw, &_bufferFrames);
+        snd_pcm_hw_params_get_period_size(hw, &_periodFrames, nullptr);
+        unsigned num = 0, den = 0;
+        if (snd_pcm_hw_params_get_rate_numden(hw, &num, &den) == 0 and den != 0) _rate = double(num)/den;
+    }
+
+    void setupSoftware(void)
+    {
+        snd_pcm_sw_params_t *sw = nullptr;
+        snd_pcm_sw_params_alloca(&sw);
+        snd_pcm_sw_params_current(_pcm, sw);
+
+        //wake up once per period, and start playback after the first period
+        snd_pcm_sw_params_set_avail_min(_pcm, sw, _periodFrames);
+        snd_pcm_sw_params_set_start_threshold(_pcm, sw, _isSink?_periodFrames:1);
+        snd_pcm_sw_params_set_tstamp_mode(_pcm, sw, SND_PCM_TSTAMP_ENABLE);
+        snd_pcm_sw_params_set_tstamp_type(_pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+        const int err = snd_pcm_sw_params(_pcm, sw);
+        if (err < 0) throw Pothos::Exception("AlsaStream()", "snd_pcm_sw_params: " + std::string(snd_strerror(err)));
+    }
+
+    //! Restart the stream after an xrun or a suspend
+    int recover(const int err)
+    {
+        if (err != -EPIPE and err != -ESTRPIPE) return err;
+        _xrun = true;
+        int ret = snd_pcm_recover(_pcm, err, 1);
+        if (ret < 0) return ret;
+        if (not _isSink) ret = snd_pcm_start(_pcm);
+        return (ret < 0)?ret:0;
+    }
+
+    //! Wait on the poll descriptors until the device is ready
+    int wait(void)
+    {
+        const int ready = poll(_pollFds.data(), _pollFds.size(), ALSA_POLL_TIMEOUT_MS);
+        if (ready == 0) return -EIO;
+        if (ready < 0) return (errno == EINTR)?0:-errno;
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents(_pcm, _pollFds.data(), _pollFds.size(), &revents);
+        if (revents & POLLERR) return this->recover(-EPIPE);
+        return 0;
+    }
+
+    //! Transfer frames between the buffer and the PCM ring, blocking until all are done
+    int transfer(void *buffer, const unsigned long frames)
+    {
+        unsigned long done = 0;
+        while (done < frames)
+        {
+            snd_pcm_sframes_t avail = snd_pcm_avail_update(_pcm);
+            if (avail < 0)
+            {
+                const int err = this->recover(int(avail));
+                if (err < 0) return err;
+                continue;
+            }
+
+            //wait for a period, or for the remainder when it is shorter
+            const snd_pcm_uframes_t wanted = std::min<snd_pcm_uframes_t>(frames - done, _periodFrames);
+            if (snd_pcm_uframes_t(avail) < wanted)
+            {
+                //playback below the start threshold must be started to drain
+                if (_isSink and snd_pcm_state(_pcm) == SND_PCM_STATE_PREPARED and avail == 0) snd_pcm_start(_pcm);
+                const int err = this->wait();
+                if (err < 0) return err;
+                continue;
+            }
+
+            snd_pcm_uframes_t n = std::min<snd_pcm_uframes_t>(avail, frames - done);
+            while (n != 0)
+            {
+                const snd_pcm_channel_area_t *areas = nullptr;
+                snd_pcm_uframes_t offset = 0, chunk = n;
+                int err = snd_pcm_mmap_begin(_pcm, &areas, &offset, &chunk);
+                if (err < 0)
+                {
+                    err = this->recover(err);
+                    if (err < 0) return err;
+                    break;
+                }
+                this->copyFrames(areas, offset, chunk, buffer, done);
+                const snd_pcm_sframes_t committed = snd_pcm_mmap_commit(_pcm, offset, chunk);
+                if (committed < 0 or snd_pcm_uframes_t(committed) != chunk)
+                {
+                    err = this->recover((committed < 0)?int(committed):-EPIPE);
+                    if (err < 0) return err;
+                    break;
+                }
+                done += chunk;
+                n -= chunk;
+            }
+        }
+
+        const bool xrun = _xrun;
+        _xrun = false;
+        return xrun?AUDIO_XRUN:AUDIO_OK;
+    }
+
+    /*!
+     * Copy frames between the mapped areas and the Pothos buffer.
+     * Matching layouts copy whole blocks, other layouts copy per sample.
+     */
+    void copyFrames(const snd_pcm_channel_area_t *areas, const snd_pcm_uframes_t offset,
+        const snd_pcm_uframes_t frames, void *buffer, const unsigned long bufferOffset)
+    {
+        const size_t frameBytes = _sampleBytes*_numChans;
+        if (_interleaved)
+        {
+            char *user = (char *)buffer + bufferOffset*frameBytes;
+            bool contiguous = areas[0].step == frameBytes*8;
+            for (size_t c = 0; c < _numChans; c++)
+            {
+                contiguous = contiguous and areas[c].addr == areas[0].addr and areas[c].first == areas[0].first + c*_sampleBytes*8;
+            }
+            if (contiguous)
+            {
+                char *dev = (char *)areas[0].addr + areas[0].first/8 + offset*frameBytes;
+                if (_isSink) std::memcpy(dev, user, frames*frameBytes);
+                else std::memcpy(user, dev, frames*frameBytes);
+                return;
+            }
+            for (size_t c = 0; c < _numChans; c++)
+            {
+                this->copyChannel(areas[c], offset, frames, user + c*_sampleBytes, frameBytes);
+            }
+            return;
+        }
+
+        char **users = (char **)buffer;
+        for (size_t c = 0; c < _numChans; c++)
+        {
+            char *user = users[c] + bufferOffset*_sampleBytes;
+            if (areas[c].step == _sampleBytes*8)
+            {
+                char *dev = (char *)areas[c].addr + areas[c].first/8 + offset*_sampleBytes;
+                if (_isSink) std::memcpy(dev, user, frames*_sampleBytes);
+                else std::memcpy(user, dev, frames*_sampleBytes);
+            }
+            else this->copyChannel(areas[c], offset, frames, user, _sampleBytes);
+        }
+    }
+
+    void copyChannel(const snd_pcm_channel_area_t &area, const snd_pcm_uframes_t offset,
+        const snd_pcm_uframes_t frames, char *user, const size_t userStep)
+    {
+        char *dev = (char *)area.addr + (area.first + offset*area.step)/8;
+        const size_t devStep = area.step/8;
+        for (snd_pcm_uframes_t i = 0; i < frames; i++)
+        {
+            if (_isSink) std::memcpy(dev, user, _sampleBytes);
+            else std::memcpy(user, dev, _sampleBytes);
+            dev += devStep;
+            user += userStep;
+        }
+    }
+
+    snd_pcm_t *_pcm;
+    const bool _isSink;
+    const bool _interleaved;
+    const size_t _numChans;
+    const size_t _sampleBytes;
+    double _rate;
+    snd_pcm_uframes_t _bufferFrames;
+    snd_pcm_uframes_t _periodFrames;
+    bool _xrun;
+    double _availableTime;
+    std::vector<struct pollfd> _pollFds;
+};
+
+/***********************************************************************
+ * ALSA backend
+ **********************************************************************/
+class AlsaBackend : public AudioBackend
+{
+public:
+    std::vector<AudioDeviceInfo> devices(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_devices.empty()) this->enumerate();
+        return _devices;
+    }
+
+    int defaultDevice(const bool)
+    {
+        const int index = this->lookupDevice("default");
+        return (index < 0)?0:index;
+    }
+
+    //! Any PCM name that opens is a device, like a plugin from the ALSA configuration
+    int lookupDevice(const std::string &name)
+    {
+        const int index = AudioBackend::lookupDevice(name);
+        if (index >= 0) return index;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        AudioDeviceInfo device;
+        if (not probe(name, device)) return -1;
+        _devices.push_back(device);
+        return int(_devices.size()-1);
+    }
+
+    std::unique_ptr<AudioStream> open(const AudioStreamArgs &args)
+    {
+        const auto devices = this->devices();
+        if (args.device < 0 or args.device >= int(devices.size())) throw Pothos::RangeException(
+            "AlsaBackend::open()", "Device index out of range");
+        const auto &name = devices[args.device].name;
+
+        snd_pcm_t *pcm = nullptr;
+        const int err = snd_pcm_open(&pcm, name.c_str(), args.isSink?SND_PCM_STREAM_PLAYBACK:SND_PCM_STREAM_CAPTURE, 0);
+        if (err < 0) throw Pothos::Exception("AlsaBackend::open("+name+")", "snd_pcm_open: " + std::string(snd_strerror(err)));
+        try
+        {
+            return std::unique_ptr<AudioStream>(new AlsaStream(pcm, args));
+        }
+        catch (...)
+        {
+            snd_pcm_close(pcm);
+            throw;
+        }
+    }
+
+private:
+    //! The PCM names from the configuration hints, opened to query their channels
+    void enumerate(void)
+    {
+        void **hints = nullptr;
+        if (snd_device_name_hint(-1, "pcm", &hints) < 0) return;
+        for (void **hint = hints; *hint != nullptr; hint++)
+        {
+            char *name = snd_device_name_get_hint(*hint, "NAME");
+            if (name == nullptr) continue;
+            AudioDeviceInfo device;
+            if (probe(name, device)) _devices.push_back(device);
+            std::free(name);
+        }
+        snd_device_name_free_hint(hints);
+    }
+
+    static unsigned maxChannels(const std::string &name, const snd_pcm_stream_t stream)
+    {
+        snd_pcm_t *pcm = nullptr;
+        if (snd_pcm_open(&pcm, name.c_str(), stream, SND_PCM_NONBLOCK) < 0) return 0;
+        snd_pcm_hw_params_t *hw = nullptr;
+        snd_pcm_hw_params_alloca(&hw);
+        unsigned channels = 0;
+        if (snd_pcm_hw_params_any(pcm, hw) >= 0) snd_pcm_hw_params_get_channels_max(hw, &channels);
+        snd_pcm_close(pcm);
+        return std::min(channels, ALSA_MAX_CHANNELS);
+    }
+
+    static bool probe(const std::string &name, AudioDeviceInfo &device)
+    {
+        device.name = name;
+        device.hostApi = "ALSA";
+        device.maxInputChannels = int(maxChannels(name, SND_PCM_STREAM_CAPTURE));
+        device.maxOutputChannels = int(maxChannels(name, SND_PCM_STREAM_PLAYBACK));
+        device.defaultSampleRate = 48000;
+        device.defaultLowInputLatency = device.defaultLowOutputLatency = 0.005;
+        device.defaultHighInputLatency = device.defaultHighOutputLatency = 0.04;
+        return device.maxInputChannels != 0 or device.maxOutputChannels != 0;
+    }
+
+    std::mutex _mutex;
+    std::vector<AudioDeviceInfo> _devices;
+};
+
+static std::shared_ptr<AudioBackend> makeAlsaBackend(void)
+{
+    return std::shared_ptr<AudioBackend>(new AlsaBackend());
+}
+
+pothos_static_block(registerAlsaBackend)
+{
+    Pothos::PluginRegistry::add("/audio/backends/alsa", Pothos::Callable(&makeAlsaBackend));
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include <Pothos/Plugin.hpp>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <mutex>
+
+AudioStream::~AudioStream(void)
+{
+    return;
+}
+
+double AudioStream::availableTime(void)
+{
+    return this->time();
+}
+
+std::vector<AudioPollFd> AudioStream::pollDescriptors(void)
+{
+    return std::vector<AudioPollFd>();
+}
+
+bool AudioStream::pollReady(std::vector<AudioPollFd> &)
+{
+    return true;
+}
+
+AudioBackend::~AudioBackend(void)
+{
+    return;
+}
+
+int AudioBackend::lookupDevice(const std::string &name)
+{
+    const auto devices = this->devices();
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (devices[i].name == name) return int(i);
+    }
+    return -1;
+}
+
+int AudioBackend::resolveDevice(const std::string &deviceName, const bool isSink)
+{
+    const auto devices = this->devices();
+    if (devices.empty()) throw Pothos::NotFoundException(
+        "AudioBackend::resolveDevice()", "No devices available");
+
+    //empty name, use default
+    if (deviceName.empty()) return this->defaultDevice(isSink);
+
+    //numeric name, use index
+    if (std::all_of(deviceName.begin(), deviceName.end(), ::isdigit))
+    {
+        const int index = std::stoi(deviceName);
+        if (index >= int(devices.size())) throw Pothos::RangeException(
+            "AudioBackend::resolveDevice("+deviceName+")", "Device index out of range");
+        return index;
+    }
+
+    //find the match by name
+    const int index = this->lookupDevice(deviceName);
+    if (index >= 0) return index;
+
+    //cant locate by name
+    throw Pothos::NotFoundException("AudioBackend::resolveDevice("+deviceName+")", "No matching device");
+}
+
+std::shared_ptr<AudioBackend> AudioBackend::make(const std::string &name)
+{
+    //blocks share the live instance of a backend,
+    //so the daemon connections and device enumerations are made once
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<AudioBackend>> backends;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto backend = backends[name].lock();
+    if (backend) return backend;
+
+    const std::string path = "/audio/backends/" + name;
+    if (not Pothos::PluginRegistry::exists(path)) throw Pothos::NotFoundException(
+        "AudioBackend::make("+name+")", "No matching backend");
+    const auto factory = Pothos::PluginRegistry::get(path).getObject().extract<Pothos::Callable>();
+    backend = factory.call<std::shared_ptr<AudioBackend>>();
+    backends[name] = backend;
+    return backend;
+}
+
+std::vector<std::string> AudioBackend::names(void)
+{
+    return Pothos::PluginRegistry::list("/audio/backends");
+}
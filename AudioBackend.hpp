@@ -0,0 +1,137 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include "AudioFormats.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Audio device backends
+ *
+ * A backend gives the audio blocks access to the devices of one audio API.
+ * The blocks use the blocking stream model: work() asks for the available
+ * frames, then reads or writes them. Backends over callback APIs
+ * exchange the frames with their callback through a ring buffer.
+ * Backends register a factory under /audio/backends/<name>
+ * in the plugin registry, and each block selects one by name.
+ **********************************************************************/
+
+//! The status of a stream read or write, other failures are negative
+enum AudioStatus
+{
+    AUDIO_OK = 0,
+
+    //! Samples were lost before the call: an overflow on input, an underflow on output
+    AUDIO_XRUN = 1,
+};
+
+//! A descriptor that signals stream readiness, the event bits are the poll() bits
+struct AudioPollFd
+{
+    int fd;
+    short events;
+    short revents;
+};
+
+struct AudioDeviceInfo
+{
+    std::string name;
+    std::string hostApi;
+    int maxInputChannels;
+    int maxOutputChannels;
+    double defaultSampleRate;
+    double defaultLowInputLatency;
+    double defaultHighInputLatency;
+    double defaultLowOutputLatency;
+    double defaultHighOutputLatency;
+};
+
+//! The configuration of a stream, the device is an index into the devices()
+struct AudioStreamArgs
+{
+    bool isSink;
+    int device;
+    size_t numChans;
+    AudioSampleType sampleType;
+    bool interleaved;
+    double sampleRate;
+
+    //! The requested latency in seconds
+    double latency;
+};
+
+//! An open input or output stream of a backend
+class AudioStream
+{
+public:
+    virtual ~AudioStream(void);
+
+    //! Start or stop the flow of samples, throws on error
+    virtual void start(void) = 0;
+    virtual void stop(void) = 0;
+
+    //! The frames that can be read or written without blocking, negative on error
+    virtual long available(void) = 0;
+
+    /*!
+     * Read or write frames, blocking until all of them are transferred.
+     * The buffer is one pointer to interleaved frames,
+     * or an array of one pointer per channel.
+     */
+    virtual int read(void *buffer, const unsigned long frames) = 0;
+    virtual int write(const void *buffer, const unsigned long frames) = 0;
+
+    //! The stream clock in seconds
+    virtual double time(void) = 0;
+
+    //! The time on the stream clock when the last available() count was sampled
+    virtual double availableTime(void);
+
+    //! The actual sample rate and the input or output latency in seconds
+    virtual double sampleRate(void) = 0;
+    virtual double latency(void) = 0;
+
+    //! The description of a negative status or available() result
+    virtual std::string errorText(const int status) = 0;
+
+    //! The descriptors to poll for readiness, empty when the stream cannot be polled
+    virtual std::vector<AudioPollFd> pollDescriptors(void);
+
+    //! Whether the returned events of the polled descriptors mean the stream is ready
+    virtual bool pollReady(std::vector<AudioPollFd> &fds);
+};
+
+class AudioBackend
+{
+public:
+    virtual ~AudioBackend(void);
+
+    /*!
+     * Make a backend by its registered name, throws when it is not registered.
+     * The instance is shared while in use, later calls return the same backend.
+     */
+    static std::shared_ptr<AudioBackend> make(const std::string &name);
+
+    //! The names of the registered backends
+    static std::vector<std::string> names(void);
+
+    virtual std::vector<AudioDeviceInfo> devices(void) = 0;
+
+    //! The index of the default input or output device
+    virtual int defaultDevice(const bool isSink) = 0;
+
+    //! The index of the device with the given name, negative when there is none
+    virtual int lookupDevice(const std::string &name);
+
+    /*!
+     * Resolve the device parameter of the audio blocks to a device index:
+     * the default device when empty, an index when numeric, otherwise a name.
+     * Throws when the device does not exist.
+     */
+    int resolveDevice(const std::string &deviceName, const bool isSink);
+
+    //! Open a stream, throws when the configuration is not supported
+    virtual std::unique_ptr<AudioStream> open(const AudioStreamArgs &args) = 0;
+};
@@ -0,0 +1,603 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioTrace.hpp"
+#include "MockPortAudio.hpp"
+#include "RealtimeCheck.hpp"
+#include <Pothos/Framework.hpp>
+#include <Pothos/Init.hpp>
+#include <json.hpp>
+#include <algorithm> //min/max
+#include <chrono>
+#include <cstdlib> //EXIT_SUCCESS
+#include <ctime> //clock
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+/***********************************************************************
+ * Audio work() throughput benchmark
+ *
+ * The benchmark is linked against the audio block sources and the
+ * PortAudio mock library, so the audio blocks run on the mock devices.
+ * The framework is initialized like any other Pothos executable.
+ * The mock devices run on the virtual clock, so blocking device calls
+ * return immediately and the measured rate is the cost of work() itself:
+ * the audio source drives a drain block and a feed block drives the audio sink.
+ *
+ * Usage: AudioBenchmark [--duration=0.2] [--blocks=source,sink]
+ *   [--dtypes=float32,int32,int16,int8,uint8] [--channels=1,2,8,32,128]
+ *   [--modes=INTERLEAVED,PORTPERCHAN] [--chunks=64,256,1024,4096]
+ *   [--outputs=STREAM,PACKET]
+ *
+ * The results are printed as JSON on stdout, one entry per combination.
+ * With --trace=file.json, a timeline trace of all runs is saved in the
+ * Chrome trace event format.
+ * Each work() call of the audio blocks makes one device call in the
+ * stream mode, so the device call counts of the mock are the work() calls.
+ *
+ * The outputs list selects the output modes of the audio source,
+ * in packet mode the chunk size is the packet size.
+ *
+ * The AudioRealtimeCheck build of the benchmark (POTHOS_AUDIO_RT_CHECK)
+ * arms the real-time check during each measurement of this sweep,
+ * reports the allocations and mutex locks made inside work(),
+ * and exits with an error code when there were any.
+ * The packet mode of the source is included by default in this build.
+ * Each posted packet may allocate its message object and metadata,
+ * up to RT_PACKET_ALLOCS per packet, but no sample memory.
+ *
+ * Scaling mode: AudioBenchmark --scale=1,8,16,32,48 [--threads=0,2,8] [--duration=2]
+ *
+ * The scaling mode runs N audio blocks in one topology, alternating
+ * sources and sinks on stereo devices, on the real-time clock of the mock.
+ * Each N is repeated for each thread pool size, where 0 is a thread per block.
+ * It reports the aggregate rate relative to real-time, the overflows and
+ * underflows, the age of captured samples when the source reads them
+ * (the scheduler latency), and the CPU time as a number of busy cores.
+ *
+ * Fault scenarios: AudioBenchmark --scenario=file.json[,file.json...]
+ *
+ * A scenario runs one stereo source or sink on the real-time clock with
+ * faults injected at scripted times, then checks the expectations.
+ * The process exits with an error code when any expectation fails.
+ * {
+ *   "block": "source",          //source or sink
+ *   "duration": 3.0,            //run time in seconds
+ *   "backoffTime": 0,           //setBackoffTime() in milliseconds
+ *   "device": {"faults": [{"type": "XRUN", "time": 1.0},
+ *       {"type": "ERROR", "time": 2.0, "duration": 0.1}]}, //mock device keys
+ *   "stalls": [{"time": 1.5, "duration": 0.5, "delay": 0.05}], //slow consumer or producer:
+ *       //each work() sleeps for delay seconds during the window
+ *   "expect": {"maxFramesDropped": 9600, "maxXruns": 4, "minErrors": 1,
+ *       "maxRecoveryTime": 0.5, "maxCpuCores": 0.5}
+ * }
+ * The recovery time is the time from the end of the last scripted fault
+ * or stall to the last overflow or underflow, so cascading xruns
+ * after the fault has cleared show up as a long recovery.
+ * The scenarios in the scenarios directory run as ctest tests.
+ **********************************************************************/
+
+static const size_t MAX_BENCH_CHANNELS = 128;
+static const double BENCH_SAMPLE_RATE = 48000.0;
+
+//the allocations of one posted packet: the message object and its metadata entries
+static const unsigned long long RT_PACKET_ALLOCS = 8;
+
+/***********************************************************************
+ * Feed and drain blocks at the other end of the audio block
+ **********************************************************************/
+static Pothos::BufferManager::Sptr makeChunkManager(const Pothos::DType &dtype, const size_t chunkSize)
+{
+    Pothos::BufferManagerArgs args;
+    args.bufferSize = dtype.size()*chunkSize;
+    args.numBuffers = 8;
+    return Pothos::BufferManager::make("generic", args);
+}
+
+/*!
+ * Scripted windows of slow work() calls in the feed and drain blocks.
+ * The times are relative to the block activation.
+ */
+class BenchStalls
+{
+public:
+    void addStall(const double time, const double duration, const double delay)
+    {
+        _windows.push_back(std::vector<double>{time, time+duration, delay});
+    }
+
+    void start(void)
+    {
+        _start = std::chrono::steady_clock::now();
+    }
+
+    void apply(void) const
+    {
+        if (_windows.empty()) return;
+        const std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - _start);
+        for (const auto &w : _windows)
+        {
+            if (elapsed.count() < w[0] or elapsed.count() >= w[1]) continue;
+            std::this_thread::sleep_for(std::chrono::duration<double>(w[2]));
+            return;
+        }
+    }
+
+private:
+    std::vector<std::vector<double>> _windows;
+    std::chrono::steady_clock::time_point _start;
+};
+
+class BenchFeed : public Pothos::Block
+{
+public:
+    BenchFeed(const Pothos::DType &dtype, const size_t numPorts, const size_t chunkSize):
+        _chunkSize(chunkSize)
+    {
+        for (size_t i = 0; i < numPorts; i++) this->setupOutput(i, dtype);
+        this->registerCall(this, POTHOS_FCN_TUPLE(BenchFeed, addStall));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numPorts, const size_t chunkSize)
+    {
+        return new BenchFeed(dtype, numPorts, chunkSize);
+    }
+
+    Pothos::BufferManager::Sptr getOutputBufferManager(const std::string &name, const std::string &)
+    {
+        return makeChunkManager(this->output(name)->dtype(), _chunkSize);
+    }
+
+    void addStall(const double time, const double duration, const double delay)
+    {
+        _stalls.addStall(time, duration, delay);
+    }
+
+    void activate(void)
+    {
+        _stalls.start();
+    }
+
+    void work(void)
+    {
+        _stalls.apply();
+        const size_t num = std::min(_chunkSize, this->workInfo().minOutElements);
+        if (num == 0) return;
+        for (auto port : this->outputs()) port->produce(num);
+    }
+
+private:
+    const size_t _chunkSize;
+    BenchStalls _stalls;
+};
+
+class BenchDrain : public Pothos::Block
+{
+public:
+    BenchDrain(const Pothos::DType &dtype, const size_t numPorts, const size_t chunkSize):
+        _chunkSize(chunkSize)
+    {
+        for (size_t i = 0; i < numPorts; i++) this->setupInput(i, dtype);
+        this->registerCall(this, POTHOS_FCN_TUPLE(BenchDrain, addStall));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numPorts, const size_t chunkSize)
+    {
+        return new BenchDrain(dtype, numPorts, chunkSize);
+    }
+
+    Pothos::BufferManager::Sptr getInputBufferManager(const std::string &name, const std::string &)
+    {
+        return makeChunkManager(this->input(name)->dtype(), _chunkSize);
+    }
+
+    void addStall(const double time, const double duration, const double delay)
+    {
+        _stalls.addStall(time, duration, delay);
+    }
+
+    void activate(void)
+    {
+        _stalls.start();
+    }
+
+    void work(void)
+    {
+        _stalls.apply();
+        for (auto port : this->inputs())
+        {
+            while (port->hasMessage()) port->popMessage();
+            port->consume(port->elements());
+        }
+    }
+
+private:
+    const size_t _chunkSize;
+    BenchStalls _stalls;
+};
+
+static Pothos::BlockRegistry registerBenchFeed(
+    "/audio/bench/feed", &BenchFeed::make);
+
+static Pothos::BlockRegistry registerBenchDrain(
+    "/audio/bench/drain", &BenchDrain::make);
+
+/***********************************************************************
+ * One benchmark run
+ **********************************************************************/
+struct BenchConfig
+{
+    std::string block;
+    std::string dtype;
+    size_t numChans;
+    std::string chanMode;
+    size_t chunkSize;
+    std::string outputMode;
+};
+
+static json runBenchmark(const BenchConfig &config, const double duration)
+{
+    const bool isSink = config.block == "sink";
+    const bool interleaved = config.chanMode == "INTERLEAVED";
+    const auto portType = interleaved?Pothos::DType::fromDType(config.dtype, config.numChans):Pothos::DType(config.dtype);
+    const size_t numPorts = interleaved?1:config.numChans;
+
+    auto audio = Pothos::BlockRegistry::make(isSink?"/audio/sink":"/audio/source", config.dtype, config.numChans, config.chanMode);
+    audio.call("setupDevice", std::string());
+    audio.call("setupStream", BENCH_SAMPLE_RATE);
+    const bool packetMode = not isSink and config.outputMode == "PACKET";
+    if (packetMode)
+    {
+        audio.call("setPacketSize", config.chunkSize);
+        audio.call("setOutputMode", config.outputMode);
+    }
+    auto other = Pothos::BlockRegistry::make(isSink?"/audio/bench/feed":"/audio/bench/drain", portType, numPorts, config.chunkSize);
+
+    Pothos::Topology topology;
+    for (size_t i = 0; i < numPorts; i++)
+    {
+        if (isSink) topology.connect(other, i, audio, i);
+        else topology.connect(audio, i, other, i);
+    }
+    topology.commit();
+
+    #ifdef POTHOS_AUDIO_RT_CHECK
+    //let the first calls settle before checking the steady state
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration/4));
+    realtimeCheckReset();
+    realtimeCheckArm(true);
+    #endif
+
+    //measure over the duration once the flow is running
+    mockAudioResetStats();
+    const auto t0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    const auto stats = mockAudioGetStats();
+    const std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - t0);
+
+    #ifdef POTHOS_AUDIO_RT_CHECK
+    realtimeCheckArm(false);
+    #endif
+
+    topology.disconnectAll();
+    topology.commit();
+
+    const double frames = double(isSink?stats.framesWritten:stats.framesRead);
+    const double calls = double(isSink?stats.numWrites:stats.numReads);
+    json result;
+    result["block"] = config.block;
+    result["dtype"] = config.dtype;
+    result["numChans"] = config.numChans;
+    result["chanMode"] = config.chanMode;
+    result["chunkSize"] = config.chunkSize;
+    if (not isSink) result["outputMode"] = config.outputMode;
+    result["seconds"] = elapsed.count();
+    result["frames"] = frames;
+    result["calls"] = calls;
+    result["framesPerSec"] = frames/elapsed.count();
+    result["nsPerFrame"] = (frames == 0.0)?0.0:(elapsed.count()*1e9/frames);
+    result["callsPerSec"] = calls/elapsed.count();
+    #ifdef POTHOS_AUDIO_RT_CHECK
+    const auto violations = realtimeCheckResults();
+    result["rtAllocs"] = violations.numAllocs;
+    result["rtLocks"] = violations.numLocks;
+    result["rtFirstScope"] = violations.firstScope;
+    result["rtFirstCall"] = violations.firstCall;
+    const unsigned long long numPackets = packetMode?(numPorts*(unsigned long long)(frames)/config.chunkSize + numPorts):0;
+    result["rtAllowedAllocs"] = numPackets*RT_PACKET_ALLOCS;
+    result["pass"] = violations.numAllocs <= numPackets*RT_PACKET_ALLOCS and violations.numLocks == 0;
+    #endif
+    return result;
+}
+
+/***********************************************************************
+ * Many audio blocks in one topology
+ **********************************************************************/
+static json runScaling(const size_t numBlocks, const size_t numThreads, const double duration)
+{
+    const std::string dtype("float32");
+    const size_t numChans = 2;
+
+    Pothos::Topology topology;
+    if (numThreads != 0) topology.setThreadPool(Pothos::ThreadPool(Pothos::ThreadPoolArgs(numThreads)));
+
+    //create the blocks, the setup includes the per block stream open
+    const auto setup0 = std::chrono::steady_clock::now();
+    std::vector<Pothos::Proxy> audioBlocks;
+    size_t numSources = 0;
+    for (size_t i = 0; i < numBlocks; i++)
+    {
+        const bool isSink = (i % 2) == 1;
+        auto audio = Pothos::BlockRegistry::make(isSink?"/audio/sink":"/audio/source", dtype, numChans, std::string("INTERLEAVED"));
+        audio.call("setupDevice", std::string());
+        audio.call("setupStream", BENCH_SAMPLE_RATE);
+        auto other = Pothos::BlockRegistry::make(isSink?"/audio/bench/feed":"/audio/bench/drain",
+            Pothos::DType::fromDType(dtype, numChans), size_t(1), size_t(MIN_FRAMES_BLOCKING));
+        if (isSink) topology.connect(other, 0, audio, 0);
+        else topology.connect(audio, 0, other, 0);
+        if (not isSink) numSources++;
+        audioBlocks.push_back(audio);
+    }
+    const std::chrono::duration<double> setupTime(std::chrono::steady_clock::now() - setup0);
+    topology.commit();
+
+    //measure over the duration once the flow is running
+    mockAudioResetStats();
+    const auto cpu0 = std::clock();
+    const auto t0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    const auto stats = mockAudioGetStats();
+    const std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - t0);
+    const auto cpu1 = std::clock();
+
+    topology.disconnectAll();
+    topology.commit();
+
+    const double frames = double(stats.framesRead + stats.framesWritten);
+    json result;
+    result["numBlocks"] = numBlocks;
+    result["numThreads"] = numThreads;
+    result["setupSeconds"] = setupTime.count();
+    result["seconds"] = elapsed.count();
+    result["frames"] = frames;
+    result["framesPerSec"] = frames/elapsed.count();
+    result["realtimeRatio"] = frames/(elapsed.count()*BENCH_SAMPLE_RATE*numBlocks);
+    result["overflows"] = stats.numOverflows;
+    result["underflows"] = stats.numUnderflows;
+    result["readLatencyMeanUs"] = (stats.numReads == 0)?0.0:(stats.readLatencyNs/1e3/stats.numReads);
+    result["readLatencyMaxUs"] = stats.maxReadLatencyNs/1e3;
+    result["cpuCores"] = (double(cpu1 - cpu0)/CLOCKS_PER_SEC)/elapsed.count();
+    result["numSources"] = numSources;
+    return result;
+}
+
+/***********************************************************************
+ * Scripted fault scenario
+ **********************************************************************/
+static json runScenario(const std::string &path)
+{
+    std::ifstream file(path);
+    if (not file) throw Pothos::FileNotFoundException("AudioBenchmark::runScenario("+path+")", "cannot open scenario");
+    const auto scenario = json::parse(file);
+    const auto block = scenario.value("block", std::string("source"));
+    const bool isSink = block == "sink";
+    const double duration = scenario.value("duration", 3.0);
+    const std::string dtype("float32");
+    const size_t numChans = 2;
+
+    //the scenario device replaces the benchmark device
+    json mockJson;
+    mockJson["clock"] = "REALTIME";
+    mockJson["devices"] = json::array({scenario.value("device", json::object())});
+    mockAudioConfigure(mockAudioConfigFromJson(mockJson.dump()));
+
+    //the end of the last scripted disturbance
+    double faultEnd = 0.0;
+    for (const auto &fault : mockJson["devices"][0].value("faults", json::array()))
+    {
+        faultEnd = std::max(faultEnd, fault.value("time", 0.0) + fault.value("duration", 0.0));
+    }
+
+    auto audio = Pothos::BlockRegistry::make(isSink?"/audio/sink":"/audio/source", dtype, numChans, std::string("INTERLEAVED"));
+    audio.call("setupDevice", std::string());
+    audio.call("setupStream", BENCH_SAMPLE_RATE);
+    audio.call("setReportMode", std::string("DISABLED"));
+    audio.call("setBackoffTime", long(scenario.value("backoffTime", 0)));
+    auto other = Pothos::BlockRegistry::make(isSink?"/audio/bench/feed":"/audio/bench/drain",
+        Pothos::DType::fromDType(dtype, numChans), size_t(1), size_t(MIN_FRAMES_BLOCKING));
+    for (const auto &stall : scenario.value("stalls", json::array()))
+    {
+        const double time = stall.value("time", 0.0);
+        const double stallDuration = stall.value("duration", 0.0);
+        other.call("addStall", time, stallDuration, stall.value("delay", 0.0));
+        faultEnd = std::max(faultEnd, time + stallDuration);
+    }
+
+    Pothos::Topology topology;
+    if (isSink) topology.connect(other, 0, audio, 0);
+    else topology.connect(audio, 0, other, 0);
+
+    mockAudioResetStats();
+    const auto cpu0 = std::clock();
+    const auto t0 = std::chrono::steady_clock::now();
+    topology.commit();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    const auto stats = mockAudioGetStats();
+    const std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - t0);
+    const auto cpu1 = std::clock();
+    const auto blockXruns = audio.call<unsigned long long>("getNumXruns");
+
+    topology.disconnectAll();
+    topology.commit();
+
+    const unsigned long long xruns = stats.numOverflows + stats.numUnderflows;
+    const double recoveryTime = (xruns == 0)?0.0:std::max(0.0, stats.lastXrunTime - faultEnd);
+    const double cpuCores = (double(cpu1 - cpu0)/CLOCKS_PER_SEC)/elapsed.count();
+
+    json result;
+    result["scenario"] = path;
+    result["block"] = block;
+    result["seconds"] = elapsed.count();
+    result["frames"] = isSink?stats.framesWritten:stats.framesRead;
+    result["framesDropped"] = stats.framesDropped;
+    result["xruns"] = xruns;
+    result["blockXruns"] = blockXruns;
+    result["errors"] = stats.numErrors;
+    result["lastXrunTime"] = stats.lastXrunTime;
+    result["recoveryTime"] = recoveryTime;
+    result["cpuCores"] = cpuCores;
+
+    //check the expectations
+    json failures = json::array();
+    const auto expect = scenario.value("expect", json::object());
+    if (expect.count("maxFramesDropped") != 0 and stats.framesDropped > expect["maxFramesDropped"].get<unsigned long long>()) failures.push_back("maxFramesDropped");
+    if (expect.count("maxXruns") != 0 and xruns > expect["maxXruns"].get<unsigned long long>()) failures.push_back("maxXruns");
+    if (expect.count("minErrors") != 0 and stats.numErrors < expect["minErrors"].get<unsigned long long>()) failures.push_back("minErrors");
+    if (expect.count("maxRecoveryTime") != 0 and recoveryTime > expect["maxRecoveryTime"].get<double>()) failures.push_back("maxRecoveryTime");
+    if (expect.count("maxCpuCores") != 0 and cpuCores > expect["maxCpuCores"].get<double>()) failures.push_back("maxCpuCores");
+    result["failures"] = failures;
+    result["pass"] = failures.empty();
+    return result;
+}
+
+/***********************************************************************
+ * Command line
+ **********************************************************************/
+static std::vector<std::string> splitList(const std::string &value)
+{
+    std::vector<std::string> out;
+    std::istringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) if (not item.empty()) out.push_back(item);
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    Pothos::ScopedInit init;
+
+    double duration = 0.0;
+    std::vector<std::string> scale;
+    std::vector<std::string> threads{"0"};
+    std::vector<std::string> scenarios;
+    std::string tracePath;
+    std::vector<std::string> blocks{"source", "sink"};
+    std::vector<std::string> dtypes{"float32", "int32", "int16", "int8", "uint8"};
+    std::vector<std::string> channels{"1", "2", "8", "32", "128"};
+    std::vector<std::string> modes{"INTERLEAVED", "PORTPERCHAN"};
+    std::vector<std::string> chunks{"64", "256", "1024", "4096"};
+    #ifdef POTHOS_AUDIO_RT_CHECK
+    std::vector<std::string> outputs{"STREAM", "PACKET"};
+    #else
+    std::vector<std::string> outputs{"STREAM"};
+    #endif
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg(argv[i]);
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const auto value = (eq == std::string::npos)?"":arg.substr(eq+1);
+        if (key == "--duration") duration = std::stod(value);
+        else if (key == "--blocks") blocks = splitList(value);
+        else if (key == "--dtypes") dtypes = splitList(value);
+        else if (key == "--channels") channels = splitList(value);
+        else if (key == "--modes") modes = splitList(value);
+        else if (key == "--chunks") chunks = splitList(value);
+        else if (key == "--outputs") outputs = splitList(value);
+        else if (key == "--scale") scale = splitList(value);
+        else if (key == "--threads") threads = splitList(value);
+        else if (key == "--scenario") scenarios = splitList(value);
+        else if (key == "--trace") tracePath = value;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--duration=seconds] [--blocks=source,sink] [--dtypes=float32,...]"
+                " [--channels=1,2,...] [--modes=INTERLEAVED,PORTPERCHAN] [--chunks=64,256,...] [--outputs=STREAM,PACKET]"
+                " [--scale=1,8,... [--threads=0,2,...]] [--scenario=file.json,...] [--trace=file.json]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    //one full-duplex device with enough channels for the sweep
+    const bool scaling = not scale.empty();
+    if (duration <= 0.0) duration = scaling?2.0:0.2;
+    MockAudioConfig mockConfig;
+    mockConfig.clock = scaling?MOCK_CLOCK_REALTIME:MOCK_CLOCK_VIRTUAL;
+    mockConfig.devices[0].name = "Benchmark Device";
+    mockConfig.devices[0].maxInputChannels = int(MAX_BENCH_CHANNELS);
+    mockConfig.devices[0].maxOutputChannels = int(MAX_BENCH_CHANNELS);
+    mockConfig.devices[0].defaultSampleRate = BENCH_SAMPLE_RATE;
+    mockAudioConfigure(mockConfig);
+
+    if (not tracePath.empty()) audioTraceEnable(true);
+    json results = json::array();
+    bool pass = true;
+    try
+    {
+        if (not scenarios.empty()) for (const auto &scenario : scenarios)
+        {
+            results.push_back(runScenario(scenario));
+            pass = pass and results.back()["pass"].get<bool>();
+            std::cerr << "." << std::flush;
+        }
+        else if (scaling) for (const auto &numBlocks : scale)
+        for (const auto &numThreads : threads)
+        {
+            results.push_back(runScaling(std::stoul(numBlocks), std::stoul(numThreads), duration));
+            std::cerr << "." << std::flush;
+        }
+        else for (const auto &block : blocks)
+        for (const auto &dtype : dtypes)
+        for (const auto &numChans : channels)
+        for (const auto &mode : modes)
+        for (const auto &chunk : chunks)
+        for (const auto &output : outputs)
+        {
+            //the output mode only applies to the source
+            if (block == "sink" and output != outputs.front()) continue;
+            BenchConfig config;
+            config.block = block;
+            config.dtype = dtype;
+            config.numChans = std::stoul(numChans);
+            config.chanMode = mode;
+            config.chunkSize = std::stoul(chunk);
+            config.outputMode = output;
+            if (config.numChans == 0 or config.numChans > MAX_BENCH_CHANNELS) continue;
+            results.push_back(runBenchmark(config, duration));
+            pass = pass and results.back().value("pass", true);
+            std::cerr << "." << std::flush;
+        }
+    }
+    catch (const Pothos::Exception &ex)
+    {
+        std::cerr << std::endl << "AudioBenchmark: " << ex.displayText() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << std::endl << "AudioBenchmark: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cerr << std::endl;
+
+    if (not tracePath.empty())
+    {
+        audioTraceEnable(false);
+        if (not audioTraceWrite(tracePath)) std::cerr << "AudioBenchmark: cannot write " << tracePath << std::endl;
+    }
+
+    json top;
+    top["benchmark"] = (not scenarios.empty())?"scenario":(scaling?"scaling":"work");
+    top["sampleRate"] = BENCH_SAMPLE_RATE;
+    top["minFramesBlocking"] = MIN_FRAMES_BLOCKING;
+    top["duration"] = duration;
+    top["results"] = results;
+    std::cout << top.dump(2) << std::endl;
+    return pass?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -2,7 +2,10 @@
 // SPDX-License-Identifier: BSL-1.0
 
 #include "AudioBlock.hpp"
-#include <cctype>
+#include "AudioReactor.hpp"
+#include "AudioTrace.hpp"
+#include <cmath>
+#include <cstring>
 #include <algorithm>
 #include <json.hpp>
 
@@ -12,50 +15,59 @@ AudioBlock::AudioBlock(const std::string &blockName, const bool isSink, const Po
     _blockName(blockName),
     _isSink(isSink),
     _logger(Poco::Logger::get(blockName)),
-    _stream(nullptr),
+    _sampleType(audioSampleTypeFromDType(dtype)),
+    _numChans(numChans),
+    _device(-1),
     _interleaved(chanMode == "INTERLEAVED"),
+    _reactor(false),
+    _streamLatency(0.0),
     _sendLabel(false),
     _reportLogger(false),
-    _reportStderror(true)
+    _reportStderror(true),
+    _numXruns(0),
+    _numFrames(0),
+    _ioStarted(false),
+    _deadlineMisses(0),
+    _maxAvailable(0),
+    _deadline(0.0),
+    _rate(1.0),
+    _latencyBudget(0.0),
+    _latency(0.0),
+    _maxLatency(0.0),
+    _overBudget(false),
+    _numOverBudget(0),
+    _numLatencyAlerts(0),
+    _traceStart(0.0)
 {
     this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, overlay));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setupBackend));
     this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setupDevice));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setupIoMode));
     this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setupStream));
     this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setReportMode));
     this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setBackoffTime));
-
-    PaError err = Pa_Initialize();
-    if (err != paNoError)
-    {
-        throw Pothos::Exception("AudioBlock()", "Pa_Initialize: " + std::string(Pa_GetErrorText(err)));
-    }
-
-    //stream params
-    _streamParams.channelCount = numChans;
-    if (dtype == Pothos::DType("float32")) _streamParams.sampleFormat = paFloat32;
-    if (dtype == Pothos::DType("int32")) _streamParams.sampleFormat = paInt32;
-    if (dtype == Pothos::DType("int16")) _streamParams.sampleFormat = paInt16;
-    if (dtype == Pothos::DType("int8")) _streamParams.sampleFormat = paInt8;
-    if (dtype == Pothos::DType("uint8")) _streamParams.sampleFormat = paUInt8;
-    if (not _interleaved) _streamParams.sampleFormat |= paNonInterleaved;
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setTimingTrace));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setTracing));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, writeTrace));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, getNumXruns));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, getNumFrames));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, getTimingStats));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, setLatencyBudget));
+    this->registerCall(this, POTHOS_FCN_TUPLE(AudioBlock, getLatencyStats));
+    this->registerSignal("latencyAlert");
 }
 
 AudioBlock::~AudioBlock(void)
 {
-    if (_stream != nullptr)
-    {
-        PaError err = Pa_CloseStream(_stream);
-        if (err != paNoError)
-        {
-            poco_error_f1(_logger, "Pa_CloseStream: %s", std::string(Pa_GetErrorText(err)));
-        }
-    }
+    //close the stream before its backend
+    _stream.reset();
+}
 
-    PaError err = Pa_Terminate();
-    if (err != paNoError)
-    {
-        poco_error_f1(_logger, "Pa_Terminate: %s", std::string(Pa_GetErrorText(err)));
-    }
+AudioBackend &AudioBlock::backend(void) const
+{
+    //the default backend is made on first use, unless another one was selected
+    if (not _backend) _backend = AudioBackend::make("portaudio");
+    return *_backend;
 }
 
 std::string AudioBlock::overlay(void) const
@@ -78,10 +90,10 @@ std::string AudioBlock::overlay(void) const
     options.push_back(defaultOption);
 
     //enumerate devices and add to the options list
-    for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++)
+    for (const auto &device : this->backend().devices())
     {
         json option;
-        const std::string deviceName(Pa_GetDeviceInfo(i)->name);
+        const std::string deviceName(device.name);
         option["name"] = deviceName;
         option["value"] = "\""+deviceName+"\"";
         options.push_back(option);
@@ -94,80 +106,57 @@ std::string AudioBlock::overlay(void) const
     return topObj.dump();
 }
 
-void AudioBlock::setupDevice(const std::string &deviceName)
+void AudioBlock::setupBackend(const std::string &name)
 {
-    if (Pa_GetDeviceCount() == 0) throw Pothos::NotFoundException(
-        "AudioBlock::setupDevice()", "No devices available");
-
-    //empty name, use default
-    if (deviceName.empty())
-    {
-        if (_isSink) _streamParams.device = Pa_GetDefaultOutputDevice();
-        else         _streamParams.device = Pa_GetDefaultInputDevice();
-        return;
-    }
-
-    //numeric name, use index
-    if (std::all_of(deviceName.begin(), deviceName.end(), ::isdigit))
-    {
-        _streamParams.device = std::stoi(deviceName);
-        if (_streamParams.device >= Pa_GetDeviceCount()) throw Pothos::RangeException(
-            "AudioBlock::setupDevice("+deviceName+")", "Device index out of range");
-        return;
-    }
+    if (_stream) throw Pothos::IllegalStateException(
+        "AudioBlock::setupBackend("+name+")", "Select the backend before the stream is opened");
+    _backend = AudioBackend::make(name);
+    _device = -1;
+}
 
-    //find the match by name
-    for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++)
-    {
-        if (Pa_GetDeviceInfo(i)->name == deviceName)
-        {
-            _streamParams.device = i;
-            return;
-        }
-    }
+void AudioBlock::setupDevice(const std::string &deviceName)
+{
+    _device = this->backend().resolveDevice(deviceName, _isSink);
+}
 
-    //cant locate by name
-    throw Pothos::NotFoundException("AudioBlock::setupDevice("+deviceName+")", "No matching device");
+void AudioBlock::setupIoMode(const std::string &mode, const std::vector<int> &cpus)
+{
+    if (_stream) throw Pothos::IllegalStateException(
+        "AudioBlock::setupIoMode("+mode+")", "Select the I/O mode before the stream is opened");
+    if (mode == "BLOCKING"){}
+    else if (mode == "REACTOR"){}
+    else throw Pothos::InvalidArgumentException(
+        "AudioBlock::setupIoMode("+mode+")", "unknown I/O mode");
+    _reactor = (mode == "REACTOR");
+    _reactorCpus = cpus;
 }
 
 void AudioBlock::setupStream(const double sampRate)
 {
-    //get device info
-    const auto deviceInfo = Pa_GetDeviceInfo(_streamParams.device);
-    poco_information_f2(_logger, "Using %s through %s",
-        std::string(deviceInfo->name), std::string(Pa_GetHostApiInfo(deviceInfo->hostApi)->name));
+    //get device info, the default device unless one was selected
+    if (_device < 0) _device = this->backend().defaultDevice(_isSink);
+    const auto devices = this->backend().devices();
+    if (_device < 0 or _device >= int(devices.size())) throw Pothos::NotFoundException(
+        "AudioBlock::setupStream()", "No device selected");
+    const auto &deviceInfo = devices[_device];
+    poco_information_f2(_logger, "Using %s through %s", deviceInfo.name, deviceInfo.hostApi);
 
-    //stream params
-    if (_isSink) _streamParams.suggestedLatency = (deviceInfo->defaultLowOutputLatency + deviceInfo->defaultHighOutputLatency)/2;
-    else         _streamParams.suggestedLatency = (deviceInfo->defaultLowInputLatency + deviceInfo->defaultHighInputLatency)/2;
-    _streamParams.hostApiSpecificStreamInfo = nullptr;
-    const int requestedSize = Pa_GetSampleSize(_streamParams.sampleFormat);
-
-    //try stream
-    PaError err = Pa_IsFormatSupported(_isSink?nullptr:&_streamParams, _isSink?&_streamParams:nullptr, sampRate);
-    if (err != paNoError)
-    {
-        throw Pothos::Exception("AudioBlock::setupStream()", "Pa_IsFormatSupported: " + std::string(Pa_GetErrorText(err)));
-    }
+    //stream args
+    AudioStreamArgs args;
+    args.isSink = _isSink;
+    args.device = _device;
+    args.numChans = _numChans;
+    args.sampleType = _sampleType;
+    args.interleaved = _interleaved;
+    args.sampleRate = sampRate;
+    if (_isSink) args.latency = (deviceInfo.defaultLowOutputLatency + deviceInfo.defaultHighOutputLatency)/2;
+    else         args.latency = (deviceInfo.defaultLowInputLatency + deviceInfo.defaultHighInputLatency)/2;
+    if (_streamLatency > 0.0) args.latency = _streamLatency;
 
     //open stream
-    err = Pa_OpenStream(
-        &_stream, // stream
-        _isSink?nullptr:&_streamParams, // inputParameters
-        _isSink?&_streamParams:nullptr, // outputParameters
-        sampRate,  //sampleRate
-        paFramesPerBufferUnspecified, // framesPerBuffer
-        0, // streamFlags
-        nullptr, //streamCallback
-        nullptr); //userData
-    if (err != paNoError)
-    {
-        throw Pothos::Exception("AudioBlock::setupStream()", "Pa_OpenStream: " + std::string(Pa_GetErrorText(err)));
-    }
-    if (Pa_GetSampleSize(_streamParams.sampleFormat) != requestedSize)
-    {
-        throw Pothos::Exception("AudioBlock::setupStream()", "Pa_GetSampleSize mismatch");
-    }
+    _stream.reset();
+    if (_reactor) _stream = audioReactorOpen(this->backend(), args, _reactorCpus);
+    else _stream = this->backend().open(args);
 }
 
 void AudioBlock::setReportMode(const std::string &mode)
@@ -186,22 +175,231 @@ void AudioBlock::setBackoffTime(const long backoff)
     _backoffTime = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::milliseconds(backoff));
 }
 
+void AudioBlock::setTimingTrace(const std::string &path)
+{
+    _tracePath = path;
+}
+
+void AudioBlock::setTracing(const bool enable)
+{
+    audioTraceEnable(enable);
+}
+
+void AudioBlock::writeTrace(const std::string &path)
+{
+    if (not audioTraceWrite(path)) throw Pothos::FileException(
+        "AudioBlock::writeTrace("+path+")", "cannot write trace file");
+}
+
+void AudioBlock::setLatencyBudget(const double budget)
+{
+    if (budget < 0.0) throw Pothos::InvalidArgumentException(
+        "AudioBlock::setLatencyBudget()", "latency budget must not be negative");
+    _latencyBudget = budget/1e3;
+}
+
+unsigned long long AudioBlock::getNumXruns(void) const
+{
+    return _numXruns;
+}
+
+unsigned long long AudioBlock::getNumFrames(void) const
+{
+    return _numFrames;
+}
+
+std::string AudioBlock::getTimingStats(void) const
+{
+    json bucketEdges;
+    for (size_t i = 0; i < LogHistogram::NUM_BUCKETS; i++) bucketEdges.push_back(std::ldexp(1.0, int(i)));
+
+    json stats;
+    stats["intervals"] = _intervalHist.toJson();
+    stats["slack"] = _slackHist.toJson();
+    stats["bucketUpperUs"] = bucketEdges;
+    stats["deadlineUs"] = _deadline*1e6;
+    stats["deadlineMisses"] = _deadlineMisses;
+    return stats.dump();
+}
+
+std::string AudioBlock::getLatencyStats(void) const
+{
+    json stats;
+    stats["budgetMs"] = _latencyBudget*1e3;
+    stats["latencyMs"] = _latency*1e3;
+    stats["maxLatencyMs"] = _maxLatency*1e3;
+    stats["overBudget"] = _overBudget;
+    stats["numOverBudget"] = _numOverBudget;
+    stats["numAlerts"] = _numLatencyAlerts;
+    return stats.dump();
+}
+
 void AudioBlock::activate(void)
 {
     _readyTime = std::chrono::high_resolution_clock::now();
-    PaError err = Pa_StartStream(_stream);
-    if (err != paNoError)
+    _numXruns = 0;
+    _numFrames = 0;
+    _stream->start();
+    _sendLabel = true;
+
+    //the timing stats measure against the stream latency
+    _rate = _stream->sampleRate();
+    _deadline = _stream->latency();
+    _intervalHist.reset();
+    _slackHist.reset();
+    _ioStarted = false;
+    _deadlineMisses = 0;
+    _maxAvailable = 0;
+    _latency = 0.0;
+    _maxLatency = 0.0;
+    _overBudget = false;
+    _numOverBudget = 0;
+    _numLatencyAlerts = 0;
+
+    //trace times are relative to the stream start
+    if (not _tracePath.empty())
     {
-        throw Pothos::Exception("AudioBlock::activate()", "Pa_StartStream: " + std::string(Pa_GetErrorText(err)));
+        if (not _trace.open(_tracePath, _isSink, _numChans, _rate))
+        {
+            throw Pothos::FileException("AudioBlock::activate()", "cannot create timing trace " + _tracePath);
+        }
+        _traceStart = _stream->time();
     }
-    _sendLabel = true;
 }
 
 void AudioBlock::deactivate(void)
 {
-    PaError err = Pa_StopStream(_stream);
-    if (err != paNoError)
+    _trace.close();
+    _stream->stop();
+}
+
+double AudioBlock::traceTime(void) const
+{
+    return _stream->time() - _traceStart;
+}
+
+/*!
+ * The slack is the time left before the device misses its deadline:
+ * for a source, the stream latency minus the age of the waiting samples,
+ * for a sink, the duration of the samples still buffered in the device.
+ */
+void AudioBlock::recordSlack(const long available)
+{
+    if (available < 0) return;
+    double slack = 0.0;
+    if (_isSink)
+    {
+        //the write space of the idle stream is the size of the device buffer
+        _maxAvailable = std::max(_maxAvailable, available);
+        if (not _ioStarted) return;
+        slack = (_maxAvailable - available)/_rate;
+    }
+    else slack = _deadline - available/_rate;
+    _slackHist.add(slack);
+    if (slack <= 0.0) _deadlineMisses++;
+}
+
+/*!
+ * The latency is the age of the oldest captured sample for a source,
+ * and the delay until a sample written now leaves the device for a sink:
+ * the stream latency for a full device buffer, less the free space,
+ * plus the frames queued inside the block.
+ * The alert is raised once per excursion over the budget,
+ * and re-armed when the latency falls below 90% of the budget.
+ */
+void AudioBlock::checkLatencyBudget(const long available)
+{
+    if (available < 0) return;
+    if (_isSink) _latency = std::max(0.0, _deadline - available/_rate) + this->internalFrames()/_rate;
+    else _latency = _deadline + available/_rate;
+    _maxLatency = std::max(_maxLatency, _latency);
+    if (_latencyBudget == 0.0) return;
+
+    if (_latency > _latencyBudget)
     {
-        throw Pothos::Exception("AudioBlock::deactivate()", "Pa_StopStream: " + std::string(Pa_GetErrorText(err)));
+        _numOverBudget++;
+        if (_overBudget) return;
+        _overBudget = true;
+        _numLatencyAlerts++;
+        audioTraceInstant("latencyAlert");
+        this->emitSignal("latencyAlert", _latency*1e3);
     }
+    else if (_overBudget and _latency < 0.9*_latencyBudget) _overBudget = false;
+}
+
+size_t AudioBlock::internalFrames(void) const
+{
+    return 0;
+}
+
+void AudioBlock::recordCompletion(void)
+{
+    const auto now = std::chrono::high_resolution_clock::now();
+    if (_ioStarted) _intervalHist.add(std::chrono::duration<double>(now - _lastIoTime).count());
+    _lastIoTime = now;
+    _ioStarted = true;
+}
+
+long AudioBlock::streamAvailable(void)
+{
+    const long available = _stream->available();
+    this->recordSlack(available);
+    this->checkLatencyBudget(available);
+    if (not _trace.isOpen()) return available;
+
+    TimingTraceEvent event;
+    std::memset(&event, 0, sizeof(event));
+    event.time = event.endTime = this->traceTime();
+    event.type = TIMING_TRACE_AVAILABLE;
+    event.value = int32_t(available);
+    _trace.push(event);
+    return available;
+}
+
+int AudioBlock::streamRead(void *buffer, const unsigned long frames)
+{
+    AudioTraceSpan span("deviceRead");
+    span.setArg("frames", frames);
+    if (not _trace.isOpen())
+    {
+        const int err = _stream->read(buffer, frames);
+        this->recordCompletion();
+        return err;
+    }
+
+    TimingTraceEvent event;
+    std::memset(&event, 0, sizeof(event));
+    event.time = this->traceTime();
+    const int err = _stream->read(buffer, frames);
+    this->recordCompletion();
+    event.endTime = this->traceTime();
+    event.type = TIMING_TRACE_IO;
+    event.value = err;
+    event.frames = uint32_t(frames);
+    _trace.push(event);
+    return err;
+}
+
+int AudioBlock::streamWrite(const void *buffer, const unsigned long frames)
+{
+    AudioTraceSpan span("deviceWrite");
+    span.setArg("frames", frames);
+    if (not _trace.isOpen())
+    {
+        const int err = _stream->write(buffer, frames);
+        this->recordCompletion();
+        return err;
+    }
+
+    TimingTraceEvent event;
+    std::memset(&event, 0, sizeof(event));
+    event.time = this->traceTime();
+    const int err = _stream->write(buffer, frames);
+    this->recordCompletion();
+    event.endTime = this->traceTime();
+    event.type = TIMING_TRACE_IO;
+    event.value = err;
+    event.frames = uint32_t(frames);
+    _trace.push(event);
+    return err;
 }
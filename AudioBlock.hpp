@@ -1,9 +1,11 @@
 // Copyright (c) 2014-2016 Josh Blum
 // SPDX-License-Identifier: BSL-1.0
 
+#include "AudioBackend.hpp"
+#include "LogHistogram.hpp"
+#include "TimingTrace.hpp"
 #include <Pothos/Framework.hpp>
 #include <Poco/Logger.h>
-#include <portaudio.h>
 #include <chrono>
 
 class AudioBlock : public Pothos::Block
@@ -14,25 +16,83 @@ public:
 
     std::string overlay(void) const;
 
+    void setupBackend(const std::string &name);
     void setupDevice(const std::string &deviceName);
+    void setupIoMode(const std::string &mode, const std::vector<int> &cpus);
     void setupStream(const double sampRate);
 
     void setReportMode(const std::string &mode);
     void setBackoffTime(const long backoff);
+    void setTimingTrace(const std::string &path);
+    void setTracing(const bool enable);
+    void writeTrace(const std::string &path);
+    void setLatencyBudget(const double budget);
+
+    unsigned long long getNumXruns(void) const;
+    unsigned long long getNumFrames(void) const;
+    std::string getTimingStats(void) const;
+    std::string getLatencyStats(void) const;
 
     void activate(void);
     void deactivate(void);
 
 protected:
+    //! The available frames of the stream, recorded in the timing trace
+    long streamAvailable(void);
+
+    //! Read from the stream, recorded in the timing trace
+    int streamRead(void *buffer, const unsigned long frames);
+
+    //! Write to the stream, recorded in the timing trace
+    int streamWrite(const void *buffer, const unsigned long frames);
+
+    //! Frames queued inside the block ahead of the device, counted in the latency budget
+    virtual size_t internalFrames(void) const;
+
     const std::string _blockName;
     const bool _isSink;
     Poco::Logger &_logger;
-    PaStream *_stream;
-    PaStreamParameters _streamParams;
+    const AudioSampleType _sampleType;
+    const size_t _numChans;
+    int _device;
+    std::unique_ptr<AudioStream> _stream;
     bool _interleaved;
+    bool _reactor;
+    std::vector<int> _reactorCpus;
+    double _streamLatency; //!< requested latency in seconds, zero for the device default
     bool _sendLabel;
     bool _reportLogger;
     bool _reportStderror;
     std::chrono::high_resolution_clock::duration _backoffTime;
     std::chrono::high_resolution_clock::time_point _readyTime;
+    unsigned long long _numXruns;
+    unsigned long long _numFrames;
+
+private:
+    AudioBackend &backend(void) const;
+    mutable std::shared_ptr<AudioBackend> _backend;
+
+    void recordSlack(const long available);
+    void recordCompletion(void);
+    LogHistogram _intervalHist;
+    LogHistogram _slackHist;
+    std::chrono::high_resolution_clock::time_point _lastIoTime;
+    bool _ioStarted;
+    unsigned long long _deadlineMisses;
+    long _maxAvailable;
+    double _deadline;
+    double _rate;
+
+    void checkLatencyBudget(const long available);
+    double _latencyBudget;
+    double _latency;
+    double _maxLatency;
+    bool _overBudget;
+    unsigned long long _numOverBudget;
+    unsigned long long _numLatencyAlerts;
+
+    double traceTime(void) const;
+    std::string _tracePath;
+    TimingTraceWriter _trace;
+    double _traceStart;
 };
@@ -0,0 +1,771 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioFormats.hpp"
+#include "WavFile.hpp"
+#include "FlacEncoder.hpp"
+#include <Pothos/Framework.hpp>
+#include <Poco/Logger.h>
+#include <algorithm> //min/max
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//the alignment of file offsets, sizes, and buffers for direct I/O
+static const size_t IO_ALIGNMENT = 4096;
+
+//the size of each write to the file
+static const size_t IO_CHUNK_SIZE = 1 << 20;
+
+//the file header is padded so the sample data starts aligned
+static const size_t HEADER_SIZE = IO_ALIGNMENT;
+
+//how often the header is rewritten with the current size
+static const std::chrono::seconds HEADER_UPDATE_PERIOD(1);
+
+//the number of frames in each independently encoded FLAC frame
+static const size_t FLAC_BLOCK_SIZE = 4096;
+
+static size_t gcd(const size_t a, const size_t b)
+{
+    return (b == 0)?a:gcd(b, a % b);
+}
+
+/***********************************************************************
+ * Positional file writes without a shared file pointer
+ **********************************************************************/
+static bool writeAt(const int fd, const void *buff, const size_t size, const unsigned long long offset)
+{
+    #ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+    return _write(fd, buff, unsigned(size)) == int(size);
+    #else
+    size_t done = 0;
+    while (done < size)
+    {
+        const ssize_t ret = pwrite(fd, (const char *)buff + done, size - done, off_t(offset + done));
+        if (ret < 0 and errno == EINTR) continue;
+        if (ret <= 0) return false;
+        done += size_t(ret);
+    }
+    return true;
+    #endif
+}
+
+/***********************************************************************
+ * |PothosDoc Audio File Sink
+ *
+ * The audio file sink records an input sample stream into a WAV file.
+ * In interleaved mode, the samples are interleaved from one input port,
+ * In the port-per-channel mode, each audio channel uses a separate port.
+ *
+ * Samples are copied into a large ring buffer that is allocated up-front,
+ * and a dedicated I/O thread writes the ring to the file in large aligned writes.
+ * So the work() thread never waits on the file system, and a disk stall
+ * only fills the ring buffer rather than backing up into the audio source.
+ * Samples are dropped and counted only once the ring buffer is full.
+ *
+ * The file is written as a RIFF/WAVE file and promoted to RF64 in place
+ * once the recording exceeds 4 GiB. The header is rewritten periodically,
+ * so an interrupted recording can still be read back up to the last update.
+ * Signed 8-bit samples are stored as unsigned, as required by the WAV format.
+ *
+ * In the FLAC mode, the ring buffer is split into blocks of 4096 frames,
+ * and each block is compressed as an independent FLAC frame on a pool of encoder threads.
+ * The I/O thread writes the encoded frames to the file in order,
+ * so the compression throughput scales with the number of cores.
+ * Float and 32-bit samples are stored with 24 bits, other types with their native size.
+ * Because a FLAC stream holds at most 8 channels, recordings with more channels
+ * are split into one file per group of 8 channels, named like "name.ch01-08.flac".
+ * The stream header is finalized with the total length on deactivation.
+ *
+ * The sample rate for the file header comes from the sampRate parameter,
+ * or from an "rxRate" stream label, which overrides the parameter.
+ *
+ * |category /Audio
+ * |category /Sinks
+ * |keywords audio sound wav rf64 file record
+ *
+ * |param filePath[File Path] The path of the WAV or FLAC file to record.
+ * The file is created on activation and finalized on deactivation.
+ * |default ""
+ * |widget FileEntry(mode=save)
+ * |preview valid
+ *
+ * |param sampRate[Sample Rate] The sample rate written to the file header.
+ * |option 32e3
+ * |option 44.1e3
+ * |option 48e3
+ * |default 44.1e3
+ * |units Sps
+ * |widget ComboBox(editable=true)
+ *
+ * |param dtype[Data Type] The data type consumed by the audio file sink.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |param bufferTime [Buffer Time] The duration of the ring buffer.
+ * This is the longest file system stall that the recording survives.
+ * |units seconds
+ * |default 10.0
+ * |preview disable
+ * |tab Buffering
+ *
+ * |param fileFormat [File Format] The format of the recorded file.
+ * |option [WAV/RF64] "WAV"
+ * |option [FLAC] "FLAC"
+ * |default "WAV"
+ * |preview enable
+ *
+ * |param numEncoders [Num Encoders] The number of FLAC encoder threads.
+ * Zero uses one encoder per hardware thread.
+ * |default 0
+ * |widget SpinBox(minimum=0)
+ * |preview disable
+ * |tab Buffering
+ *
+ * |param directIO [Direct I/O] Bypass the page cache with O_DIRECT when supported.
+ * Direct I/O applies to the WAV format only.
+ * |default false
+ * |option [Enabled] true
+ * |option [Disabled] false
+ * |preview disable
+ * |tab Buffering
+ *
+ * |factory /audio/file_sink(dtype, numChans, chanMode)
+ * |setter setFilePath(filePath)
+ * |setter setSampleRate(sampRate)
+ * |setter setFileFormat(fileFormat)
+ * |setter setNumEncoders(numEncoders)
+ * |setter setBufferTime(bufferTime)
+ * |setter setDirectIO(directIO)
+ **********************************************************************/
+class AudioFileSink : public Pothos::Block
+{
+public:
+    AudioFileSink(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _logger(Poco::Logger::get("AudioFileSink")),
+        _sampleType(audioSampleTypeFromDType(dtype)),
+        _fileType((_sampleType == AUDIO_INT8)?AUDIO_UINT8:_sampleType),
+        _numChans(numChans),
+        _interleaved(chanMode == "INTERLEAVED"),
+        _frameSize(numChans*audioSampleSize(_fileType)),
+        _sampleRate(44100.0),
+        _fileFormat("WAV"),
+        _numEncoders(0),
+        _flac(false),
+        _flacBits(0),
+        _bufferTime(10.0),
+        _directIO(false),
+        _ring(nullptr),
+        _ringSize(0),
+        _wakeSize(IO_CHUNK_SIZE),
+        _fd(-1),
+        _writeCount(0),
+        _readCount(0),
+        _running(false),
+        _ioFailed(false),
+        _encoding(false),
+        _overflowing(false),
+        _numOverflows(0),
+        _numDroppedFrames(0)
+    {
+        //setup ports
+        if (_interleaved) this->setupInput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupInput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setFilePath));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setSampleRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setFileFormat));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setNumEncoders));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setBufferTime));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, setDirectIO));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, getNumOverflows));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSink, getNumDroppedFrames));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioFileSink(dtype, numChans, chanMode);
+    }
+
+    void setFilePath(const std::string &path)
+    {
+        _filePath = path;
+    }
+
+    void setSampleRate(const double rate)
+    {
+        _sampleRate = rate;
+    }
+
+    void setFileFormat(const std::string &format)
+    {
+        if (format == "WAV"){}
+        else if (format == "FLAC"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioFileSink::setFileFormat("+format+")", "unknown file format");
+        _fileFormat = format;
+    }
+
+    void setNumEncoders(const size_t numEncoders)
+    {
+        _numEncoders = numEncoders;
+    }
+
+    void setBufferTime(const double seconds)
+    {
+        if (seconds <= 0.0) throw Pothos::InvalidArgumentException(
+            "AudioFileSink::setBufferTime()", "buffer time must be positive");
+        _bufferTime = seconds;
+    }
+
+    void setDirectIO(const bool enable)
+    {
+        _directIO = enable;
+    }
+
+    unsigned long long getNumOverflows(void) const
+    {
+        return _numOverflows;
+    }
+
+    unsigned long long getNumDroppedFrames(void) const
+    {
+        return _numDroppedFrames;
+    }
+
+    void activate(void)
+    {
+        if (_filePath.empty()) throw Pothos::FileException("AudioFileSink::activate()", "no file path specified");
+
+        //the FLAC encoders take left-justified 32-bit samples from the ring
+        _flac = (_fileFormat == "FLAC");
+        if (_flac) _fileType = AUDIO_INT32;
+        else _fileType = (_sampleType == AUDIO_INT8)?AUDIO_UINT8:_sampleType;
+        _frameSize = _numChans*audioSampleSize(_fileType);
+
+        //the ring holds whole chunks (or FLAC blocks) and whole frames, so neither wraps
+        _wakeSize = _flac?(FLAC_BLOCK_SIZE*_frameSize):IO_CHUNK_SIZE;
+        const size_t unit = _wakeSize/gcd(_wakeSize, _frameSize)*_frameSize;
+        const size_t wanted = size_t(_bufferTime*_sampleRate.load())*_frameSize;
+        _ringSize = std::max<size_t>(1, (wanted + unit - 1)/unit)*unit;
+
+        //aligned storage for direct I/O, touched up-front by the allocation
+        _ringStorage.assign(_ringSize + IO_ALIGNMENT, 0);
+        _ring = _ringStorage.data() + (IO_ALIGNMENT - size_t(_ringStorage.data()) % IO_ALIGNMENT) % IO_ALIGNMENT;
+        _headerStorage.assign(HEADER_SIZE + IO_ALIGNMENT, 0);
+        _headerBuff = _headerStorage.data() + (IO_ALIGNMENT - size_t(_headerStorage.data()) % IO_ALIGNMENT) % IO_ALIGNMENT;
+
+        _writeCount = 0;
+        _readCount = 0;
+        _ioFailed = false;
+        _overflowing = false;
+        _running = true;
+
+        if (_flac) return this->activateFlac();
+
+        _fd = this->openFile(_filePath, _directIO);
+        if (not this->writeHeader(0))
+        {
+            const std::string error(std::strerror(errno));
+            this->closeFile(_fd);
+            throw Pothos::WriteFileException("AudioFileSink::activate("+_filePath+")", error);
+        }
+        _ioThread = std::thread(&AudioFileSink::ioLoop, this);
+    }
+
+    void deactivate(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _cond.notify_one();
+        if (_ioThread.joinable()) _ioThread.join();
+        this->closeFile(_fd);
+
+        //the encoders finish any queued blocks before they exit
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _encoding = false;
+        }
+        _workCond.notify_all();
+        for (auto &encoder : _encoders) encoder.join();
+        _encoders.clear();
+        for (auto &file : _flacFiles) this->closeFile(file.fd);
+        _flacFiles.clear();
+
+        _ringStorage.clear();
+        _ringStorage.shrink_to_fit();
+        _ring = nullptr;
+
+        if (_ioFailed) throw Pothos::WriteFileException("AudioFileSink::deactivate()", _ioError);
+    }
+
+    void work(void)
+    {
+        if (_ioFailed) throw Pothos::WriteFileException("AudioFileSink::work()", _ioError);
+
+        //update the header rate from the upstream source
+        for (auto port : this->inputs())
+        {
+            for (const auto &label : port->labels())
+            {
+                if (label.id == "rxRate") _sampleRate = label.data.convert<double>();
+            }
+        }
+
+        const size_t numFrames = this->workInfo().minInElements;
+        if (numFrames == 0) return;
+
+        //the free space in the ring, the i/o thread only advances the read count
+        const unsigned long long writeCount = _writeCount.load(std::memory_order_relaxed);
+        const size_t freeFrames = (_ringSize - size_t(writeCount - _readCount.load(std::memory_order_acquire)))/_frameSize;
+        const size_t numCopy = std::min(numFrames, freeFrames);
+
+        //copy into the ring in up to two contiguous segments
+        size_t done = 0;
+        while (done < numCopy)
+        {
+            const size_t offset = size_t((writeCount + done*_frameSize) % _ringSize);
+            const size_t n = std::min(numCopy - done, (_ringSize - offset)/_frameSize);
+            this->copyFrames(_ring + offset, done, n);
+            done += n;
+        }
+        _writeCount.store(writeCount + numCopy*_frameSize, std::memory_order_release);
+
+        //drop what does not fit, the upstream source is never blocked
+        if (numCopy < numFrames)
+        {
+            if (not _overflowing) poco_warning_f1(_logger, "Ring buffer full, dropping samples to %s", _filePath);
+            if (not _overflowing) _numOverflows++;
+            _numDroppedFrames += numFrames - numCopy;
+        }
+        _overflowing = numCopy < numFrames;
+
+        //wake the i/o thread once a full chunk is available,
+        //under the lock so the wakeup cannot fall between the ring check and the wait
+        if ((writeCount + numCopy*_frameSize)/_wakeSize != writeCount/_wakeSize)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cond.notify_one();
+        }
+
+        for (auto port : this->inputs()) port->consume(numFrames);
+    }
+
+private:
+    //! One block of the ring, encoded into a frame for each FLAC file
+    struct FlacJob
+    {
+        size_t offset;
+        size_t numFrames;
+        unsigned long long frameNumber;
+        std::vector<std::vector<uint8_t>> frames;
+        bool done;
+    };
+
+    //! One FLAC stream of up to 8 channels
+    struct FlacFile
+    {
+        std::string path;
+        int fd;
+        size_t firstChan;
+        size_t numChans;
+        unsigned long long offset;
+        size_t minFrameSize;
+        size_t maxFrameSize;
+    };
+
+    //! Interleave and convert frames from the input ports into the ring
+    void copyFrames(char *out, const size_t inOffset, const size_t numFrames)
+    {
+        const size_t outSampleSize = audioSampleSize(_fileType);
+        for (auto port : this->inputs())
+        {
+            const char *in = (const char *)this->workInfo().inputPointers[port->index()] + inOffset*port->dtype().size();
+            if (_interleaved) audioConvert(in, _sampleType, 1, out, _fileType, 1, numFrames*_numChans);
+            else audioConvert(in, _sampleType, 1, out + port->index()*outSampleSize, _fileType, _numChans, numFrames);
+        }
+    }
+
+    int openFile(const std::string &path, const bool directIO)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        #ifdef _WIN32
+        flags |= O_BINARY;
+        #endif
+
+        int fd = -1;
+        #ifdef O_DIRECT
+        if (directIO) fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        if (directIO and fd < 0) poco_warning_f2(_logger, "O_DIRECT open failed for %s: %s, using buffered I/O", path, std::string(std::strerror(errno)));
+        #else
+        if (directIO) poco_warning(_logger, "O_DIRECT is not supported on this platform, using buffered I/O");
+        #endif
+        if (fd < 0) fd = open(path.c_str(), flags, 0644);
+        if (fd < 0) throw Pothos::OpenFileException("AudioFileSink::openFile("+path+")", std::strerror(errno));
+        return fd;
+    }
+
+    void closeFile(int &fd)
+    {
+        if (fd < 0) return;
+        #ifdef _WIN32
+        _close(fd);
+        #else
+        close(fd);
+        #endif
+        fd = -1;
+    }
+
+    bool writeHeader(const unsigned long long dataSize)
+    {
+        WavHeader header;
+        header.sampleType = _fileType;
+        header.numChans = _numChans;
+        header.sampleRate = _sampleRate.load();
+        header.dataOffset = HEADER_SIZE;
+        header.dataSize = dataSize;
+        wavWriteHeader(_headerBuff, header);
+        return writeAt(_fd, _headerBuff, HEADER_SIZE, 0);
+    }
+
+    void ioFailure(const std::string &what)
+    {
+        _ioError = what + ": " + std::strerror(errno);
+        poco_error_f2(_logger, "%s: %s", _filePath, _ioError);
+        _ioFailed = true;
+    }
+
+    /*!
+     * Open one FLAC file per group of up to 8 channels,
+     * and start the encoder pool and the FLAC i/o thread.
+     */
+    void activateFlac(void)
+    {
+        switch (_sampleType)
+        {
+        case AUDIO_INT16: _flacBits = 16; break;
+        case AUDIO_INT8:
+        case AUDIO_UINT8: _flacBits = 8; break;
+        default: _flacBits = 24; break;
+        }
+        if (_directIO) poco_warning(_logger, "Direct I/O is not used in the FLAC mode");
+
+        //split the channels into streams of at most 8 channels
+        const size_t numGroups = (_numChans + FLAC_MAX_CHANNELS - 1)/FLAC_MAX_CHANNELS;
+        const auto dot = _filePath.find_last_of('.');
+        const auto sep = _filePath.find_last_of("/\\");
+        const bool hasExt = dot != std::string::npos and (sep == std::string::npos or dot > sep);
+        const auto chanName = [](const size_t chan){return (chan < 10)?("0"+std::to_string(chan)):std::to_string(chan);};
+        for (size_t g = 0; g < numGroups; g++)
+        {
+            FlacFile file;
+            file.firstChan = g*FLAC_MAX_CHANNELS;
+            file.numChans = std::min(FLAC_MAX_CHANNELS, _numChans - file.firstChan);
+            file.path = _filePath;
+            if (numGroups > 1) file.path.insert(hasExt?dot:_filePath.size(),
+                ".ch"+chanName(file.firstChan+1)+"-"+chanName(file.firstChan+file.numChans));
+            file.fd = -1;
+            file.offset = FLAC_STREAMINFO_SIZE;
+            file.minFrameSize = 0;
+            file.maxFrameSize = 0;
+            _flacFiles.push_back(file);
+        }
+
+        for (auto &file : _flacFiles)
+        {
+            try
+            {
+                file.fd = this->openFile(file.path, false);
+            }
+            catch (...)
+            {
+                for (auto &f : _flacFiles) this->closeFile(f.fd);
+                _flacFiles.clear();
+                throw;
+            }
+            if (not this->writeStreamInfo(file, 0))
+            {
+                const std::string error(std::strerror(errno));
+                for (auto &f : _flacFiles) this->closeFile(f.fd);
+                _flacFiles.clear();
+                throw Pothos::WriteFileException("AudioFileSink::activate("+file.path+")", error);
+            }
+        }
+
+        size_t numEncoders = _numEncoders;
+        if (numEncoders == 0) numEncoders = std::max<size_t>(1, std::thread::hardware_concurrency());
+        poco_information_f3(_logger, "Recording %z channels to %z FLAC file(s) with %z encoders",
+            _numChans, _flacFiles.size(), numEncoders);
+
+        _jobQueue.clear();
+        _encoding = true;
+        for (size_t i = 0; i < numEncoders; i++) _encoders.emplace_back(&AudioFileSink::encoderLoop, this);
+        _ioThread = std::thread(&AudioFileSink::flacLoop, this);
+    }
+
+    bool writeStreamInfo(const FlacFile &file, const unsigned long long totalFrames)
+    {
+        FlacStreamInfo info;
+        info.numChans = file.numChans;
+        info.bitsPerSample = _flacBits;
+        info.sampleRate = unsigned(std::max(1.0, std::min(_sampleRate.load() + 0.5, 655350.0)));
+        info.blockSize = FLAC_BLOCK_SIZE;
+        info.minFrameSize = file.minFrameSize;
+        info.maxFrameSize = file.maxFrameSize;
+        info.totalSamples = totalFrames;
+        uint8_t buff[FLAC_STREAMINFO_SIZE];
+        flacWriteStreamInfo(buff, info);
+        return writeAt(file.fd, buff, FLAC_STREAMINFO_SIZE, 0);
+    }
+
+    //! An encoder thread compresses one block of the ring into a frame per file
+    void encoderLoop(void)
+    {
+        FlacFrameEncoder encoder;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _workCond.wait(lock, [this]{return not _jobQueue.empty() or not _encoding;});
+            if (_jobQueue.empty()) return;
+            auto job = _jobQueue.front();
+            _jobQueue.pop_front();
+            lock.unlock();
+
+            //the block stays in the ring until the i/o thread writes the frames
+            const int32_t *samples = (const int32_t *)(_ring + job->offset);
+            for (size_t g = 0; g < _flacFiles.size(); g++)
+            {
+                const auto &file = _flacFiles[g];
+                encoder.encode(samples + file.firstChan, _numChans, file.numChans,
+                    job->numFrames, _flacBits, job->frameNumber, job->frames[g]);
+            }
+
+            lock.lock();
+            job->done = true;
+            _cond.notify_one();
+        }
+    }
+
+    /*!
+     * The FLAC i/o thread dispatches whole blocks to the encoders,
+     * and writes the encoded frames in order as they complete.
+     * The ring space of a block is released once its frames are written.
+     */
+    void flacLoop(void)
+    {
+        const size_t blockBytes = FLAC_BLOCK_SIZE*_frameSize;
+        const size_t maxInFlight = 2*_encoders.size();
+        std::deque<std::shared_ptr<FlacJob>> inFlight;
+        unsigned long long dispatchCount = 0;
+        unsigned long long readCount = 0;
+        unsigned long long frameNumber = 0;
+        bool running = true;
+
+        while (not _ioFailed)
+        {
+            const unsigned long long writeCount = _writeCount.load(std::memory_order_acquire);
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+
+                //dispatch whole blocks, and the partial block once the recording stops
+                while (inFlight.size() < maxInFlight)
+                {
+                    size_t size = size_t(std::min<unsigned long long>(writeCount - dispatchCount, blockBytes));
+                    if (size == 0 or (size < blockBytes and running)) break;
+                    std::shared_ptr<FlacJob> job(new FlacJob());
+                    job->offset = size_t(dispatchCount % _ringSize);
+                    job->numFrames = size/_frameSize;
+                    job->frameNumber = frameNumber++;
+                    job->frames.resize(_flacFiles.size());
+                    job->done = false;
+                    dispatchCount += size;
+                    inFlight.push_back(job);
+                    _jobQueue.push_back(job);
+                    _workCond.notify_one();
+                }
+                if (not running and inFlight.empty()) break;
+
+                //wait for the next frame in order or for more blocks to dispatch
+                _cond.wait_for(lock, HEADER_UPDATE_PERIOD, [&]{
+                    if (not inFlight.empty() and inFlight.front()->done) return true;
+                    if (inFlight.size() >= maxInFlight) return false;
+                    const auto available = _writeCount.load(std::memory_order_acquire) - dispatchCount;
+                    return available >= blockBytes or (not _running and (available != 0 or inFlight.empty()));
+                });
+                running = _running;
+            }
+
+            //write the completed frames in order
+            while (not inFlight.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (not inFlight.front()->done) break;
+                }
+                const auto job = inFlight.front();
+                inFlight.pop_front();
+                for (size_t g = 0; g < _flacFiles.size(); g++)
+                {
+                    auto &file = _flacFiles[g];
+                    const auto &frame = job->frames[g];
+                    if (not writeAt(file.fd, frame.data(), frame.size(), file.offset)) return this->ioFailure("write");
+                    file.offset += frame.size();
+                    if (file.minFrameSize == 0 or frame.size() < file.minFrameSize) file.minFrameSize = frame.size();
+                    file.maxFrameSize = std::max(file.maxFrameSize, frame.size());
+                }
+                readCount += job->numFrames*_frameSize;
+                _readCount.store(readCount, std::memory_order_release);
+            }
+        }
+        if (_ioFailed) return;
+
+        //finalize the stream headers with the length and frame sizes
+        for (const auto &file : _flacFiles)
+        {
+            if (not this->writeStreamInfo(file, readCount/_frameSize)) return this->ioFailure("header update");
+            #ifdef _WIN32
+            if (_commit(file.fd) != 0) return this->ioFailure("sync");
+            #else
+            if (fsync(file.fd) != 0) return this->ioFailure("sync");
+            #endif
+        }
+    }
+
+    /*!
+     * The i/o thread writes whole chunks as they become available,
+     * and the remaining partial chunk when the recording stops.
+     */
+    void ioLoop(void)
+    {
+        auto lastHeaderUpdate = std::chrono::steady_clock::now();
+        unsigned long long readCount = 0;
+        bool running = true;
+
+        while (not _ioFailed)
+        {
+            //wait for a full chunk or the end of the recording
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait_for(lock, HEADER_UPDATE_PERIOD, [this, readCount]{
+                    return not _running or _writeCount.load(std::memory_order_acquire) - readCount >= IO_CHUNK_SIZE;});
+                running = _running;
+            }
+
+            //write all available whole chunks, chunks never wrap in the ring
+            const unsigned long long writeCount = _writeCount.load(std::memory_order_acquire);
+            while (writeCount - readCount >= IO_CHUNK_SIZE)
+            {
+                const size_t offset = size_t(readCount % _ringSize);
+                if (not writeAt(_fd, _ring + offset, IO_CHUNK_SIZE, HEADER_SIZE + readCount)) return this->ioFailure("write");
+                readCount += IO_CHUNK_SIZE;
+                _readCount.store(readCount, std::memory_order_release);
+            }
+
+            //periodically make the recording readable up to this point
+            if (std::chrono::steady_clock::now() - lastHeaderUpdate >= HEADER_UPDATE_PERIOD)
+            {
+                lastHeaderUpdate = std::chrono::steady_clock::now();
+                if (not this->writeHeader(readCount)) return this->ioFailure("header update");
+            }
+
+            if (not running) break;
+        }
+        if (_ioFailed) return;
+
+        //write the partial chunk padded to the alignment, then truncate
+        const unsigned long long writeCount = _writeCount.load(std::memory_order_acquire);
+        const size_t tail = size_t(writeCount - readCount);
+        const size_t padded = (tail + IO_ALIGNMENT - 1)/IO_ALIGNMENT*IO_ALIGNMENT;
+        if (tail != 0 and not writeAt(_fd, _ring + size_t(readCount % _ringSize), padded, HEADER_SIZE + readCount)) return this->ioFailure("write");
+        if (not this->writeHeader(writeCount)) return this->ioFailure("header update");
+
+        #ifdef _WIN32
+        if (_chsize_s(_fd, HEADER_SIZE + writeCount) != 0) return this->ioFailure("truncate");
+        if (_commit(_fd) != 0) return this->ioFailure("sync");
+        #else
+        if (ftruncate(_fd, off_t(HEADER_SIZE + writeCount)) != 0) return this->ioFailure("truncate");
+        if (fsync(_fd) != 0) return this->ioFailure("sync");
+        #endif
+        _readCount.store(writeCount, std::memory_order_release);
+    }
+
+    Poco::Logger &_logger;
+    const AudioSampleType _sampleType;
+    AudioSampleType _fileType;
+    const size_t _numChans;
+    const bool _interleaved;
+    size_t _frameSize;
+    std::string _filePath;
+    std::atomic<double> _sampleRate;
+    std::string _fileFormat;
+    size_t _numEncoders;
+    bool _flac;
+    unsigned _flacBits;
+    double _bufferTime;
+    bool _directIO;
+
+    //ring buffer shared with the i/o thread
+    std::vector<char> _ringStorage;
+    char *_ring;
+    size_t _ringSize;
+    size_t _wakeSize;
+    std::vector<char> _headerStorage;
+    char *_headerBuff;
+    int _fd;
+    std::atomic<unsigned long long> _writeCount;
+    std::atomic<unsigned long long> _readCount;
+
+    //i/o thread state
+    std::thread _ioThread;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _running;
+    std::atomic<bool> _ioFailed;
+    std::string _ioError;
+
+    //flac encoder pool state
+    std::vector<std::thread> _encoders;
+    std::condition_variable _workCond;
+    std::deque<std::shared_ptr<FlacJob>> _jobQueue;
+    bool _encoding;
+    std::vector<FlacFile> _flacFiles;
+
+    bool _overflowing;
+    unsigned long long _numOverflows;
+    unsigned long long _numDroppedFrames;
+};
+
+static Pothos::BlockRegistry registerAudioFileSink(
+    "/audio/file_sink", &AudioFileSink::make);
@@ -0,0 +1,266 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioFormats.hpp"
+#include "WavFile.hpp"
+#include <Pothos/Framework.hpp>
+#include <Poco/SharedMemory.h>
+#include <Poco/File.h>
+#include <Poco/Logger.h>
+#include <algorithm> //min/max
+#include <chrono>
+#include <thread>
+#include <memory>
+#ifndef _WIN32
+#include <sys/mman.h> //madvise
+#endif
+
+//the maximum number of zero-copy buffers held downstream
+static const long MAX_OUTSTANDING_BUFFERS = 16;
+
+/***********************************************************************
+ * |PothosDoc Audio File Source
+ *
+ * The audio file source replays a WAV or RF64 file to an output sample stream.
+ * The file is memory-mapped rather than read, so that multi-gigabyte captures
+ * are paged in on demand without copying through read() calls.
+ * In interleaved mode, the samples are interleaved into one output port,
+ * In the port-per-channel mode, each audio channel uses a separate port.
+ *
+ * When the output type matches the sample format of the file in interleaved mode,
+ * the output buffers reference slices of the mapping directly (zero-copy).
+ * Otherwise, samples are converted into the output buffers.
+ *
+ * The audio file source will post a sample rate stream label named "rxRate"
+ * on the first call to work() after activate() has been called,
+ * just like the audio source block. In the real-time pacing mode,
+ * samples are produced at the rate of the file on a monotonic clock.
+ *
+ * Supported files contain integer PCM (8, 16, 24, 32 bits)
+ * or IEEE float (32 bits) samples in a RIFF, RF64, or BW64 container.
+ *
+ * |category /Audio
+ * |category /Sources
+ * |keywords audio sound wav rf64 file replay
+ *
+ * |param filePath[File Path] The path to a WAV or RF64 file.
+ * |default ""
+ * |widget FileEntry(mode=open)
+ * |preview valid
+ *
+ * |param dtype[Data Type] The data type produced by the audio file source.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * This parameter must match the number of channels in the file.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |param pacing [Pacing] The rate at which samples are produced.
+ * <ul>
+ * <li>"REALTIME" - produce samples at the sample rate of the file</li>
+ * <li>"FAST" - produce samples as fast as downstream consumes them</li>
+ * </ul>
+ * |default "REALTIME"
+ * |option [Real-time] "REALTIME"
+ * |option [As fast as possible] "FAST"
+ * |preview enable
+ *
+ * |param repeat [Repeat] Restart from the beginning at the end of the file.
+ * |default false
+ * |option [Enabled] true
+ * |option [Disabled] false
+ * |preview disable
+ *
+ * |factory /audio/file_source(dtype, numChans, chanMode)
+ * |initializer openFile(filePath)
+ * |setter setPacing(pacing)
+ * |setter setRepeat(repeat)
+ **********************************************************************/
+class AudioFileSource : public Pothos::Block
+{
+public:
+    AudioFileSource(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _logger(Poco::Logger::get("AudioFileSource")),
+        _sampleType(audioSampleTypeFromDType(dtype)),
+        _numChans(numChans),
+        _interleaved(chanMode == "INTERLEAVED"),
+        _realTime(true),
+        _repeat(false),
+        _sendLabel(false),
+        _frameIndex(0),
+        _numFrames(0),
+        _framesSinceStart(0)
+    {
+        //setup ports
+        if (_interleaved) this->setupOutput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupOutput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSource, openFile));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSource, setPacing));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioFileSource, setRepeat));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioFileSource(dtype, numChans, chanMode);
+    }
+
+    void openFile(const std::string &path)
+    {
+        _mapping.reset();
+        _frameIndex = 0;
+        _numFrames = 0;
+        if (path.empty()) return;
+
+        Poco::File file(path);
+        if (not file.exists()) throw Pothos::FileNotFoundException("AudioFileSource::openFile("+path+")", "file does not exist");
+        if (file.getSize() == 0) throw Pothos::DataFormatException("AudioFileSource::openFile("+path+")", "empty file");
+
+        std::shared_ptr<Poco::SharedMemory> mapping(new Poco::SharedMemory(file, Poco::SharedMemory::AM_READ));
+        const unsigned long long length = mapping->end() - mapping->begin();
+        const auto header = wavParseHeader(mapping->begin(), length);
+        if (header.numChans != _numChans) throw Pothos::InvalidArgumentException("AudioFileSource::openFile("+path+")",
+            "file has " + std::to_string(header.numChans) + " channels, block has " + std::to_string(_numChans));
+
+        #ifndef _WIN32
+        //hint the kernel to read ahead for sequential replay
+        madvise(mapping->begin(), length, MADV_SEQUENTIAL);
+        #endif
+
+        poco_information_f3(_logger, "Opened %s: %z frames at %f Sps", path, size_t(header.dataSize/header.frameSize()), header.sampleRate);
+        _header = header;
+        _mapping = mapping;
+        _numFrames = header.dataSize/header.frameSize();
+    }
+
+    void setPacing(const std::string &pacing)
+    {
+        if (pacing == "REALTIME"){}
+        else if (pacing == "FAST"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioFileSource::setPacing("+pacing+")", "unknown pacing mode");
+        _realTime = (pacing == "REALTIME");
+        _startTime = std::chrono::steady_clock::now();
+        _framesSinceStart = 0;
+    }
+
+    void setRepeat(const bool repeat)
+    {
+        _repeat = repeat;
+    }
+
+    void activate(void)
+    {
+        _startTime = std::chrono::steady_clock::now();
+        _framesSinceStart = 0;
+        _sendLabel = true;
+    }
+
+    void work(void)
+    {
+        if (not _mapping or _numFrames == 0) return;
+        if (this->workInfo().minOutElements == 0) return;
+
+        //the end of the file was reached
+        if (_frameIndex == _numFrames)
+        {
+            if (not _repeat) return;
+            _frameIndex = 0;
+        }
+
+        if (_sendLabel)
+        {
+            _sendLabel = false;
+            Pothos::Label label("rxRate", _header.sampleRate, 0);
+            for (auto port : this->outputs()) port->postLabel(label);
+        }
+
+        size_t numFrames = std::min<size_t>(_numFrames - _frameIndex, this->workInfo().minOutElements);
+
+        //limit production to the elapsed time, and wait like a blocking device read
+        if (_realTime)
+        {
+            const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime);
+            const double due = elapsed.count()*_header.sampleRate;
+            unsigned long long available = 0;
+            if (due >= _framesSinceStart + 1) available = (unsigned long long)(due) - _framesSinceStart;
+            if (available == 0)
+            {
+                available = std::min<size_t>(numFrames, MIN_FRAMES_BLOCKING);
+                const std::chrono::duration<double> readyTime((_framesSinceStart + available)/_header.sampleRate);
+                std::this_thread::sleep_until(_startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(readyTime));
+            }
+            numFrames = std::min<size_t>(numFrames, available);
+        }
+
+        const char *fileData = _mapping->begin() + _header.dataOffset + _frameIndex*_header.frameSize();
+        const bool zeroCopy = _interleaved and _header.sampleType == _sampleType;
+
+        if (zeroCopy)
+        {
+            //downstream holds on to too many slices, wait for it to catch up
+            if (_mapping.use_count() > MAX_OUTSTANDING_BUFFERS)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return this->yield();
+            }
+
+            //the slice holds a reference to the mapping
+            Pothos::SharedBuffer slice(size_t(fileData), numFrames*_header.frameSize(), _mapping);
+            Pothos::BufferChunk chunk(slice);
+            chunk.dtype = this->output(0)->dtype();
+            this->output(0)->postBuffer(std::move(chunk));
+        }
+        else if (_interleaved)
+        {
+            audioConvert(fileData, _header.sampleType, 1, this->workInfo().outputPointers[0], _sampleType, 1, numFrames*_numChans);
+            this->output(0)->produce(numFrames);
+        }
+        else
+        {
+            //de-interleave into one port per channel
+            const size_t sampleSize = audioSampleSize(_header.sampleType);
+            for (auto port : this->outputs())
+            {
+                audioConvert(fileData + port->index()*sampleSize, _header.sampleType, _numChans,
+                    this->workInfo().outputPointers[port->index()], _sampleType, 1, numFrames);
+                port->produce(numFrames);
+            }
+        }
+
+        _frameIndex += numFrames;
+        _framesSinceStart += numFrames;
+    }
+
+private:
+    Poco::Logger &_logger;
+    const AudioSampleType _sampleType;
+    const size_t _numChans;
+    const bool _interleaved;
+    bool _realTime;
+    bool _repeat;
+    bool _sendLabel;
+    std::shared_ptr<Poco::SharedMemory> _mapping;
+    WavHeader _header;
+    unsigned long long _frameIndex;
+    unsigned long long _numFrames;
+    unsigned long long _framesSinceStart;
+    std::chrono::steady_clock::time_point _startTime;
+};
+
+static Pothos::BlockRegistry registerAudioFileSource(
+    "/audio/file_source", &AudioFileSource::make);
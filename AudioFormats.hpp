@@ -0,0 +1,215 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <Pothos/Framework.hpp>
+#include <algorithm> //min/max
+#include <cstdint>
+#include <cstring>
+
+//! One turn in radians, for the generated test tones and probes
+static const double TWO_PI = 2*3.14159265358979323846;
+
+/*!
+ * The sample types supported by the audio conversion routines.
+ * AUDIO_INT24 is packed 3-byte little endian, as found in WAV files.
+ */
+enum AudioSampleType
+{
+    AUDIO_FLOAT32,
+    AUDIO_INT32,
+    AUDIO_INT24,
+    AUDIO_INT16,
+    AUDIO_INT8,
+    AUDIO_UINT8,
+};
+
+//! The number of bytes per sample of the given type
+inline size_t audioSampleSize(const AudioSampleType type)
+{
+    switch (type)
+    {
+    case AUDIO_FLOAT32: return 4;
+    case AUDIO_INT32: return 4;
+    case AUDIO_INT24: return 3;
+    case AUDIO_INT16: return 2;
+    case AUDIO_INT8: return 1;
+    case AUDIO_UINT8: return 1;
+    }
+    return 0;
+}
+
+//! Get the sample type for the element type of a block data type
+inline AudioSampleType audioSampleTypeFromDType(const Pothos::DType &dtype)
+{
+    const auto name = dtype.name();
+    if (name == "float32") return AUDIO_FLOAT32;
+    if (name == "int32") return AUDIO_INT32;
+    if (name == "int16") return AUDIO_INT16;
+    if (name == "int8") return AUDIO_INT8;
+    if (name == "uint8") return AUDIO_UINT8;
+    throw Pothos::InvalidArgumentException("audioSampleTypeFromDType("+name+")", "unsupported audio data type");
+}
+
+/***********************************************************************
+ * Per-type scaling to and from normalized floats in [-1.0, 1.0)
+ **********************************************************************/
+template <typename T> struct AudioSampleTraits;
+
+template <> struct AudioSampleTraits<float>
+{
+    static float toFloat(const float in){return in;}
+    static float fromFloat(const float in){return in;}
+};
+
+template <> struct AudioSampleTraits<int32_t>
+{
+    static float toFloat(const int32_t in){return in*(1.0f/2147483648.0f);}
+    static int32_t fromFloat(const float in)
+    {
+        //clip in double precision, float cannot represent the max int32
+        const double x = std::max(-1.0, std::min(double(in), 1.0))*2147483648.0;
+        return int32_t(std::max(-2147483648.0, std::min(x, 2147483647.0)));
+    }
+};
+
+template <> struct AudioSampleTraits<int16_t>
+{
+    static float toFloat(const int16_t in){return in*(1.0f/32768.0f);}
+    static int16_t fromFloat(const float in){return int16_t(std::max(-32768.0f, std::min(in*32768.0f, 32767.0f)));}
+};
+
+template <> struct AudioSampleTraits<int8_t>
+{
+    static float toFloat(const int8_t in){return in*(1.0f/128.0f);}
+    static int8_t fromFloat(const float in){return int8_t(std::max(-128.0f, std::min(in*128.0f, 127.0f)));}
+};
+
+template <> struct AudioSampleTraits<uint8_t>
+{
+    static float toFloat(const uint8_t in){return (int(in)-128)*(1.0f/128.0f);}
+    static uint8_t fromFloat(const float in){return uint8_t(std::max(0.0f, std::min(in*128.0f+128.0f, 255.0f)));}
+};
+
+/***********************************************************************
+ * Strided conversion loops, the strides are in units of samples.
+ * The loops are written to auto-vectorize for unit strides.
+ **********************************************************************/
+template <typename T>
+void audioConvertToFloat(const T *in, const size_t inStride, float *out, const size_t outStride, const size_t num)
+{
+    if (inStride == 1 and outStride == 1)
+    {
+        for (size_t i = 0; i < num; i++) out[i] = AudioSampleTraits<T>::toFloat(in[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < num; i++) out[i*outStride] = AudioSampleTraits<T>::toFloat(in[i*inStride]);
+    }
+}
+
+template <typename T>
+void audioConvertFromFloat(const float *in, const size_t inStride, T *out, const size_t outStride, const size_t num)
+{
+    if (inStride == 1 and outStride == 1)
+    {
+        for (size_t i = 0; i < num; i++) out[i] = AudioSampleTraits<T>::fromFloat(in[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < num; i++) out[i*outStride] = AudioSampleTraits<T>::fromFloat(in[i*inStride]);
+    }
+}
+
+inline int32_t audioLoadInt24(const uint8_t *p)
+{
+    //sign extend from the most significant byte
+    return int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) >> 8;
+}
+
+inline void audioStoreInt24(uint8_t *p, const int32_t x)
+{
+    p[0] = uint8_t(x);
+    p[1] = uint8_t(x >> 8);
+    p[2] = uint8_t(x >> 16);
+}
+
+/*!
+ * Convert samples of any supported type into normalized floats.
+ * \param in the input samples of the given type
+ * \param type the sample type of the input
+ * \param inStride the input step between samples (in samples)
+ * \param out the output float samples
+ * \param outStride the output step between samples (in samples)
+ * \param num the number of samples to convert
+ */
+inline void audioConvertToFloat(const void *in, const AudioSampleType type, const size_t inStride, float *out, const size_t outStride, const size_t num)
+{
+    switch (type)
+    {
+    case AUDIO_FLOAT32: return audioConvertToFloat((const float *)in, inStride, out, outStride, num);
+    case AUDIO_INT32: return audioConvertToFloat((const int32_t *)in, inStride, out, outStride, num);
+    case AUDIO_INT16: return audioConvertToFloat((const int16_t *)in, inStride, out, outStride, num);
+    case AUDIO_INT8: return audioConvertToFloat((const int8_t *)in, inStride, out, outStride, num);
+    case AUDIO_UINT8: return audioConvertToFloat((const uint8_t *)in, inStride, out, outStride, num);
+    case AUDIO_INT24:
+        for (size_t i = 0; i < num; i++)
+        {
+            out[i*outStride] = audioLoadInt24((const uint8_t *)in + 3*i*inStride)*(1.0f/8388608.0f);
+        }
+        return;
+    }
+}
+
+/*!
+ * Convert normalized floats into samples of any supported type.
+ * Out of range values are clipped to the range of the output type.
+ */
+inline void audioConvertFromFloat(const float *in, const size_t inStride, void *out, const AudioSampleType type, const size_t outStride, const size_t num)
+{
+    switch (type)
+    {
+    case AUDIO_FLOAT32: return audioConvertFromFloat(in, inStride, (float *)out, outStride, num);
+    case AUDIO_INT32: return audioConvertFromFloat(in, inStride, (int32_t *)out, outStride, num);
+    case AUDIO_INT16: return audioConvertFromFloat(in, inStride, (int16_t *)out, outStride, num);
+    case AUDIO_INT8: return audioConvertFromFloat(in, inStride, (int8_t *)out, outStride, num);
+    case AUDIO_UINT8: return audioConvertFromFloat(in, inStride, (uint8_t *)out, outStride, num);
+    case AUDIO_INT24:
+        for (size_t i = 0; i < num; i++)
+        {
+            const float x = std::max(-8388608.0f, std::min(in[i*inStride]*8388608.0f, 8388607.0f));
+            audioStoreInt24((uint8_t *)out + 3*i*outStride, int32_t(x));
+        }
+        return;
+    }
+}
+
+/*!
+ * Convert samples between any two supported types.
+ * Matching types are copied directly, which keeps int32 samples exact.
+ * Other conversions go through a small block of normalized floats.
+ */
+inline void audioConvert(const void *in, const AudioSampleType inType, const size_t inStride, void *out, const AudioSampleType outType, const size_t outStride, const size_t num)
+{
+    const size_t inSize = audioSampleSize(inType);
+    const size_t outSize = audioSampleSize(outType);
+
+    if (inType == outType)
+    {
+        if (inStride == 1 and outStride == 1) std::memcpy(out, in, num*inSize);
+        else for (size_t i = 0; i < num; i++)
+        {
+            std::memcpy((char *)out + i*outStride*outSize, (const char *)in + i*inStride*inSize, inSize);
+        }
+        return;
+    }
+
+    static const size_t blockSize = 256;
+    float block[blockSize];
+    for (size_t i = 0; i < num; i += blockSize)
+    {
+        const size_t n = std::min(blockSize, num - i);
+        audioConvertToFloat((const char *)in + i*inStride*inSize, inType, inStride, block, 1, n);
+        audioConvertFromFloat(block, 1, (char *)out + i*outStride*outSize, outType, outStride, n);
+    }
+}
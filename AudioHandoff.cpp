@@ -0,0 +1,49 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioHandoff.hpp"
+#include <algorithm> //min/max
+#include <chrono>
+#include <thread>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <ctime>
+#endif
+
+//the polling period when futexes are not available
+static const long HANDOFF_POLL_US = 100;
+
+/***********************************************************************
+ * Futex wakeups, the sequence number changes on every wake
+ **********************************************************************/
+void audioFutexWake(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters)
+{
+    seq.fetch_add(1);
+    #ifdef __linux__
+    //skip the system call when nobody sleeps on the futex
+    if (waiters.load() != 0) syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    #else
+    (void)waiters;
+    #endif
+}
+
+bool audioFutexWait(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters, const uint32_t expected, const long timeoutUs)
+{
+    if (timeoutUs <= 0) return seq.load() != expected;
+    #ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeoutUs/1000000;
+    timeout.tv_nsec = (timeoutUs%1000000)*1000;
+    waiters.fetch_add(1);
+    //returns immediately when the sequence already changed since the check
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    waiters.fetch_sub(1);
+    #else
+    (void)waiters;
+    if (seq.load() == expected) std::this_thread::sleep_for(std::chrono::microseconds(std::min(timeoutUs, HANDOFF_POLL_US)));
+    #endif
+    return seq.load() != expected;
+}
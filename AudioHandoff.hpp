@@ -0,0 +1,119 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <algorithm> //min/max
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*!
+ * Bump the sequence number and wake the threads that sleep on it.
+ * The system call is skipped when the waiter count is zero,
+ * so a real-time thread only enters the kernel when another thread sleeps.
+ */
+void audioFutexWake(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters);
+
+/*!
+ * Sleep until the sequence number differs from the expected value.
+ * The wait returns at once when the sequence already changed,
+ * so a wake between reading the sequence and sleeping is never lost.
+ * The atomics may live in shared memory, futexes (Linux) work across processes.
+ * Other systems fall back to short sleeps between polls.
+ * \return true when the sequence changed
+ */
+bool audioFutexWait(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiters, const uint32_t expected, const long timeoutUs);
+
+/*!
+ * The wakeup from a real-time thread that fills or drains a ring
+ * to the block thread that waits on the other end of the ring.
+ *
+ * The block thread reads sequence() before it checks the ring,
+ * and when the ring has nothing for it, waits with that sequence.
+ * The real-time thread calls notify() after each ring commit,
+ * which is an atomic increment and no system call unless the block thread sleeps,
+ * so the real-time side stays free of allocations and locks.
+ * The transfer() loop implements the block thread side for the ring streams.
+ */
+class AudioHandoff
+{
+public:
+    AudioHandoff(void):
+        _seq(0),
+        _waiters(0)
+    {
+        return;
+    }
+
+    //! The current sequence, read before checking the ring
+    uint32_t sequence(void) const
+    {
+        return _seq.load(std::memory_order_acquire);
+    }
+
+    //! Signal a ring commit or a state change to the waiting thread
+    void notify(void)
+    {
+        audioFutexWake(_seq, _waiters);
+    }
+
+    /*!
+     * Wait for a notify() after the given sequence was read.
+     * \return true when notified, false on timeout
+     */
+    bool wait(const uint32_t sequence, const long timeoutUs)
+    {
+        return audioFutexWait(_seq, _waiters, sequence, timeoutUs);
+    }
+
+    /*!
+     * Wait for a notify() for the rest of a timeout that started at the last progress.
+     * \return false when the timeout has expired without progress
+     */
+    bool waitSince(const uint32_t sequence, const std::chrono::steady_clock::time_point &lastProgress, const std::chrono::milliseconds &timeout)
+    {
+        const auto remaining = timeout - (std::chrono::steady_clock::now() - lastProgress);
+        if (remaining <= std::chrono::steady_clock::duration::zero()) return false;
+        this->wait(sequence, long(std::chrono::duration_cast<std::chrono::microseconds>(remaining).count()) + 1);
+        return true;
+    }
+
+    /*!
+     * Move frames between a ring and the block buffer, blocking until all are done.
+     * The loop sleeps while the ring has nothing for the block thread,
+     * and gives up when the other side made no progress for the timeout.
+     * \param frames the number of frames to move
+     * \param timeout the longest time without progress
+     * \param timeoutStatus the status returned on timeout
+     * \param available a callable returning the frames the ring can move now, or a negative status
+     * \param copy a callable (offset, frames) that moves the frames at the buffer offset and commits the ring
+     * \return zero when all frames are done, or a negative status
+     */
+    template <typename AvailableFcn, typename CopyFcn>
+    int transfer(const unsigned long frames, const std::chrono::milliseconds &timeout, const int timeoutStatus, AvailableFcn &&available, CopyFcn &&copy)
+    {
+        auto lastProgress = std::chrono::steady_clock::now();
+        unsigned long done = 0;
+        while (done < frames)
+        {
+            const auto seq = this->sequence();
+            const long avail = available();
+            if (avail < 0) return int(avail);
+            const size_t n = std::min<size_t>(size_t(avail), frames - done);
+            if (n == 0)
+            {
+                //sleep until the other side commits to the ring
+                if (not this->waitSince(seq, lastProgress, timeout)) return timeoutStatus;
+                continue;
+            }
+            copy(size_t(done), n);
+            done += n;
+            lastProgress = std::chrono::steady_clock::now();
+        }
+        return 0;
+    }
+
+private:
+    std::atomic<uint32_t> _seq;
+    std::atomic<uint32_t> _waiters;
+};
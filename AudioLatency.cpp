@@ -0,0 +1,235 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include <Pothos/Plugin.hpp>
+#include <Pothos/Exception.hpp>
+#include <portaudio.h>
+#include <json.hpp>
+#include <algorithm> //min/max/sort
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+using json = nlohmann::json;
+
+/***********************************************************************
+ * Round-trip latency measurement through a loopback
+ *
+ * A full-duplex stream plays a noise probe on the output
+ * and captures the input, which is looped back to the output
+ * with a cable or a virtual loopback device.
+ * Because the input and output frames of a duplex stream are aligned,
+ * the lag of the correlation peak between the probe and the capture
+ * is the round-trip latency in frames, refined to a fraction of a frame
+ * by parabolic interpolation around the peak.
+ * The probe is band-limited to a quarter of the sample rate, which widens
+ * the correlation peak over several frames so that the interpolation holds.
+ *
+ * The output buffer is prefilled with silence before the lock step starts,
+ * so the lag includes the output buffering as in a running stream,
+ * and an underflow cannot shift the output against the input.
+ * A pass with any overflow or underflow is repeated, and when every pass
+ * had xruns, the report is marked invalid without a measured latency.
+ **********************************************************************/
+static const size_t PROBE_FRAMES = 4096;
+static const size_t NUM_TRIALS = 4;
+static const double PREROLL_SECONDS = 0.25;
+static const double TRIAL_SECONDS = 0.5;
+static const size_t CHUNK_FRAMES = 256;
+static const int PROBE_FILTER_TAPS = 31;
+static const size_t MAX_ATTEMPTS = 3;
+
+//the correlation peak over its RMS for a detection
+static const double DETECTION_RATIO = 8.0;
+
+//! Noise through a windowed-sinc low pass filter at a quarter of the sample rate
+static std::vector<float> makeProbe(void)
+{
+    std::minstd_rand gen(1);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    std::vector<double> noise(PROBE_FRAMES+PROBE_FILTER_TAPS);
+    for (auto &x : noise) x = dist(gen);
+
+    std::vector<double> taps(PROBE_FILTER_TAPS);
+    const int mid = PROBE_FILTER_TAPS/2;
+    for (int i = 0; i < PROBE_FILTER_TAPS; i++)
+    {
+        const double x = TWO_PI*(i-mid)/4;
+        const double window = 0.5 - 0.5*std::cos(TWO_PI*(i+1)/(PROBE_FILTER_TAPS+1));
+        taps[i] = window*((i == mid)?0.5:std::sin(x)/(2*x));
+    }
+
+    std::vector<float> probe(PROBE_FRAMES);
+    for (size_t n = 0; n < PROBE_FRAMES; n++)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < PROBE_FILTER_TAPS; i++) sum += taps[i]*noise[n+i];
+        probe[n] = float(sum);
+    }
+    return probe;
+}
+
+/*!
+ * Find the probe in one window of the capture.
+ * Returns the lag in fractional frames and the peak to RMS ratio.
+ */
+static json findProbe(const std::vector<float> &probe, const float *capture, const size_t numLags)
+{
+    std::vector<double> corr(numLags);
+    double sumSquares = 0.0;
+    size_t peak = 0;
+    for (size_t lag = 0; lag < numLags; lag++)
+    {
+        double sum = 0.0;
+        for (size_t k = 0; k < probe.size(); k++) sum += probe[k]*capture[lag+k];
+        corr[lag] = sum;
+        sumSquares += sum*sum;
+        if (std::abs(sum) > std::abs(corr[peak])) peak = lag;
+    }
+
+    //parabolic interpolation of the magnitude around the peak
+    double offset = 0.0;
+    if (peak > 0 and peak+1 < numLags)
+    {
+        const double y0 = std::abs(corr[peak-1]), y1 = std::abs(corr[peak]), y2 = std::abs(corr[peak+1]);
+        const double denom = y0 - 2*y1 + y2;
+        if (denom != 0.0) offset = std::max(-0.5, std::min(0.5, 0.5*(y0 - y2)/denom));
+    }
+
+    const double rms = std::sqrt(sumSquares/numLags);
+    const double ratio = (rms == 0.0)?0.0:std::abs(corr[peak])/rms;
+    json trial;
+    trial["frames"] = peak + offset;
+    trial["peakToRms"] = ratio;
+    trial["inverted"] = corr[peak] < 0.0;
+    trial["detected"] = ratio >= DETECTION_RATIO;
+    return trial;
+}
+
+/*!
+ * Play the output and capture the input in lock step, after prefilling the output buffer.
+ * \return the number of overflows and underflows during the pass
+ */
+static unsigned long long playCapture(PaStream *stream, const std::vector<float> &output, std::vector<float> &capture)
+{
+    PaError err = Pa_StartStream(stream);
+    if (err != paNoError) throw Pothos::Exception("/devices/audio/latency", "Pa_StartStream: " + std::string(Pa_GetErrorText(err)));
+    std::shared_ptr<PaStream> streamStopper(stream, &Pa_StopStream);
+
+    //fill the output buffer so the first writes cannot underflow
+    const signed long prefill = Pa_GetStreamWriteAvailable(stream);
+    if (prefill < 0) throw Pothos::Exception("/devices/audio/latency", "Pa_GetStreamWriteAvailable: " + std::string(Pa_GetErrorText(PaError(prefill))));
+    const std::vector<float> silence(size_t(prefill), 0.0f);
+    err = (prefill == 0)?paNoError:Pa_WriteStream(stream, silence.data(), prefill);
+    if (err != paNoError and err != paOutputUnderflowed) throw Pothos::Exception("/devices/audio/latency", "Pa_WriteStream: " + std::string(Pa_GetErrorText(err)));
+
+    unsigned long long numXruns = 0;
+    const size_t total = output.size();
+    for (size_t pos = 0; pos < total; pos += CHUNK_FRAMES)
+    {
+        const unsigned long n = std::min(CHUNK_FRAMES, total-pos);
+        err = Pa_WriteStream(stream, output.data()+pos, n);
+        if (err == paOutputUnderflowed) numXruns++;
+        else if (err != paNoError) throw Pothos::Exception("/devices/audio/latency", "Pa_WriteStream: " + std::string(Pa_GetErrorText(err)));
+        err = Pa_ReadStream(stream, capture.data()+pos, n);
+        if (err == paInputOverflowed) numXruns++;
+        else if (err != paNoError) throw Pothos::Exception("/devices/audio/latency", "Pa_ReadStream: " + std::string(Pa_GetErrorText(err)));
+    }
+    return numXruns;
+}
+
+/*!
+ * Measure the round-trip latency between an input and an output device,
+ * named as in the device parameter of the audio blocks.
+ * The JSON report holds each trial, the median measured latency,
+ * and its difference to the latencies reported by Pa_GetStreamInfo().
+ * The measured latency is left out when the report is not valid.
+ */
+static std::string measureAudioLatency(const std::string &inputDevice, const std::string &outputDevice, const double sampleRate)
+{
+    //the backend keeps PortAudio initialized, its device indexes are PortAudio indexes
+    const auto backend = AudioBackend::make("portaudio");
+
+    PaStreamParameters inParams, outParams;
+    inParams.device = backend->resolveDevice(inputDevice, false);
+    outParams.device = backend->resolveDevice(outputDevice, true);
+    inParams.channelCount = outParams.channelCount = 1;
+    inParams.sampleFormat = outParams.sampleFormat = paFloat32;
+    inParams.suggestedLatency = Pa_GetDeviceInfo(inParams.device)->defaultLowInputLatency;
+    outParams.suggestedLatency = Pa_GetDeviceInfo(outParams.device)->defaultLowOutputLatency;
+    inParams.hostApiSpecificStreamInfo = outParams.hostApiSpecificStreamInfo = nullptr;
+
+    PaStream *stream = nullptr;
+    PaError err = Pa_OpenStream(&stream, &inParams, &outParams, sampleRate,
+        CHUNK_FRAMES, paClipOff, nullptr, nullptr);
+    if (err != paNoError) throw Pothos::Exception("/devices/audio/latency", "Pa_OpenStream: " + std::string(Pa_GetErrorText(err)));
+    std::shared_ptr<PaStream> streamCloser(stream, &Pa_CloseStream);
+
+    //the probe starts each trial window, silence elsewhere
+    std::vector<float> probe = makeProbe();
+    const size_t preroll = size_t(PREROLL_SECONDS*sampleRate);
+    const size_t window = size_t(TRIAL_SECONDS*sampleRate);
+    if (window <= PROBE_FRAMES*2) throw Pothos::InvalidArgumentException(
+        "/devices/audio/latency", "Sample rate too low for the probe");
+    const size_t total = preroll + NUM_TRIALS*window;
+    std::vector<float> output(total, 0.0f), capture(total+PROBE_FRAMES, 0.0f);
+    for (size_t t = 0; t < NUM_TRIALS; t++)
+    {
+        std::copy(probe.begin(), probe.end(), output.begin()+preroll+t*window);
+    }
+
+    //play and capture in lock step, again when a pass had xruns
+    unsigned long long numXruns = 0;
+    size_t attempts = 0;
+    do
+    {
+        std::fill(capture.begin(), capture.end(), 0.0f);
+        numXruns = playCapture(stream, output, capture);
+        attempts++;
+    } while (numXruns != 0 and attempts < MAX_ATTEMPTS);
+    const bool valid = numXruns == 0;
+
+    //locate the probe in each window, the median detected lag is the result
+    json trials = json::array();
+    std::vector<double> lags;
+    for (size_t t = 0; t < NUM_TRIALS; t++)
+    {
+        auto trial = findProbe(probe, capture.data()+preroll+t*window, window-PROBE_FRAMES);
+        trial["latency"] = trial["frames"].get<double>()/sampleRate;
+        if (trial["detected"].get<bool>()) lags.push_back(trial["frames"].get<double>());
+        trials.push_back(trial);
+    }
+
+    const auto info = Pa_GetStreamInfo(stream);
+    json report;
+    report["inputDevice"] = std::string(Pa_GetDeviceInfo(inParams.device)->name);
+    report["outputDevice"] = std::string(Pa_GetDeviceInfo(outParams.device)->name);
+    report["hostApi"] = std::string(Pa_GetHostApiInfo(Pa_GetDeviceInfo(outParams.device)->hostApi)->name);
+    report["sampleRate"] = info->sampleRate;
+    report["reportedInputLatency"] = info->inputLatency;
+    report["reportedOutputLatency"] = info->outputLatency;
+    report["reportedLatency"] = info->inputLatency + info->outputLatency;
+    report["numXruns"] = numXruns;
+    report["attempts"] = attempts;
+    report["valid"] = valid;
+    report["trials"] = trials;
+    report["detected"] = not lags.empty();
+    if (valid and not lags.empty())
+    {
+        std::sort(lags.begin(), lags.end());
+        const size_t mid = lags.size()/2;
+        const double frames = (lags.size()%2 == 1)?lags[mid]:(lags[mid-1] + lags[mid])/2;
+        report["measuredFrames"] = frames;
+        report["measuredLatency"] = frames/sampleRate;
+        report["difference"] = frames/sampleRate - (info->inputLatency + info->outputLatency);
+    }
+    return report.dump();
+}
+
+pothos_static_block(registerAudioLatency)
+{
+    Pothos::PluginRegistry::addCall(
+        "/devices/audio/latency", &measureAudioLatency);
+}
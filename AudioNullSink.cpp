@@ -0,0 +1,153 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioPacer.hpp"
+#include <Pothos/Framework.hpp>
+#include <algorithm> //min/max
+
+/***********************************************************************
+ * |PothosDoc Audio Null Sink
+ *
+ * The audio null sink is a virtual audio output device for machines without a sound card.
+ * It consumes an input sample stream at the real-time rate of the sample rate parameter,
+ * paced by a monotonic clock rather than an audio device, and discards the samples.
+ * In interleaved mode, the samples are interleaved from one input port,
+ * In the port-per-channel mode, each audio channel uses a separate port.
+ *
+ * The null sink simulates a device buffer of 8*MIN_FRAMES_BLOCKING frames:
+ * the sink blocks while the buffer is full, and when the buffer drains
+ * before upstream delivers more samples, an underflow is counted
+ * just like a real playback device. Like the audio sink,
+ * the getNumFrames() and getNumXruns() calls report the statistics.
+ *
+ * |category /Audio
+ * |category /Sinks
+ * |keywords audio sound virtual null test headless
+ *
+ * |param sampRate[Sample Rate] The rate of audio samples.
+ * |option 32e3
+ * |option 44.1e3
+ * |option 48e3
+ * |default 44.1e3
+ * |units Sps
+ * |widget ComboBox(editable=true)
+ *
+ * |param dtype[Data Type] The data type consumed by the null sink.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * This parameter controls the number of samples per stream element.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |factory /audio/null_sink(dtype, numChans, chanMode)
+ * |setter setSampleRate(sampRate)
+ **********************************************************************/
+class AudioNullSink : public Pothos::Block
+{
+public:
+    AudioNullSink(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _sampleRate(44100.0),
+        _started(false),
+        _numXruns(0),
+        _numFrames(0),
+        _frameCount(0)
+    {
+        //setup ports
+        if (chanMode == "INTERLEAVED") this->setupInput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupInput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioNullSink, setSampleRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioNullSink, getNumXruns));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioNullSink, getNumFrames));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioNullSink(dtype, numChans, chanMode);
+    }
+
+    void setSampleRate(const double rate)
+    {
+        if (rate <= 0.0) throw Pothos::InvalidArgumentException(
+            "AudioNullSink::setSampleRate()", "sample rate must be positive");
+        _sampleRate = rate;
+    }
+
+    unsigned long long getNumXruns(void) const
+    {
+        return _numXruns;
+    }
+
+    unsigned long long getNumFrames(void) const
+    {
+        return _numFrames;
+    }
+
+    void activate(void)
+    {
+        _started = false;
+        _frameCount = 0;
+        _numXruns = 0;
+        _numFrames = 0;
+    }
+
+    void work(void)
+    {
+        const size_t numInput = this->workInfo().minInElements;
+        if (numInput == 0) return;
+
+        //the simulated playback starts with the first samples
+        if (not _started)
+        {
+            _started = true;
+            _pacer.reset(_sampleRate);
+            _frameCount = 0;
+        }
+
+        //the buffer drained before more samples arrived
+        unsigned long long played = _pacer.dueFrames();
+        if (played > _frameCount)
+        {
+            _numXruns++;
+            _frameCount = played;
+        }
+
+        //wait for buffer space, like a blocking device write
+        if (_frameCount - played >= VIRTUAL_BUFFER_FRAMES)
+        {
+            const size_t numBlock = std::min<size_t>(MIN_FRAMES_BLOCKING, numInput);
+            played = _frameCount + numBlock - VIRTUAL_BUFFER_FRAMES;
+            _pacer.sleepUntil(played);
+        }
+        const size_t numFrames = std::min<size_t>(numInput, size_t(VIRTUAL_BUFFER_FRAMES - (_frameCount - played)));
+
+        for (auto port : this->inputs()) port->consume(numFrames);
+        _frameCount += numFrames;
+        _numFrames += numFrames;
+    }
+
+private:
+    double _sampleRate;
+    bool _started;
+    unsigned long long _numXruns;
+    unsigned long long _numFrames;
+    unsigned long long _frameCount;
+    AudioPacer _pacer;
+};
+
+static Pothos::BlockRegistry registerAudioNullSink(
+    "/audio/null_sink", &AudioNullSink::make);
@@ -0,0 +1,49 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <chrono>
+#include <thread>
+
+//the simulated device buffer of the virtual blocks
+static const unsigned long long VIRTUAL_BUFFER_FRAMES = 8*MIN_FRAMES_BLOCKING;
+
+/*!
+ * A sample clock on the monotonic system clock,
+ * used by the virtual audio blocks in place of a device clock.
+ * The clock counts the frames that are due since the last reset.
+ */
+class AudioPacer
+{
+public:
+    AudioPacer(void):
+        _rate(1.0)
+    {
+        this->reset(1.0);
+    }
+
+    //! Restart the clock at frame zero with the given rate
+    void reset(const double rate)
+    {
+        _rate = rate;
+        _start = std::chrono::steady_clock::now();
+    }
+
+    //! The number of frames due since the last reset
+    unsigned long long dueFrames(void) const
+    {
+        const std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - _start);
+        return (unsigned long long)(elapsed.count()*_rate);
+    }
+
+    //! Sleep until the given frame is due, like a blocking device call
+    void sleepUntil(const unsigned long long frame) const
+    {
+        const std::chrono::duration<double> offset(frame/_rate);
+        std::this_thread::sleep_until(_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+    }
+
+private:
+    double _rate;
+    std::chrono::steady_clock::time_point _start;
+};
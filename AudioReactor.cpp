@@ -0,0 +1,544 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioReactor.hpp"
+#include "AudioHandoff.hpp"
+#include <Pothos/Exception.hpp>
+#ifdef __linux__
+#include <Poco/Logger.h>
+#include <algorithm> //min/max
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/***********************************************************************
+ * I/O reactor
+ *
+ * Each reactor thread owns an epoll set with the poll descriptors
+ * of its streams, and services the ready streams under its mutex,
+ * so that a stream can be removed without racing a service call.
+ * The epoll event bits are the poll() bits that the streams report.
+ * A sink with an empty ring takes its descriptors out of the epoll set
+ * until the block writes again, the device would report ready forever.
+ **********************************************************************/
+
+//the device frames of a sink ring, and the ring size for a source
+static const size_t REACTOR_RING_LATENCIES = 2;
+
+//the frames read in one go when a source ring overflows
+static const size_t REACTOR_DROP_FRAMES = 1024;
+
+//the events taken from one epoll_wait() call
+static const int REACTOR_MAX_EVENTS = 64;
+
+//give up on a blocking call after the reactor stalls this long
+static const long REACTOR_TIMEOUT_MS = 2000;
+
+//the status of a timed out transfer, away from the error codes of the device streams
+static const int REACTOR_ERROR_TIMEOUT = INT_MIN;
+
+class ReactorThread;
+
+/***********************************************************************
+ * Stream serviced by the reactor, with a ring between the device and the block
+ **********************************************************************/
+class ReactorStream : public AudioStream
+{
+public:
+    ReactorStream(std::unique_ptr<AudioStream> &&inner, const AudioStreamArgs &args, const std::shared_ptr<class AudioReactor> &reactor):
+        _inner(std::move(inner)),
+        _reactor(reactor),
+        _thread(nullptr),
+        _isSink(args.isSink),
+        _interleaved(args.interleaved),
+        _numChans(args.numChans),
+        _sampleType(args.sampleType),
+        _sampleBytes(audioSampleSize(args.sampleType)),
+        _frameBytes(_sampleBytes*_numChans),
+        _ringFrames(1),
+        _fillFrames(std::max<size_t>(1, size_t(_inner->latency()*_inner->sampleRate()))),
+        _pollFds(_inner->pollDescriptors()),
+        _readCount(0),
+        _writeCount(0),
+        _armed(true),
+        _xrun(false),
+        _error(0),
+        _availableTime(0.0)
+    {
+        if (_pollFds.empty()) throw Pothos::NotImplementedException("audioReactorOpen()", "The backend stream has no poll descriptors");
+        while (_ringFrames < REACTOR_RING_LATENCIES*_fillFrames) _ringFrames *= 2;
+        _ring.resize(_ringFrames*_frameBytes);
+        _drop.resize(REACTOR_DROP_FRAMES*_frameBytes);
+    }
+
+    ~ReactorStream(void);
+
+    void start(void);
+    void stop(void);
+
+    long available(void)
+    {
+        const int error = _error.load();
+        if (error != 0) return error;
+        const size_t filled = size_t(_writeCount.load(std::memory_order_acquire) - _readCount.load(std::memory_order_acquire));
+        if (not _isSink) return long(filled);
+        return long(_fillFrames - std::min(_fillFrames, filled));
+    }
+
+    int read(void *buffer, const unsigned long frames)
+    {
+        return this->transfer(buffer, frames);
+    }
+
+    int write(const void *buffer, const unsigned long frames)
+    {
+        return this->transfer(const_cast<void *>(buffer), frames);
+    }
+
+    double time(void)
+    {
+        return _inner->time();
+    }
+
+    //! The time of the device available() count when the reactor last serviced the stream
+    double availableTime(void)
+    {
+        return _availableTime.load(std::memory_order_acquire);
+    }
+
+    double sampleRate(void)
+    {
+        return _inner->sampleRate();
+    }
+
+    double latency(void)
+    {
+        return _inner->latency();
+    }
+
+    std::string errorText(const int status)
+    {
+        if (status == REACTOR_ERROR_TIMEOUT) return "I/O reactor timed out";
+        return _inner->errorText(status);
+    }
+
+    /*******************************************************************
+     * Reactor thread side
+     ******************************************************************/
+    std::vector<AudioPollFd> &pollFds(void)
+    {
+        return _pollFds;
+    }
+
+    //! Check the returned events, and move frames when the device is ready
+    void service(void)
+    {
+        if (_inner->pollReady(_pollFds))
+        {
+            const long avail = _inner->available();
+            if (avail < 0) this->fail(int(avail));
+            else
+            {
+                _availableTime.store(_inner->availableTime(), std::memory_order_release);
+                if (_isSink) this->serviceOutput(size_t(avail));
+                else this->serviceInput(size_t(avail));
+            }
+            _handoff.notify();
+        }
+        for (auto &fd : _pollFds) fd.revents = 0;
+    }
+
+private:
+    void fail(const int status);
+    void setArmed(const bool armed);
+
+    void serviceInput(size_t avail)
+    {
+        const auto readCount = _readCount.load(std::memory_order_acquire);
+        const auto writeCount = _writeCount.load(std::memory_order_relaxed);
+        const size_t n = std::min(avail, _ringFrames - size_t(writeCount - readCount));
+        size_t done = 0;
+        while (done < n)
+        {
+            const size_t offset = (writeCount + done) & (_ringFrames-1);
+            const size_t chunk = std::min(n - done, _ringFrames - offset);
+            const int status = _inner->read(_ring.data() + offset*_frameBytes, chunk);
+            if (status < 0) return this->fail(status);
+            if (status == AUDIO_XRUN) _xrun = true;
+            done += chunk;
+        }
+        _writeCount.store(writeCount + n, std::memory_order_release);
+
+        //the block fell behind, drain the device to keep it running
+        avail -= n;
+        if (avail != 0) _xrun = true;
+        while (avail != 0)
+        {
+            const size_t chunk = std::min(avail, REACTOR_DROP_FRAMES);
+            const int status = _inner->read(_drop.data(), chunk);
+            if (status < 0) return this->fail(status);
+            avail -= chunk;
+        }
+    }
+
+    void serviceOutput(const size_t avail)
+    {
+        const auto readCount = _readCount.load(std::memory_order_relaxed);
+        const auto writeCount = _writeCount.load(std::memory_order_acquire);
+        const size_t n = std::min(avail, size_t(writeCount - readCount));
+        if (n == 0)
+        {
+            //wait for the block, then look again in case it wrote in the meantime
+            this->setArmed(false);
+            _armed = false;
+            if (_writeCount.load() != readCount and not _armed.exchange(true)) this->setArmed(true);
+            return;
+        }
+
+        size_t done = 0;
+        while (done < n)
+        {
+            const size_t offset = (readCount + done) & (_ringFrames-1);
+            const size_t chunk = std::min(n - done, _ringFrames - offset);
+            const int status = _inner->write(_ring.data() + offset*_frameBytes, chunk);
+            if (status < 0) return this->fail(status);
+            if (status == AUDIO_XRUN) _xrun = true;
+            done += chunk;
+        }
+        _readCount.store(readCount + n, std::memory_order_release);
+    }
+
+    /*******************************************************************
+     * Block thread side
+     ******************************************************************/
+    //! Copy between the ring and the Pothos buffer, blocking until all are done
+    int transfer(void *buffer, const unsigned long frames)
+    {
+        const int status = _handoff.transfer(frames, std::chrono::milliseconds(REACTOR_TIMEOUT_MS), REACTOR_ERROR_TIMEOUT,
+            [this](void)
+            {
+                return this->available();
+            },
+            [this, buffer](const size_t offset, const size_t n)
+            {
+                const auto count = _isSink?_writeCount.load(std::memory_order_relaxed):_readCount.load(std::memory_order_relaxed);
+                size_t copied = 0;
+                while (copied < n)
+                {
+                    const size_t ringOffset = (count + copied) & (_ringFrames-1);
+                    const size_t chunk = std::min(n - copied, _ringFrames - ringOffset);
+                    this->copyFrames(_ring.data() + ringOffset*_frameBytes, buffer, offset + copied, chunk);
+                    copied += chunk;
+                }
+                if (_isSink) _writeCount.store(count + n, std::memory_order_release);
+                else _readCount.store(count + n, std::memory_order_release);
+
+                //put the descriptors back after the reactor ran out of frames
+                if (_isSink and not _armed.exchange(true)) this->setArmed(true);
+            });
+        if (status < 0) return status;
+        return _xrun.exchange(false)?AUDIO_XRUN:AUDIO_OK;
+    }
+
+    //! The ring holds interleaved frames, split them for the port per channel mode
+    void copyFrames(char *ring, void *buffer, const size_t bufferOffset, const size_t frames)
+    {
+        if (_interleaved)
+        {
+            char *user = (char *)buffer + bufferOffset*_frameBytes;
+            if (_isSink) std::memcpy(ring, user, frames*_frameBytes);
+            else std::memcpy(user, ring, frames*_frameBytes);
+            return;
+        }
+        for (size_t c = 0; c < _numChans; c++)
+        {
+            char *user = ((char **)buffer)[c] + bufferOffset*_sampleBytes;
+            char *chan = ring + c*_sampleBytes;
+            if (_isSink) audioConvert(user, _sampleType, 1, chan, _sampleType, _numChans, frames);
+            else audioConvert(chan, _sampleType, _numChans, user, _sampleType, 1, frames);
+        }
+    }
+
+    std::unique_ptr<AudioStream> _inner;
+    std::shared_ptr<class AudioReactor> _reactor;
+    ReactorThread *_thread;
+    const bool _isSink;
+    const bool _interleaved;
+    const size_t _numChans;
+    const AudioSampleType _sampleType;
+    const size_t _sampleBytes;
+    const size_t _frameBytes;
+    size_t _ringFrames;
+    const size_t _fillFrames;
+    std::vector<char> _ring;
+    std::vector<char> _drop;
+    std::vector<AudioPollFd> _pollFds;
+
+    //shared with the reactor thread
+    std::atomic<unsigned long long> _readCount;
+    std::atomic<unsigned long long> _writeCount;
+    std::atomic<bool> _armed;
+    std::atomic<bool> _xrun;
+    std::atomic<int> _error;
+    std::atomic<double> _availableTime;
+    AudioHandoff _handoff;
+};
+
+/***********************************************************************
+ * One reactor thread with its epoll set
+ **********************************************************************/
+class ReactorThread
+{
+public:
+    ReactorThread(const int cpu):
+        _epoll(epoll_create1(EPOLL_CLOEXEC)),
+        _wake(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        _running(true)
+    {
+        if (_epoll < 0 or _wake < 0) throw Pothos::RuntimeException("ReactorThread()", std::strerror(errno));
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = _wake;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+        _thread = std::thread(&ReactorThread::loop, this);
+        this->configure(cpu);
+    }
+
+    ~ReactorThread(void)
+    {
+        _running = false;
+        const uint64_t one = 1;
+        if (::write(_wake, &one, sizeof(one)) < 0){}
+        _thread.join();
+        close(_wake);
+        close(_epoll);
+    }
+
+    size_t numStreams(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _streams.size();
+    }
+
+    void add(ReactorStream *stream)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &fd : stream->pollFds())
+        {
+            _streams[fd.fd] = stream;
+            epoll_event ev = this->event(fd, true);
+            if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd.fd, &ev) != 0) throw Pothos::RuntimeException(
+                "ReactorThread::add()", "epoll_ctl: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    //! Once this returns, the thread is not servicing the stream and never will again
+    void remove(ReactorStream *stream)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &fd : stream->pollFds())
+        {
+            epoll_ctl(_epoll, EPOLL_CTL_DEL, fd.fd, nullptr);
+            _streams.erase(fd.fd);
+        }
+    }
+
+    //! Add or take out the events of a stream without removing it, safe from any thread
+    void setArmed(ReactorStream *stream, const bool armed)
+    {
+        for (auto &fd : stream->pollFds())
+        {
+            epoll_event ev = this->event(fd, armed);
+            epoll_ctl(_epoll, EPOLL_CTL_MOD, fd.fd, &ev);
+        }
+    }
+
+private:
+    static epoll_event event(const AudioPollFd &fd, const bool armed)
+    {
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = armed?uint32_t(uint16_t(fd.events)):0;
+        ev.data.fd = fd.fd;
+        return ev;
+    }
+
+    //! Pin the thread and raise it to a real-time priority when permitted
+    void configure(const int cpu)
+    {
+        auto &logger = Poco::Logger::get("AudioReactor");
+        if (cpu >= 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            const int err = pthread_setaffinity_np(_thread.native_handle(), sizeof(cpus), &cpus);
+            if (err != 0) poco_warning_f2(logger, "Cannot pin reactor thread to CPU %d: %s", cpu, std::string(std::strerror(err)));
+        }
+
+        sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO)/2;
+        const int err = pthread_setschedparam(_thread.native_handle(), SCHED_FIFO, &param);
+        if (err != 0) poco_information_f1(logger, "Reactor thread runs without real-time priority: %s", std::string(std::strerror(err)));
+    }
+
+    void loop(void)
+    {
+        epoll_event events[REACTOR_MAX_EVENTS];
+        ReactorStream *ready[REACTOR_MAX_EVENTS];
+        while (_running)
+        {
+            const int n = epoll_wait(_epoll, events, REACTOR_MAX_EVENTS, -1);
+            if (n <= 0) continue;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            //collect the events per stream, a stream may have several descriptors
+            int numReady = 0;
+            for (int i = 0; i < n; i++)
+            {
+                const int fd = events[i].data.fd;
+                if (fd == _wake)
+                {
+                    uint64_t count = 0;
+                    if (::read(_wake, &count, sizeof(count)) < 0){}
+                    continue;
+                }
+
+                //skip the events of a stream that was removed after the wait
+                const auto it = _streams.find(fd);
+                if (it == _streams.end()) continue;
+                ReactorStream *stream = it->second;
+                for (auto &pfd : stream->pollFds())
+                {
+                    if (pfd.fd == fd) pfd.revents = short(events[i].events);
+                }
+                if (std::find(ready, ready+numReady, stream) == ready+numReady) ready[numReady++] = stream;
+            }
+
+            for (int i = 0; i < numReady; i++) ready[i]->service();
+        }
+    }
+
+    int _epoll;
+    int _wake;
+    std::atomic<bool> _running;
+    std::mutex _mutex;
+    std::map<int, ReactorStream *> _streams;
+    std::thread _thread;
+};
+
+/***********************************************************************
+ * The process-wide reactor, alive while streams use it
+ **********************************************************************/
+class AudioReactor
+{
+public:
+    static std::shared_ptr<AudioReactor> get(const std::vector<int> &cpus)
+    {
+        static std::mutex mutex;
+        static std::weak_ptr<AudioReactor> weak;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto reactor = weak.lock();
+        if (not reactor)
+        {
+            reactor.reset(new AudioReactor(cpus));
+            weak = reactor;
+        }
+        else if (not cpus.empty() and cpus != reactor->_cpus)
+        {
+            poco_warning(Poco::Logger::get("AudioReactor"), "The I/O reactor is already running on other CPUs, using the running threads");
+        }
+        return reactor;
+    }
+
+    //! The thread with the fewest streams takes the next one
+    ReactorThread *assign(void)
+    {
+        ReactorThread *best = _threads.front().get();
+        for (const auto &thread : _threads)
+        {
+            if (thread->numStreams() < best->numStreams()) best = thread.get();
+        }
+        return best;
+    }
+
+private:
+    AudioReactor(const std::vector<int> &cpus):
+        _cpus(cpus)
+    {
+        if (cpus.empty()) _threads.emplace_back(new ReactorThread(-1));
+        for (const int cpu : cpus) _threads.emplace_back(new ReactorThread(cpu));
+    }
+
+    const std::vector<int> _cpus;
+    std::vector<std::unique_ptr<ReactorThread>> _threads;
+};
+
+/***********************************************************************
+ * ReactorStream methods that use the thread
+ **********************************************************************/
+ReactorStream::~ReactorStream(void)
+{
+    if (_thread != nullptr) _thread->remove(this);
+}
+
+void ReactorStream::start(void)
+{
+    _readCount = 0;
+    _writeCount = 0;
+    _armed = true;
+    _xrun = false;
+    _error = 0;
+    _inner->start();
+    _thread = _reactor->assign();
+    _thread->add(this);
+}
+
+void ReactorStream::stop(void)
+{
+    if (_thread != nullptr) _thread->remove(this);
+    _thread = nullptr;
+    _inner->stop();
+}
+
+void ReactorStream::fail(const int status)
+{
+    //stop servicing, the block reports the error on the next call
+    _error = status;
+    this->setArmed(false);
+}
+
+void ReactorStream::setArmed(const bool armed)
+{
+    if (_thread != nullptr) _thread->setArmed(this, armed);
+}
+
+std::unique_ptr<AudioStream> audioReactorOpen(AudioBackend &backend, const AudioStreamArgs &args, const std::vector<int> &cpus)
+{
+    //the reactor moves interleaved frames, the ring splits them for the block
+    auto deviceArgs = args;
+    deviceArgs.interleaved = true;
+    auto inner = backend.open(deviceArgs);
+    return std::unique_ptr<AudioStream>(new ReactorStream(std::move(inner), args, AudioReactor::get(cpus)));
+}
+
+#else
+
+std::unique_ptr<AudioStream> audioReactorOpen(AudioBackend &, const AudioStreamArgs &, const std::vector<int> &)
+{
+    throw Pothos::NotImplementedException("audioReactorOpen()", "The I/O reactor requires epoll");
+}
+
+#endif //__linux__
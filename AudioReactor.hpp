@@ -0,0 +1,27 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include "AudioBackend.hpp"
+#include <memory>
+#include <vector>
+
+/*!
+ * Open a stream that the shared I/O reactor services.
+ *
+ * The reactor waits on the poll descriptors of every stream opened through it
+ * in one epoll loop per reactor thread, and moves the frames between the device
+ * and a ring per stream when the device is ready. The returned stream reads from
+ * or writes to that ring, so the blocks never call into the device themselves,
+ * and many devices share a few real-time threads instead of one each.
+ *
+ * The reactor is shared by the process and runs while any of its streams is open.
+ * The first stream starts the threads, later streams share them.
+ *
+ * \param backend the backend that opens the device stream
+ * \param args the stream configuration of the block
+ * \param cpus the CPUs of the reactor threads, one thread pinned to each CPU,
+ * or an empty list for a single thread without CPU affinity
+ * \throws Pothos::NotImplementedException when the stream has no poll descriptors
+ */
+std::unique_ptr<AudioStream> audioReactorOpen(AudioBackend &backend, const AudioStreamArgs &args, const std::vector<int> &cpus);
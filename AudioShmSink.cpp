@@ -0,0 +1,223 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "ShmAudioRing.hpp"
+#include <Pothos/Framework.hpp>
+#include <Poco/Logger.h>
+#include <algorithm> //min/max
+
+//the longest wait for ring space in a call to work()
+static const long SHM_WAIT_US = 10000;
+
+/***********************************************************************
+ * |PothosDoc Audio Shared Memory Sink
+ *
+ * The audio shared memory sink writes an input sample stream into a named
+ * POSIX shared memory ring, to be read by an audio shared memory source
+ * in another process on the same machine, or in the same process as a virtual loopback.
+ * Samples are stored once in the ring without serialization,
+ * and the reader is woken by a futex as soon as samples are committed.
+ *
+ * The sink creates the ring on activation and removes it on deactivation.
+ * A ring left behind by a sink that exited is replaced, but activation fails
+ * while another live sink owns a ring with the same name.
+ * While no reader is attached and the ring is full, input is discarded,
+ * so the upstream graph never stalls on a missing reader.
+ * When a reader is attached and the ring is full, the sink waits for space.
+ *
+ * The "rxRate" label (or the sampRate parameter) sets the stream rate in the ring header.
+ * Other labels with numeric data, such as "rxTime", are carried through the ring
+ * and reposted by the source at the same sample. Labels are taken from the first port.
+ *
+ * |category /Audio
+ * |category /Sinks
+ * |keywords audio sound shared memory ipc loopback
+ *
+ * |param name[Ring Name] The name of the shared memory ring, like "/pothos_audio".
+ * |default "/pothos_audio"
+ * |widget StringEntry()
+ * |preview valid
+ *
+ * |param sampRate[Sample Rate] The stream rate written to the ring header.
+ * |option 32e3
+ * |option 44.1e3
+ * |option 48e3
+ * |default 44.1e3
+ * |units Sps
+ * |widget ComboBox(editable=true)
+ *
+ * |param dtype[Data Type] The data type consumed by the shared memory sink.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |param bufferSize [Buffer Size] The capacity of the ring in frames.
+ * |units frames
+ * |default 16384
+ * |preview disable
+ *
+ * |factory /audio/shm_sink(dtype, numChans, chanMode)
+ * |setter setName(name)
+ * |setter setSampleRate(sampRate)
+ * |setter setBufferSize(bufferSize)
+ **********************************************************************/
+class AudioShmSink : public Pothos::Block
+{
+public:
+    AudioShmSink(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _logger(Poco::Logger::get("AudioShmSink")),
+        _sampleType(audioSampleTypeFromDType(dtype)),
+        _numChans(numChans),
+        _interleaved(chanMode == "INTERLEAVED"),
+        _sampleRate(44100.0),
+        _bufferSize(16384),
+        _numDroppedLabels(0)
+    {
+        //setup ports
+        if (_interleaved) this->setupInput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupInput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioShmSink, setName));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioShmSink, setSampleRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioShmSink, setBufferSize));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioShmSink(dtype, numChans, chanMode);
+    }
+
+    void setName(const std::string &name)
+    {
+        if (name.empty() or name[0] != '/') throw Pothos::InvalidArgumentException(
+            "AudioShmSink::setName("+name+")", "name must start with a slash");
+        _name = name;
+    }
+
+    void setSampleRate(const double rate)
+    {
+        _sampleRate = rate;
+        if (_ring) _ring->setSampleRate(rate);
+    }
+
+    void setBufferSize(const size_t frames)
+    {
+        if (frames == 0) throw Pothos::InvalidArgumentException(
+            "AudioShmSink::setBufferSize()", "buffer size must be non-zero");
+        _bufferSize = frames;
+    }
+
+    void activate(void)
+    {
+        if (_name.empty()) throw Pothos::InvalidArgumentException("AudioShmSink::activate()", "no ring name specified");
+        _ring = ShmAudioRing::create(_name, _sampleType, _numChans, _bufferSize);
+        _ring->setSampleRate(_sampleRate);
+    }
+
+    void deactivate(void)
+    {
+        _ring.reset();
+    }
+
+    void work(void)
+    {
+        const size_t numFrames = this->workInfo().minInElements;
+        if (numFrames == 0) return;
+
+        //wait for the reader to free space, or discard when there is no reader
+        const unsigned long long writeCount = _ring->writeCount();
+        if (not _ring->waitSpace(writeCount, 0))
+        {
+            if (not _ring->hasReader())
+            {
+                for (auto port : this->inputs()) port->consume(numFrames);
+                return;
+            }
+            _ring->waitSpace(writeCount, SHM_WAIT_US);
+            return this->yield();
+        }
+        const size_t freeFrames = _ring->capacity() - size_t(writeCount - _ring->readCount());
+        const size_t numCopy = std::min(numFrames, freeFrames);
+
+        //carry the labels for the copied frames
+        for (const auto &label : this->input(0)->labels())
+        {
+            if (label.index >= numCopy) continue;
+            if (label.id == "rxRate")
+            {
+                _sampleRate = label.data.convert<double>();
+                _ring->setSampleRate(_sampleRate);
+                continue;
+            }
+            ShmLabel shmLabel;
+            shmLabel.index = writeCount + label.index;
+            shmLabel.id = label.id;
+            try
+            {
+                shmLabel.value = label.data.convert<double>();
+            }
+            catch (const Pothos::Exception &)
+            {
+                continue; //not numeric
+            }
+            if (not _ring->pushLabel(shmLabel) and (_numDroppedLabels++ % 100) == 0)
+            {
+                poco_warning_f1(_logger, "Label table full on %s, dropping labels", _name);
+            }
+        }
+
+        //copy into the ring in up to two contiguous segments
+        size_t done = 0;
+        while (done < numCopy)
+        {
+            const size_t offset = size_t((writeCount + done) % _ring->capacity());
+            const size_t n = std::min(numCopy - done, _ring->capacity() - offset);
+            this->copyFrames(_ring->frame(writeCount + done), done, n);
+            done += n;
+        }
+        _ring->commitWrite(writeCount + numCopy);
+
+        for (auto port : this->inputs()) port->consume(numCopy);
+    }
+
+private:
+    //! Interleave frames from the input ports into the ring
+    void copyFrames(char *out, const size_t inOffset, const size_t numFrames)
+    {
+        const size_t sampleSize = audioSampleSize(_sampleType);
+        for (auto port : this->inputs())
+        {
+            const char *in = (const char *)this->workInfo().inputPointers[port->index()] + inOffset*port->dtype().size();
+            if (_interleaved) audioConvert(in, _sampleType, 1, out, _sampleType, 1, numFrames*_numChans);
+            else audioConvert(in, _sampleType, 1, out + port->index()*sampleSize, _sampleType, _numChans, numFrames);
+        }
+    }
+
+    Poco::Logger &_logger;
+    const AudioSampleType _sampleType;
+    const size_t _numChans;
+    const bool _interleaved;
+    std::string _name;
+    double _sampleRate;
+    size_t _bufferSize;
+    unsigned long long _numDroppedLabels;
+    std::shared_ptr<ShmAudioRing> _ring;
+};
+
+static Pothos::BlockRegistry registerAudioShmSink(
+    "/audio/shm_sink", &AudioShmSink::make);
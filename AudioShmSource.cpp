@@ -0,0 +1,202 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "ShmAudioRing.hpp"
+#include <Pothos/Framework.hpp>
+#include <Poco/Logger.h>
+#include <algorithm> //min/max
+#include <chrono>
+#include <thread>
+
+//the longest wait for data in a call to work()
+static const long SHM_WAIT_US = 10000;
+
+//the retry period while the ring does not exist
+static const std::chrono::milliseconds SHM_RETRY_PERIOD(10);
+
+/***********************************************************************
+ * |PothosDoc Audio Shared Memory Source
+ *
+ * The audio shared memory source reads a sample stream from a named
+ * POSIX shared memory ring written by an audio shared memory sink
+ * in another process on the same machine, or in the same process as a virtual loopback.
+ * The source sleeps on a futex and wakes as soon as the sink commits samples.
+ *
+ * The source attaches to the ring when it appears, and re-attaches
+ * when the sink restarts, so the two processes can start in any order.
+ * A newly attached source starts reading at the live edge of the ring.
+ * Only one source can read from a ring at a time.
+ *
+ * The audio shared memory source will post a sample rate stream label named "rxRate"
+ * on attachment and whenever the rate in the ring header changes,
+ * just like the audio source block. Numeric labels written by the sink,
+ * such as "rxTime", are posted at the same sample on all output ports.
+ * Samples are converted when the ring and the output data type differ.
+ *
+ * |category /Audio
+ * |category /Sources
+ * |keywords audio sound shared memory ipc loopback
+ *
+ * |param name[Ring Name] The name of the shared memory ring, like "/pothos_audio".
+ * |default "/pothos_audio"
+ * |widget StringEntry()
+ * |preview valid
+ *
+ * |param dtype[Data Type] The data type produced by the shared memory source.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * This parameter must match the number of channels in the ring.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |factory /audio/shm_source(dtype, numChans, chanMode)
+ * |setter setName(name)
+ **********************************************************************/
+class AudioShmSource : public Pothos::Block
+{
+public:
+    AudioShmSource(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _logger(Poco::Logger::get("AudioShmSource")),
+        _sampleType(audioSampleTypeFromDType(dtype)),
+        _numChans(numChans),
+        _interleaved(chanMode == "INTERLEAVED"),
+        _active(false),
+        _lastRate(0.0)
+    {
+        //setup ports
+        if (_interleaved) this->setupOutput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupOutput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioShmSource, setName));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioShmSource(dtype, numChans, chanMode);
+    }
+
+    void setName(const std::string &name)
+    {
+        if (name.empty() or name[0] != '/') throw Pothos::InvalidArgumentException(
+            "AudioShmSource::setName("+name+")", "name must start with a slash");
+        _name = name;
+        _ring.reset();
+    }
+
+    void activate(void)
+    {
+        if (_name.empty()) throw Pothos::InvalidArgumentException("AudioShmSource::activate()", "no ring name specified");
+        _active = true;
+        this->attach();
+    }
+
+    void deactivate(void)
+    {
+        _active = false;
+        _ring.reset();
+    }
+
+    void work(void)
+    {
+        if (this->workInfo().minOutElements == 0) return;
+
+        //wait for the sink to create the ring
+        if (not _ring and not this->attach())
+        {
+            std::this_thread::sleep_for(SHM_RETRY_PERIOD);
+            return this->yield();
+        }
+
+        //wait for data like a blocking device read
+        const unsigned long long readCount = _ring->readCount();
+        if (not _ring->waitData(readCount, SHM_WAIT_US))
+        {
+            if (_ring->writerGone())
+            {
+                poco_information_f1(_logger, "Ring %s closed by the writer, waiting for it to reappear", _name);
+                _ring.reset();
+            }
+            return this->yield();
+        }
+
+        //the next contiguous segment of the ring
+        const unsigned long long writeCount = _ring->writeCount();
+        const size_t offset = size_t(readCount % _ring->capacity());
+        size_t numFrames = size_t(std::min<unsigned long long>(writeCount - readCount, this->workInfo().minOutElements));
+        numFrames = std::min(numFrames, _ring->capacity() - offset);
+
+        //post the rate on attachment and on changes
+        const double rate = _ring->sampleRate();
+        if (rate != _lastRate)
+        {
+            _lastRate = rate;
+            Pothos::Label label("rxRate", rate, 0);
+            for (auto port : this->outputs()) port->postLabel(label);
+        }
+
+        //repost the labels carried for these frames
+        ShmLabel shmLabel;
+        while (_ring->popLabel(readCount + numFrames, shmLabel))
+        {
+            const size_t index = (shmLabel.index > readCount)?size_t(shmLabel.index - readCount):0;
+            Pothos::Label label(shmLabel.id, shmLabel.value, index);
+            for (auto port : this->outputs()) port->postLabel(label);
+        }
+
+        //convert from the interleaved ring into the output ports
+        const char *in = _ring->frame(readCount);
+        const auto ringType = _ring->sampleType();
+        const size_t sampleSize = audioSampleSize(ringType);
+        for (auto port : this->outputs())
+        {
+            if (_interleaved) audioConvert(in, ringType, 1, port->buffer().as<void *>(), _sampleType, 1, numFrames*_numChans);
+            else audioConvert(in + port->index()*sampleSize, ringType, _numChans, port->buffer().as<void *>(), _sampleType, 1, numFrames);
+            port->produce(numFrames);
+        }
+        _ring->commitRead(readCount + numFrames);
+    }
+
+private:
+    bool attach(void)
+    {
+        if (not _active) return false;
+        _ring = ShmAudioRing::open(_name);
+        if (not _ring) return false;
+        if (_ring->numChans() != _numChans)
+        {
+            const auto ringChans = _ring->numChans();
+            _ring.reset();
+            throw Pothos::InvalidArgumentException("AudioShmSource::attach("+_name+")",
+                "ring has " + std::to_string(ringChans) + " channels, block has " + std::to_string(_numChans));
+        }
+        poco_information_f2(_logger, "Attached to ring %s at %f Sps", _name, _ring->sampleRate());
+        _lastRate = 0.0;
+        return true;
+    }
+
+    Poco::Logger &_logger;
+    const AudioSampleType _sampleType;
+    const size_t _numChans;
+    const bool _interleaved;
+    std::string _name;
+    bool _active;
+    double _lastRate;
+    std::shared_ptr<ShmAudioRing> _ring;
+};
+
+static Pothos::BlockRegistry registerAudioShmSource(
+    "/audio/shm_source", &AudioShmSource::make);
@@ -2,8 +2,23 @@
 // SPDX-License-Identifier: BSL-1.0
 
 #include "AudioBlock.hpp"
+#include "AudioFormats.hpp"
+#include "JitterBuffer.hpp"
+#include "AudioTrace.hpp"
+#include "RealtimeCheck.hpp"
 #include <algorithm> //min/max
 #include <iostream>
+#include <deque>
+#include <memory>
+#include <json.hpp>
+
+using json = nlohmann::json;
+
+//the granularity of device writes in the jitter buffer mode
+static const double JITTER_BLOCK_SECONDS = 0.002;
+
+//the number of recent latency probes kept for the percentiles
+static const size_t PROBE_HISTORY = 1024;
 
 /***********************************************************************
  * |PothosDoc Audio Sink
@@ -12,10 +27,101 @@
  * In interleaved mode, the samples are interleaved from one input port,
  * In the port-per-channel mode, each audio channel uses a separate port.
  *
+ * The getNumFrames() and getNumXruns() calls report the number of frames
+ * written and the number of underflows since activation.
+ *
+ * The getTimingStats() call reports how close the device runs to its deadline
+ * as a JSON string: log-scale histograms of the intervals between completed
+ * device writes and of the slack, the duration of the samples still buffered in the device,
+ * and the number of deadline misses where the slack ran out.
+ * Bucket i of a histogram counts values below bucketUpperUs[i] microseconds.
+ *
+ * <h2>Packet mode</h2>
+ * In packet mode, the audio sink accepts Pothos::Packet messages
+ * on its input ports rather than stream buffers.
+ * The packet payload must already be in the data type of the input port.
+ * Packets are held in an internal queue and written to the device
+ * as the device has room for them, so bursty message-driven producers
+ * can feed the sink directly without a packet to stream conversion.
+ *
+ * The sink emits the "needData" signal with the number of frames requested
+ * when the internal queue falls below half of the configured queue depth.
+ * The signal is emitted once per packet arrival, so a producer connected
+ * to the signal can pace itself without polling the sink.
+ * The getFillLevel() call reports the total number of frames
+ * held in the internal queue and the device buffer.
+ *
+ * <h2>Jitter buffer mode</h2>
+ * In the adaptive jitter buffer mode, the sink measures the arrival time
+ * of every burst of input samples (stream or packet) against the sample clock,
+ * and sets the target buffer depth from the spread of arrival lateness.
+ * The stream is opened with a device buffer of a few milliseconds
+ * and the blocking device writes pace the sink,
+ * the remaining samples wait in the jitter buffer where the depth
+ * converges to the target through small time-scale adjustments:
+ * single pitch periods are removed or repeated with a short cross-fade
+ * at the lag of maximum correlation (WSOLA-style splicing).
+ * Samples are only dropped when the maximum delay is exceeded.
+ * The getJitterStats() call reports the jitter estimate,
+ * buffer depth, and adjustment counts as a JSON string.
+ *
+ * <h2>Latency probes</h2>
+ * The audio sink measures the latency through the whole topology
+ * from the "latencyProbe" stream labels of an upstream audio source.
+ * When a labeled sample is written to the device, the sink estimates
+ * the time that the sample leaves the device from the stream output latency,
+ * and subtracts the capture time in the label data.
+ * The getProbeLatency() call reports the count, the mean, the extremes,
+ * and the 50th, 90th and 99th percentiles of the last 1024 probes
+ * in milliseconds as a JSON string.
+ * Probes apply to the stream input mode.
+ *
+ * <h2>Latency budget</h2>
+ * With a non-zero latency budget, the audio sink checks the output latency
+ * on every call to work(): the stream output latency less the free space
+ * in the device buffer, plus the frames in the packet queue and jitter buffer.
+ * When the latency exceeds the budget, the sink emits the "latencyAlert" signal
+ * with the latency in milliseconds, once until the latency falls below 90% of the budget.
+ * The getLatencyStats() call reports the current and maximum latency,
+ * the number of checks over budget, and the number of alerts as a JSON string.
+ *
+ * <h2>I/O reactor</h2>
+ * In the reactor I/O mode, the audio sink does not transfer with the device in work().
+ * A shared reactor thread waits on the poll descriptors of the device stream
+ * in one epoll loop with the streams of the other audio blocks, and moves the frames
+ * between the device and a ring of two device buffers that work() writes to.
+ * Many devices are then serviced from one or a few pinned real-time threads.
+ * The reactor needs a backend with poll descriptors, like the "alsa" backend on Linux.
+ *
+ * <h2>Tracing</h2>
+ * The setTracing(enable) and writeTrace(path) calls control a process-wide
+ * timeline trace of the work() calls, device reads and writes, and xruns
+ * of all audio blocks, recorded in lock-free per-thread buffers.
+ * writeTrace() saves the trace in the Chrome trace event JSON format
+ * for viewing in chrome://tracing or Perfetto.
+ *
  * |category /Audio
  * |category /Sinks
  * |keywords audio sound stereo mono speaker
  *
+ * |param backend[Backend] The audio API that provides the device.
+ * Backends register under /audio/backends in the plugin registry.
+ * The "alsa" backend uses memory-mapped ALSA devices on Linux,
+ * and accepts any ALSA PCM name as the device name.
+ * The "jack" backend runs the block as its own JACK client,
+ * and the device name selects the JACK client to connect, like "system".
+ * The sample rate must match the rate of the JACK server.
+ * The "pipewire" backend runs the block as a PipeWire stream
+ * with a graph quantum near half of the stream latency,
+ * and the device name selects the target node, like a sink or source node name.
+ * |option [PortAudio] "portaudio"
+ * |option [ALSA] "alsa"
+ * |option [JACK] "jack"
+ * |option [PipeWire] "pipewire"
+ * |default "portaudio"
+ * |widget ComboBox(editable=true)
+ * |preview valid
+ *
  * |param deviceName[Device Name] The name of an audio device on the system,
  * the integer index of an audio device on the system,
  * or an empty string to use the default input device.
@@ -58,6 +164,9 @@
  * <li>"STDERROR" - prints "aU" (audio underflow) to stderror</li>
  * <li>"DISABLED" - disabled mode turns off all reporting</li>
  * </ul>
+ * Device errors other than underflow are always reported to the logger.
+ * A logger report formats the message, so it allocates and is outside
+ * the allocation-free path verified by the real-time check of the benchmark.
  * |default "STDERROR"
  * |option [Logging Subsystem] "LOGGER"
  * |option [Standard Error] "STDERROR"
@@ -74,21 +183,126 @@
  * |default 0
  * |tab Underflow
  *
+ * |param timingTrace [Timing Trace] Record the stream timing to a trace file.
+ * The trace holds the time and the result of every device call of the stream:
+ * the available frames, the duration of each write, and the underflow flags.
+ * The PortAudio mock library can replay the trace as a simulated device
+ * to reproduce the scheduling behaviour of a specific audio interface.
+ * The events are buffered and written to the file in large blocks. An empty path disables recording.
+ * |default ""
+ * |widget FileEntry(mode=save)
+ * |preview valid
+ * |tab Underflow
+ *
+ * |param inputMode [Input Mode] The input mode of the audio sink.
+ * <ul>
+ * <li>"STREAM" - consume samples from the input stream buffers</li>
+ * <li>"PACKET" - queue packets from input messages</li>
+ * </ul>
+ * |default "STREAM"
+ * |option [Stream] "STREAM"
+ * |option [Packet] "PACKET"
+ * |preview disable
+ * |tab Packets
+ *
+ * |param queueDepth [Queue Depth] The target depth of the internal packet queue.
+ * The sink requests more data when the queue falls below half of this depth.
+ * |units frames
+ * |default 4096
+ * |preview disable
+ * |tab Packets
+ *
+ * |param jitterMode [Jitter Mode] The jitter buffer mode.
+ * <ul>
+ * <li>"DISABLED" - write samples to the device as soon as they arrive</li>
+ * <li>"ADAPTIVE" - buffer samples to the measured arrival jitter</li>
+ * </ul>
+ * |default "DISABLED"
+ * |option [Disabled] "DISABLED"
+ * |option [Adaptive] "ADAPTIVE"
+ * |preview disable
+ * |tab Jitter
+ *
+ * |param maxJitterDelay [Max Jitter Delay] The maximum delay of the jitter buffer.
+ * The oldest samples are dropped when the jitter buffer exceeds this delay.
+ * |units milliseconds
+ * |default 500
+ * |preview disable
+ * |tab Jitter
+ *
+ * |param latencyBudget [Latency Budget] The maximum output latency before an alert.
+ * Zero disables the latency checks.
+ * |units milliseconds
+ * |default 0.0
+ * |preview valid
+ * |tab Latency
+ *
+ * |param ioMode [I/O Mode] How the device stream is serviced.
+ * <ul>
+ * <li>"BLOCKING" - work() transfers with the device stream directly</li>
+ * <li>"REACTOR" - the shared I/O reactor services the device stream</li>
+ * </ul>
+ * |default "BLOCKING"
+ * |option [Blocking] "BLOCKING"
+ * |option [Reactor] "REACTOR"
+ * |preview disable
+ * |tab Reactor
+ *
+ * |param reactorCpus [Reactor CPUs] The CPUs of the reactor threads, one thread pinned to each CPU.
+ * An empty list runs one reactor thread without CPU affinity.
+ * The reactor is shared by all audio blocks, the first block to open a stream starts its threads.
+ * |default []
+ * |preview disable
+ * |tab Reactor
+ *
  * |factory /audio/sink(dtype, numChans, chanMode)
+ * |initializer setupBackend(backend)
  * |initializer setupDevice(deviceName)
+ * |initializer setupIoMode(ioMode, reactorCpus)
  * |initializer setupStream(sampRate)
  * |setter setReportMode(reportMode)
  * |setter setBackoffTime(backoffTime)
+ * |setter setTimingTrace(timingTrace)
+ * |setter setInputMode(inputMode)
+ * |setter setQueueDepth(queueDepth)
+ * |setter setJitterMode(jitterMode)
+ * |setter setMaxJitterDelay(maxJitterDelay)
+ * |setter setLatencyBudget(latencyBudget)
  **********************************************************************/
 class AudioSink : public AudioBlock
 {
 public:
     AudioSink(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
-        AudioBlock("AudioSink", true, dtype, numChans, chanMode)
+        AudioBlock("AudioSink", true, dtype, numChans, chanMode),
+        _packetMode(false),
+        _queueDepth(4096),
+        _deviceFrames(0),
+        _needDataArmed(false),
+        _jitterMode(false),
+        _maxJitterDelay(500),
+        _jitterBlockFrames(0),
+        _probeLatencies(PROBE_HISTORY),
+        _numProbes(0),
+        _probeMin(0.0),
+        _probeMax(0.0),
+        _probeSum(0.0)
     {
         //setup ports
         if (_interleaved) this->setupInput(0, Pothos::DType::fromDType(dtype, numChans));
         else for (size_t i = 0; i < numChans; i++) this->setupInput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, setInputMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, setQueueDepth));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, getFillLevel));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, setJitterMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, setMaxJitterDelay));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, getJitterStats));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSink, getProbeLatency));
+        this->registerSignal("needData");
+
+        _packetQueues.resize(this->inputs().size());
+        _queuedFrames.resize(this->inputs().size());
+        _packetPointers.resize(this->inputs().size());
     }
 
     static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
@@ -96,15 +310,138 @@ public:
         return new AudioSink(dtype, numChans, chanMode);
     }
 
+    void setInputMode(const std::string &mode)
+    {
+        if (mode == "STREAM"){}
+        else if (mode == "PACKET"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioSink::setInputMode("+mode+")", "unknown input mode");
+        _packetMode = (mode == "PACKET");
+    }
+
+    void setQueueDepth(const size_t depth)
+    {
+        _queueDepth = depth;
+    }
+
+    void setJitterMode(const std::string &mode)
+    {
+        if (mode == "DISABLED"){}
+        else if (mode == "ADAPTIVE"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioSink::setJitterMode("+mode+")", "unknown jitter mode");
+        _jitterMode = (mode == "ADAPTIVE");
+    }
+
+    void setMaxJitterDelay(const long delay)
+    {
+        if (delay <= 0) throw Pothos::InvalidArgumentException(
+            "AudioSink::setMaxJitterDelay()", "delay must be positive");
+        _maxJitterDelay = delay;
+    }
+
+    std::string getJitterStats(void) const
+    {
+        json stats;
+        if (not _jitterBuffer) return stats.dump();
+        const double rate = _stream->sampleRate();
+        stats["jitterMs"] = _jitterBuffer->jitter()*1e3;
+        stats["targetMs"] = _jitterBuffer->targetDepth()*1e3/rate;
+        stats["depthMs"] = _jitterBuffer->depth()*1e3/rate;
+        stats["numAccelerate"] = _jitterBuffer->numAccelerate();
+        stats["numExpand"] = _jitterBuffer->numExpand();
+        stats["numUnderflows"] = _jitterBuffer->numUnderflows();
+        stats["numDroppedFrames"] = _jitterBuffer->numDroppedFrames();
+        return stats.dump();
+    }
+
+    std::string getProbeLatency(void) const
+    {
+        json stats;
+        stats["count"] = _numProbes;
+        if (_numProbes == 0) return stats.dump();
+
+        std::vector<double> recent(_probeLatencies.begin(), _probeLatencies.begin()+std::min<size_t>(_numProbes, PROBE_HISTORY));
+        std::sort(recent.begin(), recent.end());
+        const auto percentile = [&recent](const double fraction)
+        {
+            return recent[std::min(recent.size()-1, size_t(fraction*recent.size()))]*1e3;
+        };
+        stats["lastMs"] = _probeLatencies[(_numProbes-1)%PROBE_HISTORY]*1e3;
+        stats["minMs"] = _probeMin*1e3;
+        stats["maxMs"] = _probeMax*1e3;
+        stats["meanMs"] = _probeSum*1e3/_numProbes;
+        stats["p50Ms"] = percentile(0.50);
+        stats["p90Ms"] = percentile(0.90);
+        stats["p99Ms"] = percentile(0.99);
+        return stats.dump();
+    }
+
+    size_t getFillLevel(void) const
+    {
+        const size_t queued = this->internalFrames();
+        if (not _stream or not this->isActive()) return queued;
+        const long available = _stream->available();
+        if (available < 0 or size_t(available) >= _deviceFrames) return queued;
+        return queued + _deviceFrames - available;
+    }
+
+    void activate(void)
+    {
+        //the jitter buffer mode keeps two write blocks in the device buffer,
+        //reopen the stream when the mode changed since it was opened
+        const double streamLatency = _jitterMode?2*JITTER_BLOCK_SECONDS:0.0;
+        if (streamLatency != _streamLatency)
+        {
+            _streamLatency = streamLatency;
+            this->setupStream(_stream->sampleRate());
+        }
+
+        AudioBlock::activate();
+
+        //the write space of the idle stream is the size of the device buffer
+        const long available = this->streamAvailable();
+        _deviceFrames = (available > 0)?size_t(available):0;
+        _numProbes = 0;
+
+        //request the initial fill from packet producers
+        if (_packetMode) this->emitSignal("needData", _queueDepth);
+        _needDataArmed = false;
+
+        //allocate the jitter buffer and conversion buffers up-front
+        _jitterBuffer.reset();
+        if (not _jitterMode) return;
+        const double rate = _stream->sampleRate();
+        const size_t numChans = _numChans;
+        _jitterBuffer.reset(new JitterBuffer(numChans, rate, size_t(_maxJitterDelay*rate/1000)));
+        _jitterBlockFrames = std::max<size_t>(1, size_t(rate*JITTER_BLOCK_SECONDS));
+        _jitterScratch.resize(2*_jitterBlockFrames*numChans);
+        _deviceScratch.resize(2*_jitterBlockFrames*numChans*audioSampleSize(_sampleType));
+        _devicePointers.resize(numChans);
+    }
+
+    void deactivate(void)
+    {
+        AudioBlock::deactivate();
+        _jitterBuffer.reset();
+        for (auto &queue : _packetQueues) queue.clear();
+        std::fill(_queuedFrames.begin(), _queuedFrames.end(), 0);
+    }
+
     void work(void)
     {
+        AUDIO_REALTIME_SCOPE("AudioSink::work()");
+        AudioTraceSpan traceWork("AudioSink::work()");
+        if (_jitterBuffer) return this->workJitter();
+        if (_packetMode) return this->workPackets();
+
         if (this->workInfo().minInElements == 0) return;
 
         //calculate the number of frames
-        int numFrames = Pa_GetStreamWriteAvailable(_stream);
+        int numFrames = this->streamAvailable();
         if (numFrames < 0)
         {
-            throw Pothos::Exception("AudioSink::work()", "Pa_GetStreamWriteAvailable: " + std::string(Pa_GetErrorText(numFrames)));
+            throw Pothos::Exception("AudioSink::work()", "Stream available: " + _stream->errorText(numFrames));
         }
         if (numFrames == 0) numFrames = MIN_FRAMES_BLOCKING;
         numFrames = std::min<int>(numFrames, this->workInfo().minInElements);
@@ -115,27 +452,295 @@ public:
         else buffer = (const void *)this->workInfo().inputPointers.data();
 
         //peform write to the device
-        PaError err = Pa_WriteStream(_stream, buffer, numFrames);
+        int err = this->streamWrite(buffer, numFrames);
+        this->handleWriteError(err);
+        _numFrames += numFrames;
+
+        //not ready to consume because of backoff
+        if (_readyTime >= std::chrono::high_resolution_clock::now()) return this->yield();
+
+        //the probes are measured once, when their frames are consumed
+        this->measureProbes(numFrames);
+
+        //consume buffer (all modes)
+        traceWork.setArg("consume", numFrames);
+        for (auto port : this->inputs()) port->consume(numFrames);
+    }
 
+protected:
+    size_t internalFrames(void) const
+    {
+        size_t queued = *std::min_element(_queuedFrames.begin(), _queuedFrames.end());
+        if (_jitterBuffer) queued += _jitterBuffer->depth();
+        return queued;
+    }
+
+private:
+    void handleWriteError(const int err)
+    {
         //handle the error reporting
-        bool logError = err != paNoError;
-        if (err == paOutputUnderflowed)
+        bool logError = err != AUDIO_OK;
+        if (err == AUDIO_XRUN)
         {
+            _numXruns++;
             _readyTime += _backoffTime;
+            audioTraceInstant("underflow");
             if (_reportStderror) std::cerr << "aU" << std::flush;
             logError = _reportLogger;
         }
         if (logError)
         {
-            poco_error(_logger, "Pa_WriteStream: " + std::string(Pa_GetErrorText(err)));
+            poco_error(_logger, "Stream write: " + _stream->errorText(err));
         }
+    }
+
+    /*!
+     * Record the latency of the probe labels in the frames just written.
+     * The last frame of the write leaves the device after the output latency.
+     */
+    void measureProbes(const int numFrames)
+    {
+        const auto port = this->input(0);
+        for (const auto &label : port->labels())
+        {
+            if (label.index >= size_t(numFrames) or label.id != "latencyProbe") continue;
+            if (label.data.type() != typeid(double)) continue;
+
+            const auto now = std::chrono::steady_clock::now().time_since_epoch();
+            const double outputTime = std::chrono::duration<double>(now).count()
+                + _stream->latency() - (numFrames - 1 - label.index)/_stream->sampleRate();
+            const double latency = outputTime - label.data.extract<double>();
+
+            if (_numProbes == 0)
+            {
+                _probeMin = _probeMax = latency;
+                _probeSum = 0.0;
+            }
+            _probeMin = std::min(_probeMin, latency);
+            _probeMax = std::max(_probeMax, latency);
+            _probeSum += latency;
+            _probeLatencies[_numProbes%PROBE_HISTORY] = latency;
+            _numProbes++;
+        }
+    }
+
+    /*!
+     * Move packets from the input message queues into the internal queue.
+     * Packets and plain buffer chunks are accepted, other messages are dropped.
+     */
+    void queueInputPackets(void)
+    {
+        for (auto port : this->inputs())
+        {
+            const size_t frameSize = port->dtype().size();
+            while (port->hasMessage())
+            {
+                const auto msg = port->popMessage();
+                Pothos::BufferChunk payload;
+                if (msg.type() == typeid(Pothos::Packet)) payload = msg.extract<Pothos::Packet>().payload;
+                else if (msg.type() == typeid(Pothos::BufferChunk)) payload = msg.extract<Pothos::BufferChunk>();
+                else continue;
+
+                if (payload.length % frameSize != 0)
+                {
+                    poco_error_f2(_logger, "Packet length %z is not a multiple of the frame size %z", payload.length, frameSize);
+                    continue;
+                }
+                if (payload.length == 0) continue;
+
+                _packetQueues[port->index()].push_back(payload);
+                _queuedFrames[port->index()] += payload.length/frameSize;
+                _needDataArmed = true;
+            }
+        }
+    }
+
+    //! Request more data from the producer when the queue runs low
+    void checkNeedData(const size_t queued)
+    {
+        if (_needDataArmed and queued < _queueDepth/2)
+        {
+            _needDataArmed = false;
+            this->emitSignal("needData", _queueDepth - queued);
+        }
+    }
+
+    void workPackets(void)
+    {
+        this->queueInputPackets();
+
+        //the frames available in all queues
+        const size_t queued = *std::min_element(_queuedFrames.begin(), _queuedFrames.end());
+        this->checkNeedData(queued);
+
+        if (queued == 0) return;
+
+        //calculate the number of frames
+        int numFrames = this->streamAvailable();
+        if (numFrames < 0)
+        {
+            throw Pothos::Exception("AudioSink::work()", "Stream available: " + _stream->errorText(numFrames));
+        }
+        if (numFrames == 0) numFrames = MIN_FRAMES_BLOCKING;
+
+        //limit to the contiguous frames at the front of each queue
+        for (auto port : this->inputs())
+        {
+            const auto &front = _packetQueues[port->index()].front();
+            numFrames = std::min<int>(numFrames, front.length/port->dtype().size());
+            _packetPointers[port->index()] = front.as<const void *>();
+        }
+
+        //get the buffer
+        const void *buffer = nullptr;
+        if (_interleaved) buffer = _packetPointers[0];
+        else buffer = (const void *)_packetPointers.data();
+
+        //peform write to the device
+        int err = this->streamWrite(buffer, numFrames);
+        this->handleWriteError(err);
+        _numFrames += numFrames;
+
+        //the remaining queued frames are written on the next call
+        this->yield();
 
         //not ready to consume because of backoff
-        if (_readyTime >= std::chrono::high_resolution_clock::now()) return this->yield();
+        if (_readyTime >= std::chrono::high_resolution_clock::now()) return;
 
-        //consume buffer (all modes)
-        for (auto port : this->inputs()) port->consume(numFrames);
+        //consume from the queue (all modes)
+        for (auto port : this->inputs())
+        {
+            auto &queue = _packetQueues[port->index()];
+            const size_t numBytes = numFrames*port->dtype().size();
+            queue.front().address += numBytes;
+            queue.front().length -= numBytes;
+            if (queue.front().length == 0) queue.pop_front();
+            _queuedFrames[port->index()] -= numFrames;
+        }
+    }
+
+    /*!
+     * Move the new input samples into the jitter buffer as one arrival.
+     * Stream input is consumed from the ports, packet input from the queues.
+     */
+    void feedJitterBuffer(void)
+    {
+        const size_t numChans = _numChans;
+        size_t numFrames = 0;
+        if (_packetMode) numFrames = *std::min_element(_queuedFrames.begin(), _queuedFrames.end());
+        else numFrames = this->workInfo().minInElements;
+        numFrames = std::min(numFrames, _jitterBuffer->maxFrames());
+        if (numFrames == 0) return;
+
+        float *out = _jitterBuffer->pushBegin(numFrames);
+        for (auto port : this->inputs())
+        {
+            //interleaved ports hold all channels, otherwise one channel per port
+            const size_t perFrame = _interleaved?numChans:1;
+            float *portOut = _interleaved?out:(out + port->index());
+            const size_t outStride = _interleaved?1:numChans;
+
+            if (not _packetMode)
+            {
+                audioConvertToFloat(this->workInfo().inputPointers[port->index()], _sampleType,
+                    1, portOut, outStride, numFrames*perFrame);
+                port->consume(numFrames);
+                continue;
+            }
+
+            //copy across packet boundaries in the queue
+            auto &queue = _packetQueues[port->index()];
+            size_t remaining = numFrames;
+            while (remaining != 0)
+            {
+                auto &front = queue.front();
+                const size_t frameSize = port->dtype().size();
+                const size_t n = std::min(remaining, front.length/frameSize);
+                audioConvertToFloat(front.as<const void *>(), _sampleType,
+                    1, portOut, outStride, n*perFrame);
+                portOut += n*perFrame*outStride;
+                front.address += n*frameSize;
+                front.length -= n*frameSize;
+                if (front.length == 0) queue.pop_front();
+                remaining -= n;
+            }
+            _queuedFrames[port->index()] -= numFrames;
+        }
+
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        _jitterBuffer->pushCommit(numFrames, std::chrono::duration<double>(now).count());
+    }
+
+    void workJitter(void)
+    {
+        if (_packetMode) this->queueInputPackets();
+        this->feedJitterBuffer();
+        if (_packetMode) this->checkNeedData(_jitterBuffer->depth());
+
+        //calculate the fill level of the device
+        int available = this->streamAvailable();
+        if (available < 0)
+        {
+            throw Pothos::Exception("AudioSink::work()", "Stream available: " + _stream->errorText(available));
+        }
+        _deviceFrames = std::max<size_t>(_deviceFrames, available);
+
+        //the device buffer holds about two blocks so that the jitter buffer holds the rest,
+        //the blocking write waits for the device to drain, new arrivals are queued on the next call
+        const size_t numFrames = _jitterBuffer->pull(_jitterScratch.data(), _jitterBlockFrames);
+
+        //nothing to write while the jitter buffer refills
+        if (numFrames == 0) return;
+
+        //convert into the device format
+        const size_t numChans = _numChans;
+        const void *buffer = nullptr;
+        if (_interleaved)
+        {
+            audioConvertFromFloat(_jitterScratch.data(), 1, _deviceScratch.data(), _sampleType, 1, numFrames*numChans);
+            buffer = _deviceScratch.data();
+        }
+        else
+        {
+            const size_t chanBytes = 2*_jitterBlockFrames*audioSampleSize(_sampleType);
+            for (size_t i = 0; i < numChans; i++)
+            {
+                _devicePointers[i] = _deviceScratch.data() + i*chanBytes;
+                audioConvertFromFloat(_jitterScratch.data()+i, numChans, _devicePointers[i], _sampleType, 1, numFrames);
+            }
+            buffer = (const void *)_devicePointers.data();
+        }
+
+        //peform write to the device, backoff does not apply to buffered samples
+        int err = this->streamWrite(buffer, numFrames);
+        this->handleWriteError(err);
+        _numFrames += numFrames;
+
+        //keep the device topped up from the jitter buffer
+        this->yield();
     }
+
+    bool _packetMode;
+    size_t _queueDepth;
+    size_t _deviceFrames;
+    bool _needDataArmed;
+    std::vector<std::deque<Pothos::BufferChunk>> _packetQueues;
+    std::vector<size_t> _queuedFrames;
+    std::vector<const void *> _packetPointers;
+    bool _jitterMode;
+    long _maxJitterDelay;
+    size_t _jitterBlockFrames;
+    std::unique_ptr<JitterBuffer> _jitterBuffer;
+    std::vector<float> _jitterScratch;
+    std::vector<char> _deviceScratch;
+    std::vector<void *> _devicePointers;
+
+    //latency probe measurements
+    std::vector<double> _probeLatencies;
+    unsigned long long _numProbes;
+    double _probeMin;
+    double _probeMax;
+    double _probeSum;
 };
 
 static Pothos::BlockRegistry registerAudioSink(
@@ -2,8 +2,14 @@
 // SPDX-License-Identifier: BSL-1.0
 
 #include "AudioBlock.hpp"
+#include "AudioTrace.hpp"
+#include "RealtimeCheck.hpp"
 #include <algorithm> //min/max
+#include <cstring>
 #include <iostream>
+#ifndef _WIN32
+#include <sys/mman.h> //mlock
+#endif
 
 /***********************************************************************
  * |PothosDoc Audio Source
@@ -17,10 +23,109 @@
  * Downstream blocks like the plotter widgets can consume this label
  * and use it to set internal parameters like the axis scaling.
  *
+ * The getNumFrames() and getNumXruns() calls report the number of frames
+ * read and the number of overflows since activation.
+ *
+ * The getTimingStats() call reports how close the device runs to its deadline
+ * as a JSON string: log-scale histograms of the intervals between completed
+ * device reads and of the slack, the stream latency minus the age of the samples waiting in the device,
+ * and the number of deadline misses where the slack ran out.
+ * Bucket i of a histogram counts values below bucketUpperUs[i] microseconds.
+ *
+ * <h2>Packet mode</h2>
+ * In packet mode, the audio source posts fixed-size Pothos::Packet messages
+ * rather than producing into the output stream buffers.
+ * Each packet holds exactly packetSize frames in the payload,
+ * and the payload memory comes from a pool of buffers allocated up-front,
+ * so that the steady state does not allocate sample memory.
+ * A packet buffer returns to the pool once downstream releases the packet.
+ * Posting a message still makes a few small allocations per packet:
+ * the message object and the metadata entries, which belong to the packet
+ * downstream and cannot be reused by the source.
+ * This is a fixed number per packet, independent of the packet size,
+ * and the real-time check build of the audio benchmark enforces that bound.
+ * Each packet carries the following capture metadata:
+ * <ul>
+ * <li>"rxTime" - the stream time of the first sample in seconds</li>
+ * <li>"rxIndex" - the sample count of the first sample since activation</li>
+ * <li>"rxRate" - the sample rate of the audio stream</li>
+ * </ul>
+ *
+ * <h2>Triggered mode</h2>
+ * In triggered mode, the audio source captures continuously into an in-memory ring
+ * that holds the last preTrigger seconds of audio, and produces nothing while idle.
+ * The ring is allocated on activation and locked into memory when the system allows.
+ * A trigger emits the history from the ring followed by the live stream
+ * as one contiguous burst of postTrigger seconds after the trigger.
+ * A trigger that arrives during a burst extends the burst.
+ * A "trigger" stream label marks the first sample at the trigger time,
+ * and its data is the sample count since activation.
+ * When downstream falls behind and the ring overflows during a burst,
+ * the oldest frames are dropped with a warning at the start of the overflow,
+ * and a trigger label of a dropped sample moves to the first emitted sample.
+ *
+ * The trigger comes from any message on the "trigger" input port,
+ * a stream label named "trigger" on the "trigger" input port,
+ * or a call to the trigger() method.
+ * The "trigger" input port is created when triggered mode is first configured,
+ * so the audio source in continuous mode has no input ports.
+ * Triggered mode applies to the stream output mode.
+ *
+ * <h2>Latency probes</h2>
+ * With a non-zero probe interval, the audio source marks the first sample
+ * of a produced read with a "latencyProbe" stream label once per interval.
+ * The label data is the capture time of the sample in seconds on the steady clock,
+ * estimated from the stream input latency and the frames waiting in the device.
+ * The labels travel through the topology with the stream,
+ * and an audio sink in the same process measures the latency
+ * from capture to output when the labeled sample reaches its device.
+ * Probes apply to the continuous stream output mode.
+ *
+ * <h2>Latency budget</h2>
+ * With a non-zero latency budget, the audio source checks the input latency
+ * on every call to work(): the stream input latency plus the frames waiting in the device.
+ * When the latency exceeds the budget, the source emits the "latencyAlert" signal
+ * with the latency in milliseconds, once until the latency falls below 90% of the budget.
+ * The getLatencyStats() call reports the current and maximum latency,
+ * the number of checks over budget, and the number of alerts as a JSON string.
+ *
+ * <h2>I/O reactor</h2>
+ * In the reactor I/O mode, the audio source does not transfer with the device in work().
+ * A shared reactor thread waits on the poll descriptors of the device stream
+ * in one epoll loop with the streams of the other audio blocks, and moves the frames
+ * between the device and a ring of two device buffers that work() reads from.
+ * Many devices are then serviced from one or a few pinned real-time threads.
+ * The reactor needs a backend with poll descriptors, like the "alsa" backend on Linux.
+ *
+ * <h2>Tracing</h2>
+ * The setTracing(enable) and writeTrace(path) calls control a process-wide
+ * timeline trace of the work() calls, device reads and writes, and xruns
+ * of all audio blocks, recorded in lock-free per-thread buffers.
+ * writeTrace() saves the trace in the Chrome trace event JSON format
+ * for viewing in chrome://tracing or Perfetto.
+ *
  * |category /Audio
  * |category /Sources
  * |keywords audio sound stereo mono microphone
  *
+ * |param backend[Backend] The audio API that provides the device.
+ * Backends register under /audio/backends in the plugin registry.
+ * The "alsa" backend uses memory-mapped ALSA devices on Linux,
+ * and accepts any ALSA PCM name as the device name.
+ * The "jack" backend runs the block as its own JACK client,
+ * and the device name selects the JACK client to connect, like "system".
+ * The sample rate must match the rate of the JACK server.
+ * The "pipewire" backend runs the block as a PipeWire stream
+ * with a graph quantum near half of the stream latency,
+ * and the device name selects the target node, like a sink or source node name.
+ * |option [PortAudio] "portaudio"
+ * |option [ALSA] "alsa"
+ * |option [JACK] "jack"
+ * |option [PipeWire] "pipewire"
+ * |default "portaudio"
+ * |widget ComboBox(editable=true)
+ * |preview valid
+ *
  * |param deviceName[Device Name] The name of an audio device on the system,
  * the integer index of an audio device on the system,
  * or an empty string to use the default output device.
@@ -63,6 +168,9 @@
  * <li>"STDERROR" - prints "aO" (audio overflow) to stderror</li>
  * <li>"DISABLED" - disabled mode turns off all reporting</li>
  * </ul>
+ * Device errors other than overflow are always reported to the logger.
+ * A logger report formats the message, so it allocates and is outside
+ * the allocation-free path verified by the real-time check of the benchmark.
  * |default "STDERROR"
  * |option [Logging Subsystem] "LOGGER"
  * |option [Standard Error] "STDERROR"
@@ -79,21 +187,160 @@
  * |default 0
  * |tab Overflow
  *
+ * |param timingTrace [Timing Trace] Record the stream timing to a trace file.
+ * The trace holds the time and the result of every device call of the stream:
+ * the available frames, the duration of each read, and the overflow flags.
+ * The PortAudio mock library can replay the trace as a simulated device
+ * to reproduce the scheduling behaviour of a specific audio interface.
+ * The events are buffered and written to the file in large blocks. An empty path disables recording.
+ * |default ""
+ * |widget FileEntry(mode=save)
+ * |preview valid
+ * |tab Overflow
+ *
+ * |param outputMode [Output Mode] The output mode of the audio source.
+ * <ul>
+ * <li>"STREAM" - produce samples into the output stream buffers</li>
+ * <li>"PACKET" - post fixed-size packets with capture metadata</li>
+ * </ul>
+ * |default "STREAM"
+ * |option [Stream] "STREAM"
+ * |option [Packet] "PACKET"
+ * |preview disable
+ * |tab Packets
+ *
+ * |param packetSize [Packet Size] The number of frames per packet in packet mode.
+ * |units frames
+ * |default 1024
+ * |preview disable
+ * |tab Packets
+ *
+ * |param poolSize [Pool Size] The number of preallocated packet buffers in packet mode.
+ * The source waits for a buffer to be released when all of the pool buffers are in use.
+ * |default 16
+ * |preview disable
+ * |tab Packets
+ *
+ * |param triggerMode [Trigger Mode] The capture mode of the audio source.
+ * <ul>
+ * <li>"CONTINUOUS" - produce the audio stream continuously</li>
+ * <li>"TRIGGERED" - produce bursts with pre-trigger history on each trigger</li>
+ * </ul>
+ * |default "CONTINUOUS"
+ * |option [Continuous] "CONTINUOUS"
+ * |option [Triggered] "TRIGGERED"
+ * |preview disable
+ * |tab Trigger
+ *
+ * |param preTrigger [Pre-trigger] The duration of history emitted before the trigger.
+ * The ring buffer holds twice this duration to absorb downstream delays during a burst.
+ * |units seconds
+ * |default 1.0
+ * |preview disable
+ * |tab Trigger
+ *
+ * |param postTrigger [Post-trigger] The duration of live audio emitted after the trigger.
+ * Zero continues the burst indefinitely after the first trigger.
+ * |units seconds
+ * |default 1.0
+ * |preview disable
+ * |tab Trigger
+ *
+ * |param probeInterval [Probe Interval] The interval between latency probe labels.
+ * Zero disables the probes.
+ * |units seconds
+ * |default 0.0
+ * |preview valid
+ * |tab Latency
+ *
+ * |param latencyBudget [Latency Budget] The maximum input latency before an alert.
+ * Zero disables the latency checks.
+ * |units milliseconds
+ * |default 0.0
+ * |preview valid
+ * |tab Latency
+ *
+ * |param ioMode [I/O Mode] How the device stream is serviced.
+ * <ul>
+ * <li>"BLOCKING" - work() transfers with the device stream directly</li>
+ * <li>"REACTOR" - the shared I/O reactor services the device stream</li>
+ * </ul>
+ * |default "BLOCKING"
+ * |option [Blocking] "BLOCKING"
+ * |option [Reactor] "REACTOR"
+ * |preview disable
+ * |tab Reactor
+ *
+ * |param reactorCpus [Reactor CPUs] The CPUs of the reactor threads, one thread pinned to each CPU.
+ * An empty list runs one reactor thread without CPU affinity.
+ * The reactor is shared by all audio blocks, the first block to open a stream starts its threads.
+ * |default []
+ * |preview disable
+ * |tab Reactor
+ *
  * |factory /audio/source(dtype, numChans, chanMode)
+ * |initializer setupBackend(backend)
  * |initializer setupDevice(deviceName)
+ * |initializer setupIoMode(ioMode, reactorCpus)
  * |initializer setupStream(sampRate)
  * |setter setReportMode(reportMode)
  * |setter setBackoffTime(backoffTime)
+ * |setter setTimingTrace(timingTrace)
+ * |setter setOutputMode(outputMode)
+ * |setter setPacketSize(packetSize)
+ * |setter setPoolSize(poolSize)
+ * |setter setTriggerMode(triggerMode)
+ * |setter setPreTrigger(preTrigger)
+ * |setter setPostTrigger(postTrigger)
+ * |setter setProbeInterval(probeInterval)
+ * |setter setLatencyBudget(latencyBudget)
  **********************************************************************/
 class AudioSource : public AudioBlock
 {
 public:
     AudioSource(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
-        AudioBlock("AudioSource", false, dtype, numChans, chanMode)
+        AudioBlock("AudioSource", false, dtype, numChans, chanMode),
+        _packetMode(false),
+        _packetSize(1024),
+        _poolSize(16),
+        _poolIndex(0),
+        _packetOffset(0),
+        _packetTime(0.0),
+        _packetIndex(0),
+        _sampleCount(0),
+        _triggerMode(false),
+        _preTrigger(1.0),
+        _postTrigger(1.0),
+        _preFrames(0),
+        _postFrames(0),
+        _ringFrames(0),
+        _ringLocked(false),
+        _ringWrite(0),
+        _ringRead(0),
+        _triggered(false),
+        _triggerIndex(0),
+        _triggerLabel(false),
+        _ringOverflowing(false),
+        _burstEnd(0),
+        _probeInterval(0)
     {
         //setup ports
         if (_interleaved) this->setupOutput(0, Pothos::DType::fromDType(dtype, numChans));
         else for (size_t i = 0; i < numChans; i++) this->setupOutput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setOutputMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setPacketSize));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setPoolSize));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setTriggerMode));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setPreTrigger));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setPostTrigger));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, trigger));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioSource, setProbeInterval));
+    }
+
+    ~AudioSource(void)
+    {
+        this->freeTriggerRing();
     }
 
     static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
@@ -101,16 +348,112 @@ public:
         return new AudioSource(dtype, numChans, chanMode);
     }
 
+    void setOutputMode(const std::string &mode)
+    {
+        if (mode == "STREAM"){}
+        else if (mode == "PACKET"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioSource::setOutputMode("+mode+")", "unknown output mode");
+        _packetMode = (mode == "PACKET");
+        this->setupPacketPool();
+    }
+
+    void setPacketSize(const size_t size)
+    {
+        if (size == 0) throw Pothos::InvalidArgumentException(
+            "AudioSource::setPacketSize()", "packet size must be non-zero");
+        _packetSize = size;
+        this->setupPacketPool();
+    }
+
+    void setPoolSize(const size_t size)
+    {
+        if (size == 0) throw Pothos::InvalidArgumentException(
+            "AudioSource::setPoolSize()", "pool size must be non-zero");
+        _poolSize = size;
+        this->setupPacketPool();
+    }
+
+    void setTriggerMode(const std::string &mode)
+    {
+        if (mode == "CONTINUOUS"){}
+        else if (mode == "TRIGGERED"){}
+        else throw Pothos::InvalidArgumentException(
+            "AudioSource::setTriggerMode("+mode+")", "unknown trigger mode");
+        _triggerMode = (mode == "TRIGGERED");
+
+        //the trigger port only exists once triggered mode is configured
+        if (_triggerMode and this->inputs().empty()) this->setupInput("trigger");
+    }
+
+    void setPreTrigger(const double seconds)
+    {
+        if (seconds < 0.0) throw Pothos::InvalidArgumentException(
+            "AudioSource::setPreTrigger()", "pre-trigger time must not be negative");
+        _preTrigger = seconds;
+    }
+
+    void setPostTrigger(const double seconds)
+    {
+        if (seconds < 0.0) throw Pothos::InvalidArgumentException(
+            "AudioSource::setPostTrigger()", "post-trigger time must not be negative");
+        _postTrigger = seconds;
+    }
+
+    void setProbeInterval(const double seconds)
+    {
+        if (seconds < 0.0) throw Pothos::InvalidArgumentException(
+            "AudioSource::setProbeInterval()", "probe interval must not be negative");
+        _probeInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    /*!
+     * Start a burst at the current capture position,
+     * or extend the burst when one is already in progress.
+     */
+    void trigger(void)
+    {
+        if (_ringFrames == 0) return;
+        if (not _triggered)
+        {
+            _triggered = true;
+            _triggerIndex = _ringWrite;
+            _triggerLabel = true;
+        }
+        _burstEnd = _ringWrite + _postFrames;
+    }
+
+    void activate(void)
+    {
+        AudioBlock::activate();
+        _packetOffset = 0;
+        _sampleCount = 0;
+        _nextProbe = std::chrono::steady_clock::now();
+        if (_triggerMode and not _packetMode) this->setupTriggerRing();
+    }
+
+    void deactivate(void)
+    {
+        this->freeTriggerRing();
+        AudioBlock::deactivate();
+    }
+
     void work(void)
     {
+        AUDIO_REALTIME_SCOPE("AudioSource::work()");
+        AudioTraceSpan traceWork("AudioSource::work()");
+        if (_packetMode) return this->workPackets();
+        if (_ringFrames != 0) return this->workTrigger();
+
         if (this->workInfo().minOutElements == 0) return;
 
         //calculate the number of frames
-        int numFrames = Pa_GetStreamReadAvailable(_stream);
+        int numFrames = this->streamAvailable();
         if (numFrames < 0)
         {
-            throw Pothos::Exception("AudioSource::work()", "Pa_GetStreamReadAvailable: " + std::string(Pa_GetErrorText(numFrames)));
+            throw Pothos::Exception("AudioSource::work()", "Stream available: " + _stream->errorText(numFrames));
         }
+        const int numAvailable = numFrames;
         if (numFrames == 0) numFrames = MIN_FRAMES_BLOCKING;
         numFrames = std::min<int>(numFrames, this->workInfo().minOutElements);
 
@@ -120,35 +463,359 @@ public:
         else buffer = (void *)this->workInfo().outputPointers.data();
 
         //peform read from the device
-        PaError err = Pa_ReadStream(_stream, buffer, numFrames);
+        int err = this->streamRead(buffer, numFrames);
+        this->handleReadError(err);
+        _numFrames += numFrames;
+        _sampleCount += numFrames;
 
+        if (_sendLabel)
+        {
+            _sendLabel = false;
+            const auto rate = _stream->sampleRate();
+            Pothos::Label label("rxRate", rate, 0);
+            for (auto port : this->outputs()) port->postLabel(label);
+        }
+
+        //not ready to produce because of backoff
+        if (_readyTime >= std::chrono::high_resolution_clock::now()) return this->yield();
+
+        //the first sample of the read is older than the newest captured sample by the larger of both counts
+        if (_probeInterval.count() != 0) this->postProbe(std::max(numAvailable, numFrames));
+
+        //produce buffer (all modes)
+        traceWork.setArg("produce", numFrames);
+        for (auto port : this->outputs()) port->produce(numFrames);
+    }
+
+private:
+    void handleReadError(const int err)
+    {
         //handle the error reporting
-        bool logError = err != paNoError;
-        if (err == paInputOverflowed)
+        bool logError = err != AUDIO_OK;
+        if (err == AUDIO_XRUN)
         {
+            _numXruns++;
             _readyTime += _backoffTime;
+            audioTraceInstant("overflow");
             if (_reportStderror) std::cerr << "aO" << std::flush;
             logError = _reportLogger;
         }
         if (logError)
         {
-            poco_error(_logger, "Pa_ReadStream: " + std::string(Pa_GetErrorText(err)));
+            poco_error(_logger, "Stream read: " + _stream->errorText(err));
+        }
+    }
+
+    /*!
+     * Label the first sample of the produced read with its capture time
+     * when the probe interval has elapsed.
+     * The backlog is the number of frames captured since that sample.
+     */
+    void postProbe(const int backlog)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < _nextProbe) return;
+        _nextProbe = now + _probeInterval;
+
+        const double captureTime = std::chrono::duration<double>(now.time_since_epoch()).count()
+            - _stream->latency() - backlog/_stream->sampleRate();
+        Pothos::Label label("latencyProbe", captureTime, 0);
+        for (auto port : this->outputs()) port->postLabel(label);
+    }
+
+    /*!
+     * Allocate the packet buffer pool for packet mode.
+     * Each pool slot holds one buffer per output port.
+     */
+    void setupPacketPool(void)
+    {
+        _packetPool.clear();
+        _packetPointers.clear();
+        _packetOffset = 0;
+        _poolIndex = 0;
+        if (not _packetMode) return;
+
+        _packetPool.resize(_poolSize);
+        for (auto &slot : _packetPool)
+        {
+            for (auto port : this->outputs())
+            {
+                slot.push_back(Pothos::SharedBuffer::make(_packetSize*port->dtype().size()));
+            }
+        }
+        _packetPointers.resize(this->outputs().size());
+    }
+
+    /*!
+     * Find the next pool slot that is no longer referenced downstream.
+     * A buffer is free again when the pool holds the only reference.
+     * \return true when a free slot was found
+     */
+    bool acquirePacketSlot(void)
+    {
+        for (size_t i = 0; i < _packetPool.size(); i++)
+        {
+            const size_t index = (_poolIndex + i) % _packetPool.size();
+            const auto &slot = _packetPool[index];
+            if (not std::all_of(slot.begin(), slot.end(),
+                [](const Pothos::SharedBuffer &b){return b.unique();})) continue;
+            _poolIndex = index;
+            return true;
+        }
+        return false;
+    }
+
+    void workPackets(void)
+    {
+        //wait for downstream to release a packet buffer
+        if (_packetOffset == 0 and not this->acquirePacketSlot()) return this->yield();
+
+        //calculate the number of frames
+        int numFrames = this->streamAvailable();
+        if (numFrames < 0)
+        {
+            throw Pothos::Exception("AudioSource::work()", "Stream available: " + _stream->errorText(numFrames));
         }
+        const int numAvailable = numFrames;
+        if (numFrames == 0) numFrames = MIN_FRAMES_BLOCKING;
+        numFrames = std::min<int>(numFrames, _packetSize - _packetOffset);
+
+        //capture time of the first sample in this read
+        const double rate = _stream->sampleRate();
+        const double readTime = _stream->availableTime() - _stream->latency() - numAvailable/rate;
+
+        //get the buffer at the current packet offset
+        const auto &slot = _packetPool[_poolIndex];
+        for (size_t i = 0; i < slot.size(); i++)
+        {
+            const size_t offset = _packetOffset*this->outputs()[i]->dtype().size();
+            _packetPointers[i] = (void *)(slot[i].getAddress() + offset);
+        }
+        void *buffer = nullptr;
+        if (_interleaved) buffer = _packetPointers[0];
+        else buffer = (void *)_packetPointers.data();
+
+        //peform read from the device
+        int err = this->streamRead(buffer, numFrames);
+        this->handleReadError(err);
+        _numFrames += numFrames;
+
+        //record the metadata for the first sample in the packet
+        if (_packetOffset == 0)
+        {
+            _packetTime = readTime;
+            _packetIndex = _sampleCount;
+        }
+        _packetOffset += numFrames;
+        _sampleCount += numFrames;
+
+        //not ready to produce because of backoff, drop the partial packet
+        if (_readyTime >= std::chrono::high_resolution_clock::now())
+        {
+            _packetOffset = 0;
+            return this->yield();
+        }
+
+        //the packet is incomplete, continue reading on the next call
+        if (_packetOffset < _packetSize) return;
+        _packetOffset = 0;
+
+        //post the packet (all modes)
+        for (size_t i = 0; i < slot.size(); i++)
+        {
+            auto port = this->outputs()[i];
+            Pothos::Packet packet;
+            packet.payload = Pothos::BufferChunk(slot[i]);
+            packet.payload.dtype = port->dtype();
+            packet.metadata["rxTime"] = Pothos::Object(_packetTime);
+            packet.metadata["rxIndex"] = Pothos::Object(_packetIndex);
+            packet.metadata["rxRate"] = Pothos::Object(rate);
+            port->postMessage(std::move(packet));
+        }
+        _poolIndex = (_poolIndex + 1) % _packetPool.size();
+    }
+
+    /*!
+     * Allocate the pre-trigger ring for the stream rate.
+     * The ring holds the pre-trigger history plus the same again
+     * as headroom for the backlog while a burst is being emitted.
+     */
+    void setupTriggerRing(void)
+    {
+        this->freeTriggerRing();
+        const auto rate = _stream->sampleRate();
+        _preFrames = size_t(_preTrigger*rate + 0.5);
+        _postFrames = (unsigned long long)(_postTrigger*rate + 0.5);
+        if (_postFrames == 0) _postFrames = ~0ull/2; //continue indefinitely
+        _ringFrames = _preFrames + std::max<size_t>(_preFrames, MIN_FRAMES_BLOCKING);
+
+        _triggerRing.resize(this->outputs().size());
+        _ringPointers.resize(this->outputs().size());
+        _ringLocked = true;
+        for (size_t i = 0; i < _triggerRing.size(); i++)
+        {
+            //the allocation writes every page, so the ring is resident before capture
+            _triggerRing[i].assign(_ringFrames*this->outputs()[i]->dtype().size(), 0);
+            #ifndef _WIN32
+            if (mlock(_triggerRing[i].data(), _triggerRing[i].size()) != 0) _ringLocked = false;
+            #else
+            _ringLocked = false;
+            #endif
+        }
+        if (not _ringLocked) poco_warning_f1(_logger, "Could not lock the %s pre-trigger ring into memory", _blockName);
+
+        _ringWrite = 0;
+        _ringRead = 0;
+        _triggered = false;
+        _triggerLabel = false;
+        _ringOverflowing = false;
+    }
+
+    void freeTriggerRing(void)
+    {
+        #ifndef _WIN32
+        for (auto &ring : _triggerRing)
+        {
+            if (_ringLocked and not ring.empty()) munlock(ring.data(), ring.size());
+        }
+        #endif
+        _triggerRing.clear();
+        _ringLocked = false;
+        _ringFrames = 0;
+        _triggered = false;
+    }
+
+    void workTrigger(void)
+    {
+        //any message or "trigger" label on the trigger port starts a burst
+        auto triggerPort = this->input("trigger");
+        bool triggered = false;
+        while (triggerPort->hasMessage())
+        {
+            triggerPort->popMessage();
+            triggered = true;
+        }
+        for (const auto &label : triggerPort->labels())
+        {
+            if (label.id == "trigger") triggered = true;
+        }
+        triggerPort->consume(triggerPort->elements());
+        if (triggered) this->trigger();
+
+        //calculate the number of frames, only block when there is nothing to emit
+        int numFrames = this->streamAvailable();
+        if (numFrames < 0)
+        {
+            throw Pothos::Exception("AudioSource::work()", "Stream available: " + _stream->errorText(numFrames));
+        }
+        if (numFrames == 0 and not (_triggered and _ringWrite != _ringRead)) numFrames = MIN_FRAMES_BLOCKING;
+        const size_t writeOffset = size_t(_ringWrite % _ringFrames);
+        numFrames = std::min<int>(numFrames, int(_ringFrames - writeOffset));
+
+        //peform read from the device into the ring
+        if (numFrames > 0)
+        {
+            //the oldest frames are overwritten when the ring is full,
+            //warn once at the start of an overflow during a burst
+            const bool overflow = _ringWrite + numFrames - _ringRead > _ringFrames;
+            if (overflow)
+            {
+                if (_triggered and not _ringOverflowing) poco_warning_f1(_logger, "%s pre-trigger ring overflow, downstream is not keeping up", _blockName);
+                _ringRead = _ringWrite + numFrames - _ringFrames;
+            }
+            _ringOverflowing = overflow and _triggered;
+            for (size_t i = 0; i < _triggerRing.size(); i++)
+            {
+                _ringPointers[i] = _triggerRing[i].data() + writeOffset*this->outputs()[i]->dtype().size();
+            }
+            void *buffer = nullptr;
+            if (_interleaved) buffer = _ringPointers[0];
+            else buffer = (void *)_ringPointers.data();
+            int err = this->streamRead(buffer, numFrames);
+            this->handleReadError(err);
+            _numFrames += numFrames;
+            _ringWrite += numFrames;
+            _sampleCount += numFrames;
+        }
+
+        //keep only the pre-trigger history while idle
+        if (not _triggered)
+        {
+            if (_ringWrite - _ringRead > _preFrames) _ringRead = _ringWrite - _preFrames;
+            return;
+        }
+
+        //the burst ends at the post-trigger time
+        if (_ringRead >= _burstEnd)
+        {
+            _triggered = false;
+            return;
+        }
+
+        //emit the next contiguous segment of the burst
+        const size_t readOffset = size_t(_ringRead % _ringFrames);
+        size_t numOut = size_t(std::min<unsigned long long>(_ringWrite, _burstEnd) - _ringRead);
+        numOut = std::min(numOut, _ringFrames - readOffset);
+        numOut = std::min(numOut, this->workInfo().minOutElements);
+        if (numOut == 0) return;
 
         if (_sendLabel)
         {
             _sendLabel = false;
-            const auto rate = Pa_GetStreamInfo(_stream)->sampleRate;
+            const auto rate = _stream->sampleRate();
             Pothos::Label label("rxRate", rate, 0);
             for (auto port : this->outputs()) port->postLabel(label);
         }
 
-        //not ready to produce because of backoff
-        if (_readyTime >= std::chrono::high_resolution_clock::now()) return this->yield();
-
-        //produce buffer (all modes)
-        for (auto port : this->outputs()) port->produce(numFrames);
+        //the trigger label goes on the first sample when an overflow dropped the trigger sample
+        const bool postTrigger = _triggerLabel and _triggerIndex < _ringRead + numOut;
+        const size_t triggerOffset = (_triggerIndex > _ringRead)?size_t(_triggerIndex - _ringRead):0;
+        if (postTrigger) _triggerLabel = false;
+        for (auto port : this->outputs())
+        {
+            if (postTrigger)
+            {
+                port->postLabel(Pothos::Label("trigger", Pothos::Object((long long)_triggerIndex), triggerOffset));
+            }
+            const size_t size = port->dtype().size();
+            std::memcpy(port->buffer().as<void *>(), _triggerRing[port->index()].data() + readOffset*size, numOut*size);
+            port->produce(numOut);
+        }
+        _ringRead += numOut;
     }
+
+    bool _packetMode;
+    size_t _packetSize;
+    size_t _poolSize;
+    std::vector<std::vector<Pothos::SharedBuffer>> _packetPool;
+    std::vector<void *> _packetPointers;
+    size_t _poolIndex;
+    size_t _packetOffset;
+    double _packetTime;
+    long long _packetIndex;
+    long long _sampleCount;
+
+    //pre-trigger ring state
+    bool _triggerMode;
+    double _preTrigger;
+    double _postTrigger;
+    size_t _preFrames;
+    unsigned long long _postFrames;
+    std::vector<std::vector<char>> _triggerRing;
+    std::vector<void *> _ringPointers;
+    size_t _ringFrames;
+    bool _ringLocked;
+    unsigned long long _ringWrite;
+    unsigned long long _ringRead;
+    bool _triggered;
+    unsigned long long _triggerIndex;
+    bool _triggerLabel;
+    bool _ringOverflowing;
+    unsigned long long _burstEnd;
+
+    //latency probe state
+    std::chrono::steady_clock::duration _probeInterval;
+    std::chrono::steady_clock::time_point _nextProbe;
 };
 
 static Pothos::BlockRegistry registerAudioSource(
@@ -0,0 +1,217 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioFormats.hpp"
+#include "AudioPacer.hpp"
+#include <Pothos/Framework.hpp>
+#include <algorithm> //min/max
+#include <cmath>
+#include <vector>
+
+/***********************************************************************
+ * |PothosDoc Audio Tone Source
+ *
+ * The audio tone source is a virtual audio input device for machines without a sound card.
+ * It produces a sine tone at the real-time rate of the sample rate parameter,
+ * paced by a monotonic clock rather than an audio device.
+ * In interleaved mode, the samples are interleaved into one output port,
+ * In the port-per-channel mode, each audio channel uses a separate port.
+ *
+ * Like the audio source, the tone source posts a sample rate stream label named "rxRate"
+ * on the first call to work() after activate() has been called,
+ * and reports the getNumFrames() and getNumXruns() statistics.
+ * The tone source simulates a device buffer of 8*MIN_FRAMES_BLOCKING frames:
+ * when downstream falls further behind the clock, the excess frames are
+ * dropped and counted as an overflow, just like a real capture device.
+ *
+ * |category /Audio
+ * |category /Sources
+ * |keywords audio sound virtual tone sine test headless
+ *
+ * |param sampRate[Sample Rate] The rate of audio samples.
+ * |option 32e3
+ * |option 44.1e3
+ * |option 48e3
+ * |default 44.1e3
+ * |units Sps
+ * |widget ComboBox(editable=true)
+ *
+ * |param dtype[Data Type] The data type produced by the tone source.
+ * |option [Float32] "float32"
+ * |option [Int32] "int32"
+ * |option [Int16] "int16"
+ * |option [Int8] "int8"
+ * |option [UInt8] "uint8"
+ * |default "float32"
+ * |preview disable
+ *
+ * |param numChans [Num Channels] The number of audio channels.
+ * This parameter controls the number of samples per stream element.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ *
+ * |param chanMode [Channel Mode] The channel mode.
+ * One port with interleaved channels or one port per channel?
+ * |option [Interleaved channels] "INTERLEAVED"
+ * |option [One port per channel] "PORTPERCHAN"
+ * |default "INTERLEAVED"
+ * |preview disable
+ *
+ * |param frequency [Frequency] The frequency of the tone.
+ * |units Hz
+ * |default 1000.0
+ *
+ * |param amplitude [Amplitude] The amplitude of the tone relative to full scale.
+ * |default 0.5
+ *
+ * |factory /audio/tone_source(dtype, numChans, chanMode)
+ * |setter setSampleRate(sampRate)
+ * |setter setFrequency(frequency)
+ * |setter setAmplitude(amplitude)
+ **********************************************************************/
+class AudioToneSource : public Pothos::Block
+{
+public:
+    AudioToneSource(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode):
+        _sampleType(audioSampleTypeFromDType(dtype)),
+        _numChans(numChans),
+        _interleaved(chanMode == "INTERLEAVED"),
+        _sampleRate(44100.0),
+        _frequency(1000.0),
+        _amplitude(0.5),
+        _phase(0.0),
+        _sendLabel(false),
+        _numXruns(0),
+        _numFrames(0),
+        _frameCount(0)
+    {
+        //setup ports
+        if (_interleaved) this->setupOutput(0, Pothos::DType::fromDType(dtype, numChans));
+        else for (size_t i = 0; i < numChans; i++) this->setupOutput(i, dtype);
+
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioToneSource, setSampleRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioToneSource, setFrequency));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioToneSource, setAmplitude));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioToneSource, getNumXruns));
+        this->registerCall(this, POTHOS_FCN_TUPLE(AudioToneSource, getNumFrames));
+    }
+
+    static Block *make(const Pothos::DType &dtype, const size_t numChans, const std::string &chanMode)
+    {
+        return new AudioToneSource(dtype, numChans, chanMode);
+    }
+
+    void setSampleRate(const double rate)
+    {
+        if (rate <= 0.0) throw Pothos::InvalidArgumentException(
+            "AudioToneSource::setSampleRate()", "sample rate must be positive");
+        _sampleRate = rate;
+    }
+
+    void setFrequency(const double freq)
+    {
+        _frequency = freq;
+    }
+
+    void setAmplitude(const double ampl)
+    {
+        _amplitude = ampl;
+    }
+
+    unsigned long long getNumXruns(void) const
+    {
+        return _numXruns;
+    }
+
+    unsigned long long getNumFrames(void) const
+    {
+        return _numFrames;
+    }
+
+    void activate(void)
+    {
+        _pacer.reset(_sampleRate);
+        _frameCount = 0;
+        _numXruns = 0;
+        _numFrames = 0;
+        _sendLabel = true;
+    }
+
+    void work(void)
+    {
+        if (this->workInfo().minOutElements == 0) return;
+
+        //downstream fell behind by more than the device buffer, drop the excess
+        unsigned long long due = _pacer.dueFrames();
+        if (due > _frameCount + VIRTUAL_BUFFER_FRAMES)
+        {
+            const auto dropped = due - _frameCount - VIRTUAL_BUFFER_FRAMES;
+            _phase = std::fmod(_phase + dropped*this->phaseStep(), TWO_PI);
+            _frameCount += dropped;
+            _numXruns++;
+        }
+
+        //wait for frames to become due, like a blocking device read
+        if (due <= _frameCount)
+        {
+            due = _frameCount + std::min<size_t>(MIN_FRAMES_BLOCKING, this->workInfo().minOutElements);
+            _pacer.sleepUntil(due);
+        }
+        const size_t numFrames = std::min<size_t>(size_t(due - _frameCount), this->workInfo().minOutElements);
+
+        if (_sendLabel)
+        {
+            _sendLabel = false;
+            Pothos::Label label("rxRate", _sampleRate, 0);
+            for (auto port : this->outputs()) port->postLabel(label);
+        }
+
+        //generate one channel of the tone
+        _tone.resize(numFrames);
+        const double step = this->phaseStep();
+        for (size_t i = 0; i < numFrames; i++)
+        {
+            _tone[i] = float(_amplitude*std::sin(_phase + i*step));
+        }
+        _phase = std::fmod(_phase + numFrames*step, TWO_PI);
+
+        //convert into every channel of the outputs
+        const size_t sampleSize = audioSampleSize(_sampleType);
+        for (auto port : this->outputs())
+        {
+            char *out = port->buffer().as<char *>();
+            if (_interleaved) for (size_t c = 0; c < _numChans; c++)
+            {
+                audioConvertFromFloat(_tone.data(), 1, out + c*sampleSize, _sampleType, _numChans, numFrames);
+            }
+            else audioConvertFromFloat(_tone.data(), 1, out, _sampleType, 1, numFrames);
+            port->produce(numFrames);
+        }
+
+        _frameCount += numFrames;
+        _numFrames += numFrames;
+    }
+
+private:
+    double phaseStep(void) const
+    {
+        return TWO_PI*_frequency/_sampleRate;
+    }
+
+    const AudioSampleType _sampleType;
+    const size_t _numChans;
+    const bool _interleaved;
+    double _sampleRate;
+    double _frequency;
+    double _amplitude;
+    double _phase;
+    bool _sendLabel;
+    unsigned long long _numXruns;
+    unsigned long long _numFrames;
+    unsigned long long _frameCount;
+    AudioPacer _pacer;
+    std::vector<float> _tone;
+};
+
+static Pothos::BlockRegistry registerAudioToneSource(
+    "/audio/tone_source", &AudioToneSource::make);
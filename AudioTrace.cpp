@@ -0,0 +1,153 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioTrace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//the number of events per thread, later events are dropped until the next trace
+static const size_t TRACE_BUFFER_EVENTS = 16384;
+
+std::atomic<bool> audioTraceActive(false);
+
+struct AudioTraceEvent
+{
+    const char *name;
+    const char *argName;
+    long long arg;
+    unsigned long long startNs;
+    unsigned long long durNs;
+    char phase;
+};
+
+struct AudioTraceBuffer
+{
+    AudioTraceBuffer(const int tid):
+        tid(tid),
+        generation(0),
+        size(0),
+        events(TRACE_BUFFER_EVENTS)
+    {
+        return;
+    }
+
+    const int tid;
+    std::atomic<unsigned> generation;
+    std::atomic<size_t> size;
+    std::vector<AudioTraceEvent> events;
+};
+
+/***********************************************************************
+ * Registry of the thread buffers, locked only on first use per thread
+ **********************************************************************/
+struct AudioTraceState
+{
+    AudioTraceState(void):
+        epoch(std::chrono::steady_clock::now()),
+        generation(0)
+    {
+        return;
+    }
+
+    const std::chrono::steady_clock::time_point epoch;
+    std::atomic<unsigned> generation;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<AudioTraceBuffer>> buffers;
+};
+
+static AudioTraceState &traceState(void)
+{
+    static AudioTraceState state;
+    return state;
+}
+
+static AudioTraceBuffer *threadBuffer(void)
+{
+    static thread_local AudioTraceBuffer *buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        auto &state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.buffers.emplace_back(new AudioTraceBuffer(int(state.buffers.size()+1)));
+        buffer = state.buffers.back().get();
+    }
+    return buffer;
+}
+
+/***********************************************************************
+ * Recording
+ **********************************************************************/
+void audioTraceEnable(const bool enable)
+{
+    if (enable) traceState().generation++;
+    audioTraceActive = enable;
+}
+
+unsigned long long audioTraceNow(void)
+{
+    const auto elapsed = std::chrono::steady_clock::now() - traceState().epoch;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() + 1;
+}
+
+void audioTraceRecord(const char *name, const char phase, const unsigned long long startNs,
+    const unsigned long long durNs, const char *argName, const long long arg)
+{
+    auto buffer = threadBuffer();
+
+    //the owning thread clears its buffer when a new trace starts
+    const auto generation = traceState().generation.load(std::memory_order_relaxed);
+    if (buffer->generation.load(std::memory_order_relaxed) != generation)
+    {
+        buffer->size.store(0, std::memory_order_relaxed);
+        buffer->generation.store(generation, std::memory_order_release);
+    }
+
+    const size_t index = buffer->size.load(std::memory_order_relaxed);
+    if (index == buffer->events.size()) return;
+    auto &event = buffer->events[index];
+    event.name = name;
+    event.argName = argName;
+    event.arg = arg;
+    event.startNs = startNs;
+    event.durNs = durNs;
+    event.phase = phase;
+    buffer->size.store(index+1, std::memory_order_release);
+}
+
+/***********************************************************************
+ * Chrome trace event JSON output
+ **********************************************************************/
+bool audioTraceWrite(const std::string &path)
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) return false;
+
+    auto &state = traceState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    const auto generation = state.generation.load();
+    std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;
+    for (const auto &buffer : state.buffers)
+    {
+        if (buffer->generation.load(std::memory_order_acquire) != generation) continue;
+        const size_t size = buffer->size.load(std::memory_order_acquire);
+        for (size_t i = 0; i < size; i++)
+        {
+            const auto &event = buffer->events[i];
+            std::fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f",
+                first?"":",\n", event.name, event.phase, buffer->tid, event.startNs/1e3);
+            if (event.phase == 'X') std::fprintf(file, ", \"dur\": %.3f", event.durNs/1e3);
+            if (event.phase == 'i') std::fprintf(file, ", \"s\": \"t\"");
+            if (event.argName != nullptr) std::fprintf(file, ", \"args\": {\"%s\": %lld}", event.argName, event.arg);
+            std::fprintf(file, "}");
+            first = false;
+        }
+        if (size == buffer->events.size()) std::fprintf(file, "%s{\"name\": \"trace buffer full\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}",
+            first?"":",\n", buffer->tid, buffer->events.back().startNs/1e3);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <atomic>
+#include <string>
+
+/***********************************************************************
+ * Timeline tracing of the audio blocks
+ *
+ * The trace records work() spans, device read and write spans,
+ * and xrun instants into a fixed size buffer per thread.
+ * Only the owning thread writes to a buffer, so recording is lock-free.
+ * The trace is process-wide: audioTraceEnable() starts a new trace
+ * and audioTraceWrite() saves the events of all threads in the
+ * Chrome trace event JSON format, viewable in chrome://tracing or Perfetto.
+ * While disabled, each trace point costs one relaxed atomic load.
+ **********************************************************************/
+extern std::atomic<bool> audioTraceActive;
+
+//! Start a new trace or stop recording
+void audioTraceEnable(const bool enable);
+
+//! Write the recorded events to a Chrome trace JSON file, false on error
+bool audioTraceWrite(const std::string &path);
+
+//! Nanoseconds since the trace epoch, never zero
+unsigned long long audioTraceNow(void);
+
+/*!
+ * Record one event, the name and argument name must be string literals.
+ * The phase is 'X' for a complete span or 'i' for an instant.
+ */
+void audioTraceRecord(const char *name, const char phase, const unsigned long long startNs,
+    const unsigned long long durNs, const char *argName, const long long arg);
+
+//! Record an instant event when tracing is active
+inline void audioTraceInstant(const char *name, const char *argName = nullptr, const long long arg = 0)
+{
+    if (not audioTraceActive.load(std::memory_order_relaxed)) return;
+    audioTraceRecord(name, 'i', audioTraceNow(), 0, argName, arg);
+}
+
+//! Record a complete span for the lifetime of the object when tracing is active
+class AudioTraceSpan
+{
+public:
+    AudioTraceSpan(const char *name):
+        _name(name),
+        _argName(nullptr),
+        _arg(0),
+        _start(audioTraceActive.load(std::memory_order_relaxed)?audioTraceNow():0)
+    {
+        return;
+    }
+
+    ~AudioTraceSpan(void)
+    {
+        if (_start != 0) audioTraceRecord(_name, 'X', _start, audioTraceNow() - _start, _argName, _arg);
+    }
+
+    //! Attach a numeric argument to the span, like the frames produced
+    void setArg(const char *name, const long long value)
+    {
+        _argName = name;
+        _arg = value;
+    }
+
+private:
+    const char *_name;
+    const char *_argName;
+    long long _arg;
+    const unsigned long long _start;
+};
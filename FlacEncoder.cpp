@@ -0,0 +1,319 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "FlacEncoder.hpp"
+#include <algorithm> //min/max
+#include <cstring>
+
+//the largest partition order searched for the residual coding
+static const unsigned MAX_PARTITION_ORDER = 8;
+
+//the largest fixed predictor order defined by the format
+static const size_t MAX_FIXED_ORDER = 4;
+
+/***********************************************************************
+ * CRC-8 (poly 0x07) for frame headers and CRC-16 (poly 0x8005) for frames
+ **********************************************************************/
+struct FlacCrcTables
+{
+    FlacCrcTables(void)
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            uint8_t c8 = uint8_t(i);
+            uint16_t c16 = uint16_t(i << 8);
+            for (int b = 0; b < 8; b++)
+            {
+                c8 = uint8_t((c8 & 0x80)?((c8 << 1) ^ 0x07):(c8 << 1));
+                c16 = uint16_t((c16 & 0x8000)?((c16 << 1) ^ 0x8005):(c16 << 1));
+            }
+            crc8[i] = c8;
+            crc16[i] = c16;
+        }
+    }
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+};
+
+static const FlacCrcTables &crcTables(void)
+{
+    static const FlacCrcTables tables;
+    return tables;
+}
+
+static uint8_t flacCrc8(const uint8_t *p, const size_t len)
+{
+    const auto &t = crcTables();
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) crc = t.crc8[crc ^ p[i]];
+    return crc;
+}
+
+static uint16_t flacCrc16(const uint8_t *p, const size_t len)
+{
+    const auto &t = crcTables();
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) crc = uint16_t((crc << 8) ^ t.crc16[(crc >> 8) ^ p[i]]);
+    return crc;
+}
+
+/***********************************************************************
+ * MSB-first bit packing into a byte vector
+ **********************************************************************/
+class FlacBitWriter
+{
+public:
+    FlacBitWriter(std::vector<uint8_t> &out):
+        _out(out),
+        _acc(0),
+        _bits(0)
+    {
+        return;
+    }
+
+    //! Write the low n bits of value (n <= 32)
+    void write(const uint32_t value, const unsigned n)
+    {
+        if (n == 0) return;
+        _acc = (_acc << n) | (value & (0xFFFFFFFFu >> (32 - n)));
+        _bits += n;
+        while (_bits >= 8)
+        {
+            _bits -= 8;
+            _out.push_back(uint8_t(_acc >> _bits));
+        }
+        _acc &= (uint64_t(1) << _bits) - 1;
+    }
+
+    void writeUnary(uint32_t zeros)
+    {
+        while (zeros >= 32)
+        {
+            this->write(0, 32);
+            zeros -= 32;
+        }
+        this->write(1, zeros + 1);
+    }
+
+    void writeRice(const uint32_t folded, const unsigned k)
+    {
+        this->writeUnary(folded >> k);
+        this->write(folded, k);
+    }
+
+    //! Pad with zeros to the next byte boundary
+    void align(void)
+    {
+        if (_bits != 0) this->write(0, 8 - _bits);
+    }
+
+private:
+    std::vector<uint8_t> &_out;
+    uint64_t _acc;
+    unsigned _bits;
+};
+
+/***********************************************************************
+ * Stream header
+ **********************************************************************/
+void flacWriteStreamInfo(uint8_t *out, const FlacStreamInfo &info)
+{
+    std::vector<uint8_t> buff;
+    buff.reserve(FLAC_STREAMINFO_SIZE);
+    FlacBitWriter bw(buff);
+    bw.write(0x664C6143, 32); //"fLaC"
+    bw.write(1, 1); //last metadata block
+    bw.write(0, 7); //STREAMINFO
+    bw.write(34, 24); //block length
+    bw.write(uint32_t(info.blockSize), 16); //min block size
+    bw.write(uint32_t(info.blockSize), 16); //max block size
+    bw.write(uint32_t(info.minFrameSize), 24);
+    bw.write(uint32_t(info.maxFrameSize), 24);
+    bw.write(info.sampleRate, 20);
+    bw.write(uint32_t(info.numChans - 1), 3);
+    bw.write(info.bitsPerSample - 1, 5);
+    bw.write(uint32_t(info.totalSamples >> 32), 4);
+    bw.write(uint32_t(info.totalSamples), 32);
+    for (size_t i = 0; i < 4; i++) bw.write(0, 32); //MD5 not computed
+    std::memcpy(out, buff.data(), FLAC_STREAMINFO_SIZE);
+}
+
+/***********************************************************************
+ * Frame encoder
+ **********************************************************************/
+//! The Rice parameter for a partition, about log2 of the mean
+static unsigned riceParam(const uint64_t sum, const size_t n)
+{
+    unsigned k = 0;
+    while (k < 30 and (uint64_t(n) << (k + 1)) <= sum) k++;
+    return k;
+}
+
+static uint64_t riceBits(const uint64_t sum, const size_t n, const unsigned k)
+{
+    return n*(k + 1) + (sum >> k);
+}
+
+FlacFrameEncoder::FlacFrameEncoder(void):
+    _sums(size_t(1) << MAX_PARTITION_ORDER),
+    _params(size_t(1) << MAX_PARTITION_ORDER)
+{
+    return;
+}
+
+void FlacFrameEncoder::encode(const int32_t *samples, const size_t stride, const size_t numChans,
+    const size_t numFrames, const unsigned bitsPerSample,
+    const unsigned long long frameNumber, std::vector<uint8_t> &out)
+{
+    const size_t N = numFrames;
+    const unsigned shift = 32 - bitsPerSample;
+    _chan.resize(N);
+    _folded.resize(N);
+
+    const size_t start = out.size();
+    FlacBitWriter bw(out);
+
+    //frame header, rate and sample size come from STREAMINFO
+    bw.write(0xFFF8, 16); //sync code, fixed block size strategy
+    bw.write(0x7, 4); //16-bit block size at the end of the header
+    bw.write(0x0, 4); //sample rate from STREAMINFO
+    bw.write(uint32_t(numChans - 1), 4); //independent channels
+    bw.write(0x0, 3); //sample size from STREAMINFO
+    bw.write(0, 1);
+
+    //frame number in the extended UTF-8 coding
+    if (frameNumber < 0x80) bw.write(uint32_t(frameNumber), 8);
+    else
+    {
+        unsigned numBytes = 2;
+        while (numBytes < 7 and frameNumber >= (1ull << (5*numBytes + 1))) numBytes++;
+        bw.write(uint32_t((0xFF00 >> numBytes) & 0xFF) | uint32_t(frameNumber >> (6*(numBytes - 1))), 8);
+        for (unsigned i = numBytes - 1; i > 0; i--)
+        {
+            bw.write(0x80 | uint32_t((frameNumber >> (6*(i - 1))) & 0x3F), 8);
+        }
+    }
+    bw.write(uint32_t(N - 1), 16);
+    bw.write(flacCrc8(out.data() + start, out.size() - start), 8);
+
+    for (size_t c = 0; c < numChans; c++)
+    {
+        //de-interleave and right-justify
+        const int32_t *x = _chan.data();
+        for (size_t n = 0; n < N; n++) _chan[n] = samples[n*stride + c] >> shift;
+
+        //constant subframe
+        if (std::all_of(_chan.begin(), _chan.end(), [x](const int32_t v){return v == x[0];}))
+        {
+            bw.write(0x00, 8);
+            bw.write(uint32_t(x[0]), bitsPerSample);
+            continue;
+        }
+
+        //pick the fixed predictor order with the smallest residual
+        size_t order = 0;
+        if (N > MAX_FIXED_ORDER)
+        {
+            uint64_t total[MAX_FIXED_ORDER + 1] = {0, 0, 0, 0, 0};
+            int64_t last0 = x[3], last1 = x[3] - x[2];
+            int64_t last2 = last1 - (x[2] - x[1]);
+            int64_t last3 = last2 - (x[2] - x[1] - (x[1] - x[0]));
+            for (size_t n = MAX_FIXED_ORDER; n < N; n++)
+            {
+                const int64_t e0 = x[n], e1 = e0 - last0, e2 = e1 - last1, e3 = e2 - last2, e4 = e3 - last3;
+                total[0] += uint64_t(e0 < 0 ? -e0 : e0);
+                total[1] += uint64_t(e1 < 0 ? -e1 : e1);
+                total[2] += uint64_t(e2 < 0 ? -e2 : e2);
+                total[3] += uint64_t(e3 < 0 ? -e3 : e3);
+                total[4] += uint64_t(e4 < 0 ? -e4 : e4);
+                last0 = e0; last1 = e1; last2 = e2; last3 = e3;
+            }
+            order = size_t(std::min_element(total, total + MAX_FIXED_ORDER + 1) - total);
+        }
+
+        //compute and fold the residual, the warm-up samples are stored verbatim
+        for (size_t n = 0; n < N; n++)
+        {
+            int32_t e = 0;
+            if (n < order) e = 0;
+            else if (order == 0) e = x[n];
+            else if (order == 1) e = x[n] - x[n-1];
+            else if (order == 2) e = x[n] - 2*x[n-1] + x[n-2];
+            else if (order == 3) e = x[n] - 3*x[n-1] + 3*x[n-2] - x[n-3];
+            else e = x[n] - 4*x[n-1] + 6*x[n-2] - 4*x[n-3] + x[n-4];
+            _folded[n] = (uint32_t(e) << 1) ^ uint32_t(e >> 31);
+        }
+
+        //the largest partition order with whole partitions longer than the order
+        unsigned maxPartOrder = 0;
+        while (maxPartOrder < MAX_PARTITION_ORDER and
+            N % (size_t(2) << maxPartOrder) == 0 and
+            (N >> (maxPartOrder + 1)) > order) maxPartOrder++;
+
+        //partition sums at the largest order, merged pairwise for each lower order
+        size_t numParts = size_t(1) << maxPartOrder;
+        for (size_t i = 0; i < numParts; i++)
+        {
+            const size_t ps = N >> maxPartOrder;
+            uint64_t sum = 0;
+            for (size_t n = i*ps; n < (i+1)*ps; n++) sum += _folded[n];
+            _sums[i] = sum;
+        }
+        unsigned bestPartOrder = maxPartOrder;
+        uint64_t bestBits = ~uint64_t(0);
+        for (int p = int(maxPartOrder); p >= 0; p--)
+        {
+            numParts = size_t(1) << p;
+            const size_t ps = N >> p;
+            uint64_t bits = 0;
+            for (size_t i = 0; i < numParts; i++)
+            {
+                const size_t n = (i == 0)?(ps - order):ps;
+                bits += 5 + riceBits(_sums[i], n, riceParam(_sums[i], n));
+            }
+            if (bits < bestBits)
+            {
+                bestBits = bits;
+                bestPartOrder = unsigned(p);
+            }
+            for (size_t i = 0; i < numParts/2; i++) _sums[i] = _sums[2*i] + _sums[2*i+1];
+        }
+
+        //verbatim when prediction does not pay off
+        if (6 + order*bitsPerSample + bestBits >= N*bitsPerSample)
+        {
+            bw.write(0x02, 8);
+            for (size_t n = 0; n < N; n++) bw.write(uint32_t(x[n]), bitsPerSample);
+            continue;
+        }
+
+        //recompute the parameters for the chosen partition order
+        numParts = size_t(1) << bestPartOrder;
+        const size_t ps = N >> bestPartOrder;
+        unsigned maxParam = 0;
+        for (size_t i = 0; i < numParts; i++)
+        {
+            uint64_t sum = 0;
+            for (size_t n = i*ps; n < (i+1)*ps; n++) sum += _folded[n];
+            _params[i] = riceParam(sum, (i == 0)?(ps - order):ps);
+            maxParam = std::max(maxParam, _params[i]);
+        }
+        const bool rice2 = maxParam > 14;
+
+        //fixed subframe: header, warm-up, and partitioned Rice residual
+        bw.write(uint32_t((0x08 | order) << 1), 8);
+        for (size_t n = 0; n < order; n++) bw.write(uint32_t(x[n]), bitsPerSample);
+        bw.write(rice2?1:0, 2);
+        bw.write(bestPartOrder, 4);
+        for (size_t i = 0; i < numParts; i++)
+        {
+            bw.write(_params[i], rice2?5:4);
+            for (size_t n = std::max(i*ps, order); n < (i+1)*ps; n++) bw.writeRice(_folded[n], _params[i]);
+        }
+    }
+
+    //frame footer
+    bw.align();
+    const uint16_t crc = flacCrc16(out.data() + start, out.size() - start);
+    bw.write(crc, 16);
+}
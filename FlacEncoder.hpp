@@ -0,0 +1,70 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+//! The maximum number of channels in one FLAC stream
+static const size_t FLAC_MAX_CHANNELS = 8;
+
+//! The size of the "fLaC" marker and the STREAMINFO metadata block
+static const size_t FLAC_STREAMINFO_SIZE = 42;
+
+/*!
+ * The stream parameters stored in the STREAMINFO block.
+ * The frame sizes and total samples may be zero when unknown,
+ * they are filled in when the stream is finalized.
+ */
+struct FlacStreamInfo
+{
+    size_t numChans;
+    unsigned bitsPerSample;
+    unsigned sampleRate;
+    size_t blockSize;
+    size_t minFrameSize;
+    size_t maxFrameSize;
+    unsigned long long totalSamples;
+};
+
+/*!
+ * Write the "fLaC" marker and the STREAMINFO block (the only metadata block).
+ * The MD5 signature is left zero, which marks it as not computed.
+ * \param out the output buffer of FLAC_STREAMINFO_SIZE bytes
+ */
+void flacWriteStreamInfo(uint8_t *out, const FlacStreamInfo &info);
+
+/*!
+ * An encoder for independent FLAC frames with a fixed block size.
+ * Each subframe is coded as constant, verbatim, or with the best
+ * fixed polynomial predictor (orders 0 to 4) and partitioned Rice coding.
+ * Frames do not depend on each other, so separate encoder instances
+ * can encode the frames of a stream in parallel.
+ * The scratch memory grows to the block size and is then reused.
+ */
+class FlacFrameEncoder
+{
+public:
+    FlacFrameEncoder(void);
+
+    /*!
+     * Encode one frame and append it to the output.
+     * \param samples interleaved samples, left-justified in 32 bits
+     * \param stride the number of samples between frames of the input
+     * \param numChans the number of channels to encode (at most 8)
+     * \param numFrames the block size of this frame
+     * \param bitsPerSample the bits per sample of the stream (at most 24)
+     * \param frameNumber the index of the frame in the stream
+     * \param out the encoded frame is appended to this buffer
+     */
+    void encode(const int32_t *samples, const size_t stride, const size_t numChans,
+        const size_t numFrames, const unsigned bitsPerSample,
+        const unsigned long long frameNumber, std::vector<uint8_t> &out);
+
+private:
+    std::vector<int32_t> _chan;
+    std::vector<uint32_t> _folded;
+    std::vector<uint64_t> _sums;
+    std::vector<unsigned> _params;
+};
@@ -0,0 +1,451 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include "AudioHandoff.hpp"
+#include <Pothos/Plugin.hpp>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <algorithm> //min/max
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+/***********************************************************************
+ * Native JACK backend
+ *
+ * Every stream is its own JACK client with one JACK port per channel.
+ * The process callback exchanges the port buffers with the stream
+ * through one lock-free ring per channel, sized in whole JACK periods,
+ * so the latency is set by the JACK period rather than extra buffering.
+ * The devices are the JACK clients with audio ports, like "system",
+ * and the stream ports connect to the device ports in order on start.
+ * The dummy driver (jackd -d dummy) runs the same graph without hardware.
+ **********************************************************************/
+
+//the minimum number of JACK periods held in the rings
+static const size_t JACK_MIN_PERIODS = 2;
+
+//give up on a blocking call after the process callback stalls this long
+static const long JACK_TIMEOUT_MS = 2000;
+
+//negative status codes of the stream, JACK calls have no error text
+static const int JACK_ERROR_TIMEOUT = -1;
+static const int JACK_ERROR_SHUTDOWN = -2;
+
+//the client name of a device port, the part of "client:port" before the colon
+static std::string jackClientName(const std::string &portName)
+{
+    return portName.substr(0, portName.find(':'));
+}
+
+/***********************************************************************
+ * JACK client stream
+ **********************************************************************/
+class JackStream : public AudioStream
+{
+public:
+    JackStream(const std::string &deviceName, const AudioStreamArgs &args):
+        _client(nullptr),
+        _deviceName(deviceName),
+        _isSink(args.isSink),
+        _interleaved(args.interleaved),
+        _numChans(args.numChans),
+        _sampleType(args.sampleType),
+        _sampleBytes(audioSampleSize(args.sampleType)),
+        _ringFrames(0),
+        _primed(false),
+        _xrun(false),
+        _shutdown(false),
+        _cycleTime(0)
+    {
+        jack_status_t status;
+        _client = jack_client_open(_isSink?"pothos_sink":"pothos_source", JackNoStartServer, &status);
+        if (_client == nullptr) throw Pothos::Exception("JackStream()", "jack_client_open: no JACK server running");
+        try
+        {
+            this->setup(args);
+        }
+        catch (...)
+        {
+            this->cleanup();
+            throw;
+        }
+    }
+
+    ~JackStream(void)
+    {
+        this->cleanup();
+    }
+
+    void start(void)
+    {
+        //the process callback is not running, so the rings can be emptied
+        for (auto ring : _rings) jack_ringbuffer_reset(ring);
+        _primed = false;
+        _xrun = false;
+
+        int err = jack_activate(_client);
+        if (err != 0) throw Pothos::Exception("JackStream::start()", "jack_activate failed");
+
+        //connect the stream ports to the device ports in order
+        const char **ports = jack_get_ports(_client, nullptr, JACK_DEFAULT_AUDIO_TYPE, _isSink?JackPortIsInput:JackPortIsOutput);
+        size_t chan = 0;
+        for (size_t i = 0; ports != nullptr and ports[i] != nullptr and chan < _numChans; i++)
+        {
+            if (jackClientName(ports[i]) != _deviceName) continue;
+            const std::string theirs(ports[i]);
+            const char *ours = jack_port_name(_ports[chan++]);
+            err = _isSink?jack_connect(_client, ours, theirs.c_str()):jack_connect(_client, theirs.c_str(), ours);
+            if (err != 0)
+            {
+                jack_free(ports);
+                throw Pothos::Exception("JackStream::start()", "jack_connect failed: " + theirs);
+            }
+        }
+        if (ports != nullptr) jack_free(ports);
+    }
+
+    void stop(void)
+    {
+        //deactivating also disconnects the ports
+        const int err = jack_deactivate(_client);
+        if (err != 0) throw Pothos::Exception("JackStream::stop()", "jack_deactivate failed");
+    }
+
+    long available(void)
+    {
+        if (_shutdown) return JACK_ERROR_SHUTDOWN;
+        return long(this->ringAvailable());
+    }
+
+    int read(void *buffer, const unsigned long frames)
+    {
+        return this->transfer(buffer, frames);
+    }
+
+    int write(const void *buffer, const unsigned long frames)
+    {
+        _primed = true;
+        return this->transfer(const_cast<void *>(buffer), frames);
+    }
+
+    double time(void)
+    {
+        return jack_get_time()*1e-6;
+    }
+
+    //! The start of the last process cycle, when the last frames entered or left the rings
+    double availableTime(void)
+    {
+        return _cycleTime.load(std::memory_order_acquire)*1e-6;
+    }
+
+    double sampleRate(void)
+    {
+        return jack_get_sample_rate(_client);
+    }
+
+    //! The latency of the connected ports plus the process cycle
+    double latency(void)
+    {
+        jack_latency_range_t range;
+        jack_port_get_latency_range(_ports.front(), _isSink?JackPlaybackLatency:JackCaptureLatency, &range);
+        return double(range.max + jack_get_buffer_size(_client))/jack_get_sample_rate(_client);
+    }
+
+    std::string errorText(const int status)
+    {
+        if (status == AUDIO_XRUN) return _isSink?"Output underflowed":"Input overflowed";
+        if (status == JACK_ERROR_TIMEOUT) return "JACK process callback timed out";
+        if (status == JACK_ERROR_SHUTDOWN) return "JACK server shut down";
+        return "Unknown JACK error " + std::to_string(status);
+    }
+
+private:
+    void setup(const AudioStreamArgs &args)
+    {
+        //the server clock is fixed, JACK clients cannot resample
+        const double rate = jack_get_sample_rate(_client);
+        if (rate != args.sampleRate) throw Pothos::Exception("JackStream()",
+            "JACK server runs at " + std::to_string(rate) + " Sps, requested " + std::to_string(args.sampleRate) + " Sps");
+
+        for (size_t i = 0; i < _numChans; i++)
+        {
+            const auto name = (_isSink?"out_":"in_") + std::to_string(i);
+            jack_port_t *port = jack_port_register(_client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE, _isSink?JackPortIsOutput:JackPortIsInput, 0);
+            if (port == nullptr) throw Pothos::Exception("JackStream()", "jack_port_register failed: " + name);
+            _ports.push_back(port);
+        }
+
+        //whole periods that cover the requested latency
+        const size_t period = jack_get_buffer_size(_client);
+        const size_t periods = std::max(JACK_MIN_PERIODS, size_t(args.latency*rate/period + 0.999));
+        _ringFrames = periods*period;
+        for (size_t i = 0; i < _numChans; i++)
+        {
+            //one spare frame because a full ring holds one byte less than its size
+            jack_ringbuffer_t *ring = jack_ringbuffer_create((_ringFrames+1)*sizeof(float));
+            if (ring == nullptr) throw Pothos::Exception("JackStream()", "jack_ringbuffer_create failed");
+            jack_ringbuffer_mlock(ring);
+            _rings.push_back(ring);
+        }
+
+        jack_set_process_callback(_client, &JackStream::processCallback, this);
+        jack_set_xrun_callback(_client, &JackStream::xrunCallback, this);
+        jack_on_shutdown(_client, &JackStream::shutdownCallback, this);
+    }
+
+    void cleanup(void)
+    {
+        //closing the client stops the callbacks before the rings are freed
+        if (_client != nullptr) jack_client_close(_client);
+        _client = nullptr;
+        for (auto ring : _rings) jack_ringbuffer_free(ring);
+        _rings.clear();
+    }
+
+    /*******************************************************************
+     * Real-time process callback on the JACK thread
+     ******************************************************************/
+    static int processCallback(jack_nframes_t nframes, void *arg)
+    {
+        auto self = static_cast<JackStream *>(arg);
+        if (self->_isSink) self->processOutput(nframes);
+        else self->processInput(nframes);
+
+        self->_cycleTime.store(jack_frames_to_time(self->_client, jack_last_frame_time(self->_client)), std::memory_order_release);
+        self->_handoff.notify();
+        return 0;
+    }
+
+    void processInput(const jack_nframes_t nframes)
+    {
+        //drop the whole cycle when any ring is full to keep the channels aligned
+        const size_t bytes = nframes*sizeof(float);
+        for (auto ring : _rings)
+        {
+            if (jack_ringbuffer_write_space(ring) >= bytes) continue;
+            _xrun = true;
+            return;
+        }
+        for (size_t i = 0; i < _numChans; i++)
+        {
+            const auto buff = (const char *)jack_port_get_buffer(_ports[i], nframes);
+            jack_ringbuffer_write(_rings[i], buff, bytes);
+        }
+    }
+
+    void processOutput(const jack_nframes_t nframes)
+    {
+        //the ports stay silent until the block primes the rings,
+        //then a short ring is padded with silence and counted as an underflow
+        const size_t n = _primed?std::min<size_t>(this->ringReadable(), nframes):0;
+        if (_primed and n < nframes) _xrun = true;
+        for (size_t i = 0; i < _numChans; i++)
+        {
+            const auto buff = (char *)jack_port_get_buffer(_ports[i], nframes);
+            jack_ringbuffer_read(_rings[i], buff, n*sizeof(float));
+            std::memset(buff + n*sizeof(float), 0, (nframes-n)*sizeof(float));
+        }
+    }
+
+    static int xrunCallback(void *arg)
+    {
+        static_cast<JackStream *>(arg)->_xrun = true;
+        return 0;
+    }
+
+    static void shutdownCallback(void *arg)
+    {
+        auto self = static_cast<JackStream *>(arg);
+        self->_shutdown = true;
+        self->_handoff.notify();
+    }
+
+    /*******************************************************************
+     * Ring access from the block thread
+     ******************************************************************/
+    //! The frames that every channel can read
+    size_t ringReadable(void) const
+    {
+        size_t bytes = jack_ringbuffer_read_space(_rings.front());
+        for (auto ring : _rings) bytes = std::min(bytes, jack_ringbuffer_read_space(ring));
+        return bytes/sizeof(float);
+    }
+
+    //! Readable frames for a source, free frames within the ring size for a sink
+    size_t ringAvailable(void) const
+    {
+        if (not _isSink) return this->ringReadable();
+        size_t bytes = 0;
+        for (auto ring : _rings) bytes = std::max(bytes, jack_ringbuffer_read_space(ring));
+        return _ringFrames - std::min(_ringFrames, bytes/sizeof(float));
+    }
+
+    //! Convert between the float ring samples and the Pothos buffer, blocking until all are done
+    int transfer(void *buffer, const unsigned long frames)
+    {
+        const int status = _handoff.transfer(frames, std::chrono::milliseconds(JACK_TIMEOUT_MS), JACK_ERROR_TIMEOUT,
+            [this](void) -> long
+            {
+                if (_shutdown) return JACK_ERROR_SHUTDOWN;
+                return long(this->ringAvailable());
+            },
+            [this, buffer](const size_t offset, const size_t n)
+            {
+                for (size_t c = 0; c < _numChans; c++)
+                {
+                    char *user = _interleaved?
+                        (char *)buffer + (offset*_numChans + c)*_sampleBytes:
+                        ((char **)buffer)[c] + offset*_sampleBytes;
+                    this->transferChannel(_rings[c], user, n);
+                }
+            });
+        if (status < 0) return status;
+        return _xrun.exchange(false)?AUDIO_XRUN:AUDIO_OK;
+    }
+
+    //! Convert frames directly in the two segments of the ring memory
+    void transferChannel(jack_ringbuffer_t *ring, char *user, const size_t frames)
+    {
+        const size_t userStride = _interleaved?_numChans:1;
+        jack_ringbuffer_data_t vec[2];
+        if (_isSink) jack_ringbuffer_get_write_vector(ring, vec);
+        else jack_ringbuffer_get_read_vector(ring, vec);
+
+        size_t remaining = frames;
+        for (size_t v = 0; v < 2 and remaining != 0; v++)
+        {
+            const size_t n = std::min(remaining, vec[v].len/sizeof(float));
+            if (_isSink) audioConvert(user, _sampleType, userStride, vec[v].buf, AUDIO_FLOAT32, 1, n);
+            else audioConvert(vec[v].buf, AUDIO_FLOAT32, 1, user, _sampleType, userStride, n);
+            user += n*userStride*_sampleBytes;
+            remaining -= n;
+        }
+
+        if (_isSink) jack_ringbuffer_write_advance(ring, frames*sizeof(float));
+        else jack_ringbuffer_read_advance(ring, frames*sizeof(float));
+    }
+
+    jack_client_t *_client;
+    const std::string _deviceName;
+    const bool _isSink;
+    const bool _interleaved;
+    const size_t _numChans;
+    const AudioSampleType _sampleType;
+    const size_t _sampleBytes;
+    size_t _ringFrames;
+    std::vector<jack_port_t *> _ports;
+    std::vector<jack_ringbuffer_t *> _rings;
+
+    //shared with the process callback
+    std::atomic<bool> _primed;
+    std::atomic<bool> _xrun;
+    std::atomic<bool> _shutdown;
+    std::atomic<jack_time_t> _cycleTime;
+    AudioHandoff _handoff;
+};
+
+/***********************************************************************
+ * JACK backend
+ **********************************************************************/
+class JackBackend : public AudioBackend
+{
+public:
+    std::vector<AudioDeviceInfo> devices(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_devices.empty()) this->enumerate();
+        return _devices;
+    }
+
+    //! The client that owns the first physical port, usually "system"
+    int defaultDevice(const bool isSink)
+    {
+        const auto devices = this->devices();
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            if (devices[i].name == (isSink?_defaultPlayback:_defaultCapture)) return int(i);
+        }
+        return devices.empty()?-1:0;
+    }
+
+    //! Clients come and go with the graph, so look again before giving up
+    int lookupDevice(const std::string &name)
+    {
+        const int index = AudioBackend::lookupDevice(name);
+        if (index >= 0) return index;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            this->enumerate();
+        }
+        return AudioBackend::lookupDevice(name);
+    }
+
+    std::unique_ptr<AudioStream> open(const AudioStreamArgs &args)
+    {
+        const auto devices = this->devices();
+        if (args.device < 0 or args.device >= int(devices.size())) throw Pothos::RangeException(
+            "JackBackend::open()", "Device index out of range");
+        return std::unique_ptr<AudioStream>(new JackStream(devices[args.device].name, args));
+    }
+
+private:
+    //! Group the audio ports of the graph by client with a short-lived client
+    void enumerate(void)
+    {
+        _devices.clear();
+        jack_status_t status;
+        jack_client_t *client = jack_client_open("pothos_probe", JackNoStartServer, &status);
+        if (client == nullptr) return;
+
+        const double rate = jack_get_sample_rate(client);
+        const double period = jack_get_buffer_size(client)/rate;
+        std::map<std::string, size_t> indexes;
+        const char **ports = jack_get_ports(client, nullptr, JACK_DEFAULT_AUDIO_TYPE, 0);
+        for (size_t i = 0; ports != nullptr and ports[i] != nullptr; i++)
+        {
+            const auto name = jackClientName(ports[i]);
+            if (indexes.count(name) == 0)
+            {
+                indexes[name] = _devices.size();
+                AudioDeviceInfo device;
+                device.name = name;
+                device.hostApi = "JACK";
+                device.maxInputChannels = device.maxOutputChannels = 0;
+                device.defaultSampleRate = rate;
+                device.defaultLowInputLatency = device.defaultLowOutputLatency = period*JACK_MIN_PERIODS;
+                device.defaultHighInputLatency = device.defaultHighOutputLatency = period*JACK_MIN_PERIODS*2;
+                _devices.push_back(device);
+            }
+
+            //capture from the output ports of a client, play to its input ports
+            auto &device = _devices[indexes[name]];
+            const int flags = jack_port_flags(jack_port_by_name(client, ports[i]));
+            if ((flags & JackPortIsOutput) != 0) device.maxInputChannels++;
+            if ((flags & JackPortIsInput) != 0) device.maxOutputChannels++;
+            if ((flags & JackPortIsPhysical) != 0 and (flags & JackPortIsOutput) != 0 and _defaultCapture.empty()) _defaultCapture = name;
+            if ((flags & JackPortIsPhysical) != 0 and (flags & JackPortIsInput) != 0 and _defaultPlayback.empty()) _defaultPlayback = name;
+        }
+        if (ports != nullptr) jack_free(ports);
+        jack_client_close(client);
+    }
+
+    std::mutex _mutex;
+    std::vector<AudioDeviceInfo> _devices;
+    std::string _defaultCapture;
+    std::string _defaultPlayback;
+};
+
+static std::shared_ptr<AudioBackend> makeJackBackend(void)
+{
+    return std::shared_ptr<AudioBackend>(new JackBackend());
+}
+
+pothos_static_block(registerJackBackend)
+{
+    Pothos::PluginRegistry::add("/audio/backends/jack", Pothos::Callable(&makeJackBackend));
+}
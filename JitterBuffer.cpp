@@ -0,0 +1,276 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "JitterBuffer.hpp"
+#include <algorithm> //min/max
+#include <cstring> //memcpy
+#include <cmath>
+
+//the number of arrivals used to measure the lateness spread
+static const size_t LATENESS_HISTORY = 128;
+
+//the minimum output between adjustments, in multiples of the adjustment,
+//this limits the time-scale change to about 5 percent
+static const size_t HOLDOFF_FACTOR = 20;
+
+JitterBuffer::JitterBuffer(const size_t numChans, const double sampleRate, const size_t maxFrames):
+    _numChans(numChans),
+    _sampleRate(sampleRate),
+    _maxFrames(std::max(maxFrames, 2*(size_t(sampleRate*0.015)+size_t(sampleRate*0.010)))),
+    _overlap(size_t(sampleRate*0.010)),
+    _minLag(size_t(sampleRate*0.0025)),
+    _maxLag(size_t(sampleRate*0.015)),
+    _margin(size_t(sampleRate*0.005)),
+    _fifo(2*_maxFrames*numChans),
+    _splice((_maxLag+_overlap)*numChans),
+    _mono(_maxLag+_overlap),
+    _lateness(LATENESS_HISTORY)
+{
+    this->reset();
+}
+
+void JitterBuffer::reset(void)
+{
+    _head = 0;
+    _tail = 0;
+    _spliceOffset = 0;
+    _spliceFrames = 0;
+    _latenessIndex = 0;
+    _numArrivals = 0;
+    _firstArrival = 0.0;
+    _lastArrival = 0.0;
+    _lastFrames = 0;
+    _framesArrived = 0.0;
+    _jitter = 0.0;
+    _targetDepth = _margin;
+    _startDepth = _margin;
+    _depthAvg = 0.0;
+    _holdoff = 0;
+    _buffering = true;
+    _numAccelerate = 0;
+    _numExpand = 0;
+    _numUnderflows = 0;
+    _numDroppedFrames = 0;
+}
+
+size_t JitterBuffer::maxFrames(void) const
+{
+    return _maxFrames;
+}
+
+size_t JitterBuffer::depth(void) const
+{
+    return (_tail - _head) + (_spliceFrames - _spliceOffset);
+}
+
+float *JitterBuffer::pushBegin(const size_t numFrames)
+{
+    //drop the oldest frames to make room
+    const size_t used = _tail - _head;
+    if (used + numFrames > _maxFrames)
+    {
+        const size_t numDrop = std::min(used, used + numFrames - _maxFrames);
+        this->consume(numDrop);
+        _numDroppedFrames += numDrop;
+    }
+
+    //move the contents to the front of the storage
+    if (_tail + numFrames > 2*_maxFrames)
+    {
+        std::memmove(_fifo.data(), _fifo.data()+_head*_numChans, (_tail-_head)*_numChans*sizeof(float));
+        _tail -= _head;
+        _head = 0;
+    }
+
+    return _fifo.data()+_tail*_numChans;
+}
+
+void JitterBuffer::pushCommit(const size_t numFrames, const double arrivalTime)
+{
+    //smooth the depth seen just before the arrival
+    const double preDepth = double(this->depth());
+    if (_numArrivals == 0) _depthAvg = preDepth;
+    else _depthAvg += (preDepth - _depthAvg)/8;
+
+    _tail += numFrames;
+    this->updateTarget(numFrames, arrivalTime);
+}
+
+void JitterBuffer::updateTarget(const size_t numFrames, const double arrivalTime)
+{
+    if (_numArrivals == 0)
+    {
+        _firstArrival = arrivalTime;
+        _framesArrived = 0.0;
+    }
+    else
+    {
+        //RFC 3550 inter-arrival jitter, the expected spacing is the previous burst duration
+        const double d = (arrivalTime - _lastArrival) - _lastFrames/_sampleRate;
+        _jitter += (std::abs(d) - _jitter)/16;
+    }
+
+    //lateness of this arrival against the sample clock
+    const double lateness = (arrivalTime - _firstArrival) - _framesArrived/_sampleRate;
+    _lateness[_latenessIndex] = lateness;
+    _latenessIndex = (_latenessIndex + 1) % _lateness.size();
+    _numArrivals++;
+    _framesArrived += numFrames;
+    _lastArrival = arrivalTime;
+    _lastFrames = numFrames;
+
+    //the target covers the peak to peak lateness in the history window
+    const auto end = _lateness.begin() + std::min(_numArrivals, _lateness.size());
+    const auto range = std::minmax_element(_lateness.begin(), end);
+    const double spread = *range.second - *range.first;
+    _targetDepth = std::min(size_t(spread*_sampleRate) + _margin, _maxFrames/2);
+
+    //after running empty, restart once the target and one more burst are held
+    _startDepth = std::min(_targetDepth + numFrames, _maxFrames);
+}
+
+size_t JitterBuffer::pull(float *out, const size_t numFrames)
+{
+    if (_buffering)
+    {
+        if (_numArrivals == 0 or this->depth() < _startDepth) return 0;
+        _buffering = false;
+    }
+
+    size_t produced = 0;
+    while (produced < numFrames)
+    {
+        //drain the output of the last adjustment
+        if (_spliceOffset < _spliceFrames)
+        {
+            const size_t n = std::min(numFrames - produced, _spliceFrames - _spliceOffset);
+            std::memcpy(out+produced*_numChans, _splice.data()+_spliceOffset*_numChans, n*_numChans*sizeof(float));
+            _spliceOffset += n;
+            produced += n;
+            continue;
+        }
+
+        const size_t available = _tail - _head;
+        if (available == 0)
+        {
+            _buffering = true;
+            _numUnderflows++;
+            break;
+        }
+
+        if (_holdoff == 0)
+        {
+            this->adjust();
+            if (_spliceOffset < _spliceFrames) continue;
+        }
+
+        //pass-through without adjustment
+        const size_t n = std::min(numFrames - produced, available);
+        std::memcpy(out+produced*_numChans, _fifo.data()+_head*_numChans, n*_numChans*sizeof(float));
+        this->consume(n);
+        produced += n;
+        _holdoff -= std::min(_holdoff, n);
+    }
+
+    return produced;
+}
+
+void JitterBuffer::adjust(void)
+{
+    if (_tail - _head < _maxLag + _overlap) return;
+
+    //hysteresis around the target depth
+    const double lower = double(_targetDepth - _targetDepth/4);
+    const double upper = double(_targetDepth + std::max(_targetDepth/2, 2*_margin));
+    const bool accelerate = _depthAvg > upper;
+    const bool expand = _depthAvg < lower;
+    if (not accelerate and not expand) return;
+
+    const size_t lag = this->bestLag();
+    const float *x = _fifo.data()+_head*_numChans;
+    float *out = _splice.data();
+    const size_t C = _numChans;
+
+    if (accelerate)
+    {
+        //cross-fade from x[0, W) into x[lag, lag+W), skipping one period
+        for (size_t i = 0; i < _overlap; i++)
+        {
+            const float w = (i+0.5f)/_overlap;
+            for (size_t c = 0; c < C; c++)
+            {
+                out[i*C+c] = x[i*C+c]*(1.0f-w) + x[(lag+i)*C+c]*w;
+            }
+        }
+        _spliceFrames = _overlap;
+        this->consume(_overlap+lag);
+        _depthAvg -= lag;
+        _numAccelerate++;
+    }
+    else
+    {
+        //play x[0, lag), then cross-fade from x[lag, lag+W) back into x[0, W),
+        //so the period is repeated and playback continues from x[W]
+        std::memcpy(out, x, lag*C*sizeof(float));
+        for (size_t i = 0; i < _overlap; i++)
+        {
+            const float w = (i+0.5f)/_overlap;
+            for (size_t c = 0; c < C; c++)
+            {
+                out[(lag+i)*C+c] = x[(lag+i)*C+c]*(1.0f-w) + x[i*C+c]*w;
+            }
+        }
+        _spliceFrames = lag+_overlap;
+        this->consume(_overlap);
+        _depthAvg += lag;
+        _numExpand++;
+    }
+
+    _spliceOffset = 0;
+    _holdoff = HOLDOFF_FACTOR*lag;
+}
+
+size_t JitterBuffer::bestLag(void)
+{
+    //mono downmix of the search region
+    const float *x = _fifo.data()+_head*_numChans;
+    for (size_t i = 0; i < _mono.size(); i++)
+    {
+        float sum = 0.0f;
+        for (size_t c = 0; c < _numChans; c++) sum += x[i*_numChans+c];
+        _mono[i] = sum;
+    }
+
+    //energy of the reference segment and the first candidate
+    const float *m = _mono.data();
+    double refEnergy = 0.0, candEnergy = 0.0;
+    for (size_t i = 0; i < _overlap; i++)
+    {
+        refEnergy += m[i]*m[i];
+        candEnergy += m[_minLag+i]*m[_minLag+i];
+    }
+
+    //the lag with the maximum normalized correlation
+    size_t bestLag = _minLag;
+    double bestCorr = -2.0;
+    for (size_t lag = _minLag; lag <= _maxLag; lag++)
+    {
+        double corr = 0.0;
+        for (size_t i = 0; i < _overlap; i++) corr += m[i]*m[lag+i];
+        corr /= std::sqrt(refEnergy*candEnergy) + 1e-12;
+        if (corr > bestCorr)
+        {
+            bestCorr = corr;
+            bestLag = lag;
+        }
+        if (lag == _maxLag) break;
+        candEnergy += m[lag+_overlap]*m[lag+_overlap] - m[lag]*m[lag];
+    }
+    return bestLag;
+}
+
+void JitterBuffer::consume(const size_t numFrames)
+{
+    _head += numFrames;
+    if (_head == _tail) _head = _tail = 0;
+}
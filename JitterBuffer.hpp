@@ -0,0 +1,140 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <vector>
+#include <cstddef>
+
+/*!
+ * An adaptive jitter buffer for interleaved float audio.
+ *
+ * The buffer records the arrival time of every burst of frames,
+ * and measures the spread of arrival lateness against the sample clock.
+ * The target depth is set from the spread, and the depth measured just
+ * before each arrival converges to that target by time-scale modification:
+ * a pitch period is removed (accelerate) or repeated (expand)
+ * at the lag of maximum correlation with a short cross-fade.
+ * Frames are only dropped when the maximum depth is exceeded.
+ *
+ * All storage is allocated in the constructor.
+ */
+class JitterBuffer
+{
+public:
+    JitterBuffer(const size_t numChans, const double sampleRate, const size_t maxFrames);
+
+    //! Discard all samples and arrival history
+    void reset(void);
+
+    //! The maximum number of frames held in the buffer
+    size_t maxFrames(void) const;
+
+    /*!
+     * Get space at the tail of the buffer for incoming frames.
+     * The oldest frames are dropped when the buffer would overflow.
+     * \param numFrames the number of frames to write (at most maxFrames())
+     * \return a pointer to write numFrames interleaved frames
+     */
+    float *pushBegin(const size_t numFrames);
+
+    /*!
+     * Commit frames written after pushBegin() and record the arrival.
+     * \param numFrames the number of frames written
+     * \param arrivalTime the arrival time in seconds on a monotonic clock
+     */
+    void pushCommit(const size_t numFrames, const double arrivalTime);
+
+    /*!
+     * Read frames out of the buffer with time-scale adjustments.
+     * Nothing is output after the buffer runs empty
+     * until the buffer has filled back up to the target depth.
+     * \param out the interleaved output frames
+     * \param numFrames the maximum number of frames to read
+     * \return the number of frames written to out
+     */
+    size_t pull(float *out, const size_t numFrames);
+
+    //! The number of frames held in the buffer
+    size_t depth(void) const;
+
+    //! The current target depth in frames
+    size_t targetDepth(void) const
+    {
+        return _targetDepth;
+    }
+
+    //! The smoothed inter-arrival jitter in seconds (RFC 3550 estimator)
+    double jitter(void) const
+    {
+        return _jitter;
+    }
+
+    size_t numAccelerate(void) const
+    {
+        return _numAccelerate;
+    }
+
+    size_t numExpand(void) const
+    {
+        return _numExpand;
+    }
+
+    size_t numUnderflows(void) const
+    {
+        return _numUnderflows;
+    }
+
+    size_t numDroppedFrames(void) const
+    {
+        return _numDroppedFrames;
+    }
+
+private:
+    void updateTarget(const size_t numFrames, const double arrivalTime);
+    void adjust(void);
+    size_t bestLag(void);
+    void consume(const size_t numFrames);
+
+    const size_t _numChans;
+    const double _sampleRate;
+    const size_t _maxFrames;
+
+    //time-scale modification parameters in frames
+    const size_t _overlap;
+    const size_t _minLag;
+    const size_t _maxLag;
+    const size_t _margin;
+
+    //linear sample storage, compacted when the head passes the midpoint
+    std::vector<float> _fifo;
+    size_t _head;
+    size_t _tail;
+
+    //output of the last time-scale operation, drained before the fifo
+    std::vector<float> _splice;
+    size_t _spliceOffset;
+    size_t _spliceFrames;
+    std::vector<float> _mono;
+
+    //arrival history
+    std::vector<double> _lateness;
+    size_t _latenessIndex;
+    size_t _numArrivals;
+    double _firstArrival;
+    double _lastArrival;
+    size_t _lastFrames;
+    double _framesArrived;
+    double _jitter;
+
+    //depth control
+    size_t _targetDepth;
+    size_t _startDepth;
+    double _depthAvg;
+    size_t _holdoff;
+    bool _buffering;
+
+    size_t _numAccelerate;
+    size_t _numExpand;
+    size_t _numUnderflows;
+    size_t _numDroppedFrames;
+};
@@ -0,0 +1,97 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <json.hpp>
+#include <algorithm> //min/max
+#include <array>
+#include <cmath>
+
+/*!
+ * A histogram of durations in fixed log-scale buckets.
+ * Bucket 0 counts values under 1 us and bucket i counts [2^(i-1), 2^i) us,
+ * the last bucket also counts everything longer. Negative values are
+ * counted separately. Adding a value never allocates.
+ */
+class LogHistogram
+{
+public:
+    static const size_t NUM_BUCKETS = 26;
+
+    LogHistogram(void)
+    {
+        this->reset();
+    }
+
+    void reset(void)
+    {
+        _buckets.fill(0);
+        _numNegative = 0;
+        _count = 0;
+        _min = 0.0;
+        _max = 0.0;
+        _sum = 0.0;
+    }
+
+    //! Add a duration in seconds
+    void add(const double seconds)
+    {
+        const double us = seconds*1e6;
+        if (_count == 0) _min = _max = us;
+        _min = std::min(_min, us);
+        _max = std::max(_max, us);
+        _sum += us;
+        _count++;
+        if (us < 0.0) _numNegative++;
+        else _buckets[this->bucketIndex(us)]++;
+    }
+
+    unsigned long long count(void) const
+    {
+        return _count;
+    }
+
+    //! The upper edge in us of the bucket that holds the given fraction of the values
+    double percentile(const double fraction) const
+    {
+        const unsigned long long target = (unsigned long long)std::ceil(fraction*_count);
+        unsigned long long total = _numNegative;
+        if (total >= target) return 0.0;
+        for (size_t i = 0; i < NUM_BUCKETS; i++)
+        {
+            total += _buckets[i];
+            if (total >= target) return std::min(_max, std::ldexp(1.0, int(i)));
+        }
+        return _max;
+    }
+
+    nlohmann::json toJson(void) const
+    {
+        nlohmann::json out;
+        out["count"] = _count;
+        out["minUs"] = _min;
+        out["maxUs"] = _max;
+        out["meanUs"] = (_count == 0)?0.0:(_sum/_count);
+        out["negative"] = _numNegative;
+        auto buckets = nlohmann::json::array();
+        for (size_t i = 0; i < NUM_BUCKETS; i++) buckets.push_back(_buckets[i]);
+        out["buckets"] = buckets;
+        return out;
+    }
+
+private:
+    static size_t bucketIndex(const double us)
+    {
+        if (us < 1.0) return 0;
+        int exp = 0;
+        std::frexp(us, &exp); //us = m*2^exp, m in [0.5, 1)
+        return std::min<size_t>(size_t(exp), NUM_BUCKETS-1);
+    }
+
+    std::array<unsigned long long, NUM_BUCKETS> _buckets;
+    unsigned long long _numNegative;
+    unsigned long long _count;
+    double _min;
+    double _max;
+    double _sum;
+};
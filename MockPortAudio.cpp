@@ -0,0 +1,899 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "MockPortAudio.hpp"
+#include "TimingTrace.hpp"
+#include <portaudio.h>
+#include <json.hpp>
+#include <algorithm> //min/max
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib> //getenv
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+using json = nlohmann::json;
+
+/***********************************************************************
+ * Configuration
+ **********************************************************************/
+MockAudioDevice::MockAudioDevice(void):
+    name("Mock Audio Device"),
+    maxInputChannels(2),
+    maxOutputChannels(2),
+    defaultSampleRate(48000.0),
+    rateErrorPpm(0.0),
+    bufferFrames(4096),
+    periodFrames(256),
+    latency(0.01),
+    jitter(0.0),
+    xrunRate(0.0)
+{
+    return;
+}
+
+MockAudioFault::MockAudioFault(void):
+    type(MOCK_FAULT_XRUN),
+    time(0.0),
+    duration(0.0)
+{
+    return;
+}
+
+MockAudioConfig::MockAudioConfig(void):
+    devices(1),
+    clock(MOCK_CLOCK_REALTIME),
+    seed(0)
+{
+    return;
+}
+
+MockAudioConfig mockAudioConfigFromJson(const std::string &jsonText)
+{
+    const auto top = json::parse(jsonText);
+    MockAudioConfig config;
+    if (top.count("clock") != 0) config.clock = (top["clock"].get<std::string>() == "VIRTUAL")?MOCK_CLOCK_VIRTUAL:MOCK_CLOCK_REALTIME;
+    if (top.count("seed") != 0) config.seed = top["seed"].get<unsigned>();
+    if (top.count("devices") != 0)
+    {
+        config.devices.clear();
+        for (const auto &d : top["devices"])
+        {
+            MockAudioDevice device;
+            if (d.count("name") != 0) device.name = d["name"].get<std::string>();
+            if (d.count("inputs") != 0) device.maxInputChannels = d["inputs"].get<int>();
+            if (d.count("outputs") != 0) device.maxOutputChannels = d["outputs"].get<int>();
+            if (d.count("rate") != 0) device.defaultSampleRate = d["rate"].get<double>();
+            if (d.count("rates") != 0) device.sampleRates = d["rates"].get<std::vector<double>>();
+            if (d.count("ppm") != 0) device.rateErrorPpm = d["ppm"].get<double>();
+            if (d.count("bufferFrames") != 0) device.bufferFrames = d["bufferFrames"].get<unsigned long>();
+            if (d.count("periodFrames") != 0) device.periodFrames = d["periodFrames"].get<unsigned long>();
+            if (d.count("latency") != 0) device.latency = d["latency"].get<double>();
+            if (d.count("jitter") != 0) device.jitter = d["jitter"].get<double>();
+            if (d.count("xrunRate") != 0) device.xrunRate = d["xrunRate"].get<double>();
+            if (d.count("replay") != 0) device.replay = d["replay"].get<std::string>();
+            if (d.count("faults") != 0) for (const auto &f : d["faults"])
+            {
+                MockAudioFault fault;
+                const auto type = f.value("type", std::string("XRUN"));
+                if (type == "XRUN") fault.type = MOCK_FAULT_XRUN;
+                else if (type == "ERROR") fault.type = MOCK_FAULT_ERROR;
+                else throw std::invalid_argument("mockAudioConfigFromJson: unknown fault type " + type);
+                fault.time = f.value("time", 0.0);
+                fault.duration = f.value("duration", 0.0);
+                device.faults.push_back(fault);
+            }
+            config.devices.push_back(device);
+        }
+    }
+    return config;
+}
+
+/***********************************************************************
+ * Global state
+ **********************************************************************/
+struct MockAudioState
+{
+    MockAudioState(void):
+        initCount(0),
+        configured(false),
+        numReads(0),
+        numWrites(0),
+        framesRead(0),
+        framesWritten(0),
+        numOverflows(0),
+        numUnderflows(0),
+        numBlockingWaits(0),
+        readLatencyNs(0),
+        maxReadLatencyNs(0),
+        framesDropped(0),
+        numErrors(0),
+        lastXrunNs(0)
+    {
+        this->setConfig(MockAudioConfig());
+    }
+
+    void setConfig(const MockAudioConfig &newConfig)
+    {
+        config = newConfig;
+        deviceInfos.clear();
+        for (const auto &device : config.devices)
+        {
+            PaDeviceInfo info;
+            std::memset(&info, 0, sizeof(info));
+            info.structVersion = 2;
+            info.name = device.name.c_str();
+            info.hostApi = 0;
+            info.maxInputChannels = device.maxInputChannels;
+            info.maxOutputChannels = device.maxOutputChannels;
+            info.defaultLowInputLatency = device.latency;
+            info.defaultLowOutputLatency = device.latency;
+            info.defaultHighInputLatency = device.latency;
+            info.defaultHighOutputLatency = device.latency;
+            info.defaultSampleRate = device.defaultSampleRate;
+            deviceInfos.push_back(info);
+        }
+
+        std::memset(&hostApiInfo, 0, sizeof(hostApiInfo));
+        hostApiInfo.structVersion = 1;
+        hostApiInfo.type = 0; //paInDevelopment
+        hostApiInfo.name = "Mock";
+        hostApiInfo.deviceCount = int(config.devices.size());
+        hostApiInfo.defaultInputDevice = paNoDevice;
+        hostApiInfo.defaultOutputDevice = paNoDevice;
+        for (size_t i = config.devices.size(); i > 0; i--)
+        {
+            if (config.devices[i-1].maxInputChannels > 0) hostApiInfo.defaultInputDevice = PaDeviceIndex(i-1);
+            if (config.devices[i-1].maxOutputChannels > 0) hostApiInfo.defaultOutputDevice = PaDeviceIndex(i-1);
+        }
+    }
+
+    std::mutex mutex;
+    int initCount;
+    bool configured;
+    MockAudioConfig config;
+    std::vector<PaDeviceInfo> deviceInfos;
+    PaHostApiInfo hostApiInfo;
+
+    std::atomic<unsigned long long> numReads;
+    std::atomic<unsigned long long> numWrites;
+    std::atomic<unsigned long long> framesRead;
+    std::atomic<unsigned long long> framesWritten;
+    std::atomic<unsigned long long> numOverflows;
+    std::atomic<unsigned long long> numUnderflows;
+    std::atomic<unsigned long long> numBlockingWaits;
+    std::atomic<unsigned long long> readLatencyNs;
+    std::atomic<unsigned long long> maxReadLatencyNs;
+    std::atomic<unsigned long long> framesDropped;
+    std::atomic<unsigned long long> numErrors;
+    std::atomic<unsigned long long> lastXrunNs;
+};
+
+static MockAudioState &mockState(void)
+{
+    static MockAudioState state;
+    return state;
+}
+
+void mockAudioConfigure(const MockAudioConfig &config)
+{
+    auto &state = mockState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.setConfig(config);
+    state.configured = true;
+}
+
+MockAudioStats mockAudioGetStats(void)
+{
+    auto &state = mockState();
+    MockAudioStats stats;
+    stats.numReads = state.numReads;
+    stats.numWrites = state.numWrites;
+    stats.framesRead = state.framesRead;
+    stats.framesWritten = state.framesWritten;
+    stats.numOverflows = state.numOverflows;
+    stats.numUnderflows = state.numUnderflows;
+    stats.numBlockingWaits = state.numBlockingWaits;
+    stats.readLatencyNs = state.readLatencyNs;
+    stats.maxReadLatencyNs = state.maxReadLatencyNs;
+    stats.framesDropped = state.framesDropped;
+    stats.numErrors = state.numErrors;
+    stats.lastXrunTime = state.lastXrunNs/1e9;
+    return stats;
+}
+
+void mockAudioResetStats(void)
+{
+    auto &state = mockState();
+    state.numReads = 0;
+    state.numWrites = 0;
+    state.framesRead = 0;
+    state.framesWritten = 0;
+    state.numOverflows = 0;
+    state.numUnderflows = 0;
+    state.numBlockingWaits = 0;
+    state.readLatencyNs = 0;
+    state.maxReadLatencyNs = 0;
+    state.framesDropped = 0;
+    state.numErrors = 0;
+    state.lastXrunNs = 0;
+}
+
+/***********************************************************************
+ * Simulated stream on a device clock
+ **********************************************************************/
+static size_t mockSampleSize(const PaSampleFormat format)
+{
+    switch (format & ~paNonInterleaved)
+    {
+    case paFloat32: return 4;
+    case paInt32: return 4;
+    case paInt24: return 3;
+    case paInt16: return 2;
+    case paInt8: return 1;
+    case paUInt8: return 1;
+    default: return 0;
+    }
+}
+
+static void mockStoreSample(char *out, const PaSampleFormat format, const float x)
+{
+    switch (format & ~paNonInterleaved)
+    {
+    case paFloat32: std::memcpy(out, &x, 4); return;
+    case paInt32: {const int32_t v = int32_t(x*2147483647.0); std::memcpy(out, &v, 4); return;}
+    case paInt24: {const int32_t v = int32_t(x*8388607.0f); out[0] = char(v); out[1] = char(v >> 8); out[2] = char(v >> 16); return;}
+    case paInt16: {const int16_t v = int16_t(x*32767.0f); std::memcpy(out, &v, 2); return;}
+    case paInt8: *out = char(int8_t(x*127.0f)); return;
+    case paUInt8: *out = char(uint8_t(x*127.0f + 128.0f)); return;
+    }
+}
+
+class MockStream
+{
+public:
+    MockStream(const MockAudioDevice &device, const PaStreamParameters &params,
+        const bool isInput, const double rate, const MockAudioClock clock, const unsigned seed):
+        _device(device),
+        _isInput(isInput),
+        _numChans(size_t(params.channelCount)),
+        _format(params.sampleFormat),
+        _sampleSize(mockSampleSize(params.sampleFormat)),
+        _rate(rate),
+        _clock(clock),
+        _running(false),
+        _primed(false),
+        _virtualNow(0.0),
+        _periodTime(device.periodFrames/(rate*(1.0 + device.rateErrorPpm*1e-6))),
+        _devicePeriods(0),
+        _nextPeriodTime(0.0),
+        _clientCount(0),
+        _xrun(false),
+        _faults(device.faults),
+        _nextFault(0),
+        _replayIndex(0),
+        _replaying(false),
+        _rng(seed),
+        _phase(0.0)
+    {
+        TimingTraceHeader header;
+        if (not device.replay.empty()) _replayOk = timingTraceLoad(device.replay, header, _replay);
+        else _replayOk = true;
+        std::sort(_faults.begin(), _faults.end(), [](const MockAudioFault &a, const MockAudioFault &b){return a.time < b.time;});
+        std::memset(&_info, 0, sizeof(_info));
+        _info.structVersion = 1;
+        _info.inputLatency = isInput?device.latency:0.0;
+        _info.outputLatency = isInput?0.0:device.latency;
+        _info.sampleRate = rate;
+    }
+
+    const PaStreamInfo *info(void) const
+    {
+        return &_info;
+    }
+
+    //! False when the replay trace of the device could not be loaded
+    bool replayOk(void) const
+    {
+        return _replayOk;
+    }
+
+    PaError start(void)
+    {
+        if (_running) return paStreamIsNotStopped;
+        _running = true;
+        _startTime = std::chrono::steady_clock::now();
+        _virtualNow = 0.0;
+        this->restartClock(0.0);
+        _clientCount = 0;
+        _xrun = false;
+        _nextFault = 0;
+        _replayIndex = 0;
+        _replaying = not _replay.empty();
+        //an output device starts consuming with the first write
+        _primed = _isInput;
+        return paNoError;
+    }
+
+    PaError stop(void)
+    {
+        if (not _running) return paStreamIsStopped;
+        _running = false;
+        return paNoError;
+    }
+
+    double now(void) const
+    {
+        if (_clock == MOCK_CLOCK_VIRTUAL) return _virtualNow;
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+    }
+
+    signed long readAvailable(void)
+    {
+        if (not _isInput) return paCanNotReadFromAnOutputOnlyStream;
+        const auto event = this->nextReplay(TIMING_TRACE_AVAILABLE);
+        if (event != nullptr) return event->value;
+        this->advanceTo(this->now());
+        return long(this->deviceFrames() - _clientCount);
+    }
+
+    signed long writeAvailable(void)
+    {
+        if (_isInput) return paCanNotWriteToAnInputOnlyStream;
+        const auto event = this->nextReplay(TIMING_TRACE_AVAILABLE);
+        if (event != nullptr) return event->value;
+        this->advanceTo(this->now());
+        return long(_device.bufferFrames - (_clientCount - this->deviceFrames()));
+    }
+
+    PaError read(void *buffer, const unsigned long frames)
+    {
+        if (not _isInput) return paCanNotReadFromAnOutputOnlyStream;
+        if (not _running) return paStreamIsStopped;
+        auto &state = mockState();
+        state.numReads++;
+        if (this->inErrorFault()) return this->failCall(frames);
+
+        //the recorded read returns at the recorded time with the recorded flags
+        const auto event = this->nextReplay(TIMING_TRACE_IO);
+        if (event != nullptr)
+        {
+            this->fillTone(buffer, 0, frames);
+            state.framesRead += frames;
+            if (event->value == TIMING_TRACE_XRUN) this->flagXrun(event->endTime);
+            _xrun = false;
+            return (event->value == TIMING_TRACE_XRUN)?paInputOverflowed:event->value;
+        }
+        this->recordReadLatency();
+
+        unsigned long done = 0;
+        while (done < frames)
+        {
+            //wait for the device to capture the next chunk
+            const unsigned long n = std::min<unsigned long>(frames - done, _device.bufferFrames);
+            this->advanceTo(this->now());
+            if (this->deviceFrames() - _clientCount < n) state.numBlockingWaits++;
+            while (this->deviceFrames() - _clientCount < n) this->waitNextPeriod();
+
+            this->fillTone(buffer, done, n);
+            _clientCount += n;
+            done += n;
+        }
+
+        state.framesRead += frames;
+        return this->takeXrun(paInputOverflowed);
+    }
+
+    PaError write(const void *buffer, const unsigned long frames)
+    {
+        if (_isInput) return paCanNotWriteToAnInputOnlyStream;
+        if (not _running) return paStreamIsStopped;
+        auto &state = mockState();
+        state.numWrites++;
+        (void)buffer; //samples are consumed by the simulated device
+        if (this->inErrorFault()) return this->failCall(frames);
+
+        //the recorded write returns at the recorded time with the recorded flags
+        const auto event = this->nextReplay(TIMING_TRACE_IO);
+        if (event != nullptr)
+        {
+            state.framesWritten += frames;
+            if (event->value == TIMING_TRACE_XRUN) this->flagXrun(event->endTime);
+            _xrun = false;
+            return (event->value == TIMING_TRACE_XRUN)?paOutputUnderflowed:event->value;
+        }
+
+        if (not _primed)
+        {
+            _primed = true;
+            this->restartClock(this->now());
+        }
+
+        unsigned long done = 0;
+        while (done < frames)
+        {
+            //wait for the device to make room for the next chunk
+            const unsigned long n = std::min<unsigned long>(frames - done, _device.bufferFrames);
+            this->advanceTo(this->now());
+            if (this->writeSpace() < n) state.numBlockingWaits++;
+            while (this->writeSpace() < n) this->waitNextPeriod();
+            _clientCount += n;
+            done += n;
+        }
+
+        state.framesWritten += frames;
+        return this->takeXrun(paOutputUnderflowed);
+    }
+
+private:
+    //! A test tone at half scale in every channel
+    void fillTone(void *buffer, const size_t offset, const size_t num)
+    {
+        const double step = 2*3.14159265358979323846*1000.0/_rate;
+        for (size_t i = 0; i < num; i++)
+        {
+            const float x = float(0.5*std::sin(_phase));
+            _phase = std::fmod(_phase + step, 2*3.14159265358979323846);
+            for (size_t c = 0; c < _numChans; c++) mockStoreSample(this->sampleAt(buffer, offset + i, c), _format, x);
+        }
+    }
+
+    /*!
+     * The next recorded event of the given type, after waiting for its time.
+     * Events of the other type are skipped, so a replay survives small
+     * changes to the call sequence. At the end of the trace the stream
+     * continues as a simulated device and nullptr is returned.
+     */
+    const TimingTraceEvent *nextReplay(const int32_t type)
+    {
+        if (not _replaying) return nullptr;
+        while (_replayIndex < _replay.size())
+        {
+            const auto &event = _replay[_replayIndex++];
+            if (event.type != type) continue;
+            this->waitUntil(event.endTime);
+            return &event;
+        }
+
+        _replaying = false;
+        _clientCount = 0;
+        _primed = true;
+        _xrun = false;
+        this->restartClock(this->now());
+        return nullptr;
+    }
+
+    void waitUntil(const double time)
+    {
+        if (_clock == MOCK_CLOCK_VIRTUAL) _virtualNow = std::max(_virtualNow, time);
+        else std::this_thread::sleep_until(_startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time)));
+    }
+
+    unsigned long long deviceFrames(void) const
+    {
+        return _devicePeriods*_device.periodFrames;
+    }
+
+    unsigned long long writeSpace(void) const
+    {
+        return _device.bufferFrames - (_clientCount - this->deviceFrames());
+    }
+
+    //! How long the oldest captured frame waited for the client
+    void recordReadLatency(void)
+    {
+        const double time = this->now();
+        this->advanceTo(time);
+        if (this->deviceFrames() == _clientCount) return;
+        const auto period = _clientCount/_device.periodFrames + 1;
+        const double captured = _clockOrigin + period*_periodTime;
+        if (time <= captured) return;
+
+        auto &state = mockState();
+        const auto ns = (unsigned long long)((time - captured)*1e9);
+        state.readLatencyNs += ns;
+        auto maxNs = state.maxReadLatencyNs.load();
+        while (ns > maxNs and not state.maxReadLatencyNs.compare_exchange_weak(maxNs, ns));
+    }
+
+    char *sampleAt(void *buffer, const size_t frame, const size_t chan) const
+    {
+        if (_format & paNonInterleaved) return ((char **)buffer)[chan] + frame*_sampleSize;
+        return (char *)buffer + (frame*_numChans + chan)*_sampleSize;
+    }
+
+    void restartClock(const double time)
+    {
+        _clockOrigin = time;
+        _devicePeriods = 0;
+        _nextPeriodTime = time + _periodTime + this->lateness();
+    }
+
+    double lateness(void)
+    {
+        if (_device.jitter <= 0.0) return 0.0;
+        std::normal_distribution<double> dist(0.0, _device.jitter);
+        return std::abs(dist(_rng));
+    }
+
+    //! Run the device clock forward to the given stream time
+    void advanceTo(const double time)
+    {
+        if (not _primed) return;
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        while (_nextPeriodTime <= time)
+        {
+            _devicePeriods++;
+            const double nominal = _clockOrigin + (_devicePeriods + 1)*_periodTime;
+            _nextPeriodTime = std::max(_nextPeriodTime, nominal + this->lateness());
+
+            //an injected glitch loses the buffered samples
+            const double periodTime = _nextPeriodTime;
+            bool glitch = _device.xrunRate > 0.0 and uniform(_rng) < _device.xrunRate*_periodTime;
+            while (_nextFault < _faults.size() and _faults[_nextFault].time <= periodTime)
+            {
+                if (_faults[_nextFault].type == MOCK_FAULT_XRUN) glitch = true;
+                _nextFault++;
+            }
+            if (glitch)
+            {
+                this->dropFrames(_isInput?(this->deviceFrames() - _clientCount):(_clientCount - this->deviceFrames()));
+                _clientCount = this->deviceFrames();
+                this->flagXrun(periodTime);
+            }
+
+            //the client fell behind the device
+            if (_isInput and this->deviceFrames() - _clientCount > _device.bufferFrames)
+            {
+                this->dropFrames(this->deviceFrames() - _clientCount - _device.bufferFrames);
+                _clientCount = this->deviceFrames() - _device.bufferFrames;
+                this->flagXrun(periodTime);
+            }
+            if (not _isInput and _clientCount < this->deviceFrames())
+            {
+                this->dropFrames(this->deviceFrames() - _clientCount);
+                _clientCount = this->deviceFrames();
+                this->flagXrun(periodTime);
+            }
+        }
+    }
+
+    //! Is a device error fault active at the current stream time?
+    bool inErrorFault(void) const
+    {
+        const double time = this->now();
+        for (const auto &fault : _faults)
+        {
+            if (fault.type != MOCK_FAULT_ERROR) continue;
+            if (time >= fault.time and time < fault.time + fault.duration) return true;
+        }
+        return false;
+    }
+
+    /*!
+     * A device call during an error fault fails without transferring frames.
+     * On the virtual clock the failed call still takes the time of the requested
+     * frames (at least one period), so the clock moves through the fault window.
+     */
+    PaError failCall(const unsigned long frames)
+    {
+        mockState().numErrors++;
+        const unsigned long long num = std::max<unsigned long long>(frames, _device.periodFrames);
+        if (_clock == MOCK_CLOCK_VIRTUAL) _virtualNow += num/_rate;
+        this->advanceTo(this->now());
+        return paUnanticipatedHostError;
+    }
+
+    void dropFrames(const unsigned long long num)
+    {
+        mockState().framesDropped += num;
+    }
+
+    //! Block until the next device period, like a blocking device call
+    void waitNextPeriod(void)
+    {
+        const double wakeTime = _nextPeriodTime;
+        this->waitUntil(wakeTime);
+        this->advanceTo(std::max(wakeTime, this->now()));
+    }
+
+    void flagXrun(const double time)
+    {
+        auto &state = mockState();
+        if (not _xrun)
+        {
+            if (_isInput) state.numOverflows++;
+            else state.numUnderflows++;
+        }
+        _xrun = true;
+
+        const auto ns = (unsigned long long)(time*1e9);
+        auto lastNs = state.lastXrunNs.load();
+        while (ns > lastNs and not state.lastXrunNs.compare_exchange_weak(lastNs, ns));
+    }
+
+    PaError takeXrun(const PaError err)
+    {
+        if (not _xrun) return paNoError;
+        _xrun = false;
+        return err;
+    }
+
+    const MockAudioDevice _device;
+    const bool _isInput;
+    const size_t _numChans;
+    const PaSampleFormat _format;
+    const size_t _sampleSize;
+    const double _rate;
+    const MockAudioClock _clock;
+    PaStreamInfo _info;
+    bool _running;
+    bool _primed;
+    std::chrono::steady_clock::time_point _startTime;
+    double _virtualNow;
+    const double _periodTime;
+    double _clockOrigin;
+    unsigned long long _devicePeriods;
+    double _nextPeriodTime;
+    unsigned long long _clientCount;
+    bool _xrun;
+    std::vector<MockAudioFault> _faults;
+    size_t _nextFault;
+    std::vector<TimingTraceEvent> _replay;
+    size_t _replayIndex;
+    bool _replaying;
+    bool _replayOk;
+    std::mt19937 _rng;
+    double _phase;
+};
+
+/***********************************************************************
+ * PortAudio API
+ **********************************************************************/
+static MockStream *mockStream(PaStream *stream)
+{
+    return reinterpret_cast<MockStream *>(stream);
+}
+
+int Pa_GetVersion(void)
+{
+    return 0x130600;
+}
+
+const char *Pa_GetVersionText(void)
+{
+    return "PortAudio mock";
+}
+
+const char *Pa_GetErrorText(PaError errorCode)
+{
+    switch (errorCode)
+    {
+    case paNoError: return "Success";
+    case paNotInitialized: return "PortAudio not initialized";
+    case paInvalidChannelCount: return "Invalid number of channels";
+    case paInvalidSampleRate: return "Invalid sample rate";
+    case paInvalidDevice: return "Invalid device";
+    case paInvalidFlag: return "Invalid flag";
+    case paSampleFormatNotSupported: return "Sample format not supported";
+    case paBadIODeviceCombination: return "Illegal combination of I/O devices";
+    case paBadStreamPtr: return "Invalid stream pointer";
+    case paInternalError: return "Internal PortAudio error";
+    case paStreamIsStopped: return "Stream is stopped";
+    case paStreamIsNotStopped: return "Stream is not stopped";
+    case paInputOverflowed: return "Input overflowed";
+    case paOutputUnderflowed: return "Output underflowed";
+    case paUnanticipatedHostError: return "Unanticipated host error";
+    case paDeviceUnavailable: return "Device unavailable";
+    case paCanNotReadFromACallbackStream: return "Can't read from a callback stream";
+    case paCanNotWriteToACallbackStream: return "Can't write to a callback stream";
+    case paCanNotReadFromAnOutputOnlyStream: return "Can't read from an output only stream";
+    case paCanNotWriteToAnInputOnlyStream: return "Can't write to an input only stream";
+    default: return "Invalid error code";
+    }
+}
+
+PaError Pa_Initialize(void)
+{
+    auto &state = mockState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.initCount++ == 0 and not state.configured)
+    {
+        //optional configuration from the environment
+        const char *env = std::getenv("POTHOS_AUDIO_MOCK");
+        if (env != nullptr and env[0] != '\0')
+        {
+            std::string text(env);
+            if (text[0] != '{')
+            {
+                std::ifstream file(env);
+                text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+            try
+            {
+                state.setConfig(mockAudioConfigFromJson(text));
+            }
+            catch (const std::exception &)
+            {
+                state.initCount--;
+                return paInternalError;
+            }
+        }
+        state.configured = true;
+    }
+    return paNoError;
+}
+
+PaError Pa_Terminate(void)
+{
+    auto &state = mockState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.initCount == 0) return paNotInitialized;
+    state.initCount--;
+    return paNoError;
+}
+
+PaHostApiIndex Pa_GetHostApiCount(void)
+{
+    return 1;
+}
+
+PaHostApiIndex Pa_GetDefaultHostApi(void)
+{
+    return 0;
+}
+
+const PaHostApiInfo *Pa_GetHostApiInfo(PaHostApiIndex hostApi)
+{
+    if (hostApi != 0) return nullptr;
+    return &mockState().hostApiInfo;
+}
+
+PaDeviceIndex Pa_GetDeviceCount(void)
+{
+    auto &state = mockState();
+    if (state.initCount == 0) return paNotInitialized;
+    return PaDeviceIndex(state.deviceInfos.size());
+}
+
+PaDeviceIndex Pa_GetDefaultInputDevice(void)
+{
+    return mockState().hostApiInfo.defaultInputDevice;
+}
+
+PaDeviceIndex Pa_GetDefaultOutputDevice(void)
+{
+    return mockState().hostApiInfo.defaultOutputDevice;
+}
+
+const PaDeviceInfo *Pa_GetDeviceInfo(PaDeviceIndex device)
+{
+    auto &state = mockState();
+    if (device < 0 or size_t(device) >= state.deviceInfos.size()) return nullptr;
+    return &state.deviceInfos[device];
+}
+
+PaError Pa_GetSampleSize(PaSampleFormat format)
+{
+    const size_t size = mockSampleSize(format);
+    if (size == 0) return paSampleFormatNotSupported;
+    return PaError(size);
+}
+
+static PaError mockCheckParams(const PaStreamParameters *params, const bool isInput, const double sampleRate)
+{
+    auto &state = mockState();
+    if (state.initCount == 0) return paNotInitialized;
+    if (params->device < 0 or size_t(params->device) >= state.config.devices.size()) return paInvalidDevice;
+    const auto &device = state.config.devices[params->device];
+    const int maxChans = isInput?device.maxInputChannels:device.maxOutputChannels;
+    if (params->channelCount <= 0 or params->channelCount > maxChans) return paInvalidChannelCount;
+    if (mockSampleSize(params->sampleFormat) == 0) return paSampleFormatNotSupported;
+    if (sampleRate <= 0.0) return paInvalidSampleRate;
+    if (not device.sampleRates.empty() and std::find(device.sampleRates.begin(),
+        device.sampleRates.end(), sampleRate) == device.sampleRates.end()) return paInvalidSampleRate;
+    return paNoError;
+}
+
+PaError Pa_IsFormatSupported(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters, double sampleRate)
+{
+    if (inputParameters == nullptr and outputParameters == nullptr) return paBadIODeviceCombination;
+    if (inputParameters != nullptr and outputParameters != nullptr) return paBadIODeviceCombination;
+    if (inputParameters != nullptr) return mockCheckParams(inputParameters, true, sampleRate);
+    return mockCheckParams(outputParameters, false, sampleRate);
+}
+
+PaError Pa_OpenStream(PaStream** stream, const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters,
+    double sampleRate, unsigned long, PaStreamFlags, PaStreamCallback *streamCallback, void *)
+{
+    //only the blocking half-duplex streams used by the audio blocks are simulated
+    if (streamCallback != nullptr) return paCanNotReadFromACallbackStream;
+    const PaError err = Pa_IsFormatSupported(inputParameters, outputParameters, sampleRate);
+    if (err != paNoError) return err;
+
+    auto &state = mockState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    const bool isInput = inputParameters != nullptr;
+    const auto &params = isInput?*inputParameters:*outputParameters;
+    const unsigned seed = state.config.seed + unsigned(params.device)*7919u + (isInput?0u:1u);
+    auto newStream = new MockStream(state.config.devices[params.device], params, isInput, sampleRate, state.config.clock, seed);
+    if (not newStream->replayOk())
+    {
+        delete newStream;
+        return paDeviceUnavailable;
+    }
+    *stream = newStream;
+    return paNoError;
+}
+
+PaError Pa_CloseStream(PaStream *stream)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    delete mockStream(stream);
+    return paNoError;
+}
+
+PaError Pa_StartStream(PaStream *stream)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->start();
+}
+
+PaError Pa_StopStream(PaStream *stream)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->stop();
+}
+
+PaError Pa_AbortStream(PaStream *stream)
+{
+    return Pa_StopStream(stream);
+}
+
+const PaStreamInfo *Pa_GetStreamInfo(PaStream *stream)
+{
+    if (stream == nullptr) return nullptr;
+    return mockStream(stream)->info();
+}
+
+PaTime Pa_GetStreamTime(PaStream *stream)
+{
+    if (stream == nullptr) return 0.0;
+    return mockStream(stream)->now();
+}
+
+signed long Pa_GetStreamReadAvailable(PaStream *stream)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->readAvailable();
+}
+
+signed long Pa_GetStreamWriteAvailable(PaStream *stream)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->writeAvailable();
+}
+
+PaError Pa_ReadStream(PaStream *stream, void *buffer, unsigned long frames)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->read(buffer, frames);
+}
+
+PaError Pa_WriteStream(PaStream *stream, const void *buffer, unsigned long frames)
+{
+    if (stream == nullptr) return paBadStreamPtr;
+    return mockStream(stream)->write(buffer, frames);
+}
+
+void Pa_Sleep(long msec)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <string>
+#include <vector>
+
+//! The kinds of scripted faults
+enum MockAudioFaultType
+{
+    //! The device loses its buffered samples: an overflow on input, an underflow on output
+    MOCK_FAULT_XRUN,
+
+    //! Device calls fail with paUnanticipatedHostError for the duration
+    MOCK_FAULT_ERROR,
+};
+
+//! A fault at a scripted time in seconds after the stream starts
+struct MockAudioFault
+{
+    MockAudioFault(void);
+    MockAudioFaultType type;
+    double time;
+    double duration;
+};
+
+/*!
+ * A simulated device for the PortAudio mock library.
+ * The mock implements the blocking PortAudio API (Pa_ReadStream, Pa_WriteStream, ...)
+ * on a simulated device clock, so the audio blocks can be linked against it
+ * for benchmarks and regression tests on machines without audio hardware.
+ */
+struct MockAudioDevice
+{
+    MockAudioDevice(void);
+
+    std::string name;
+    int maxInputChannels;
+    int maxOutputChannels;
+    double defaultSampleRate;
+
+    //! The supported sample rates, any positive rate when empty
+    std::vector<double> sampleRates;
+
+    //! The device clock error relative to the nominal rate in parts per million
+    double rateErrorPpm;
+
+    //! The size of the device buffer in frames, overflow/underflow occurs past this
+    unsigned long bufferFrames;
+
+    //! The device transfers frames in periods of this many frames
+    unsigned long periodFrames;
+
+    //! The latency reported in the stream info in seconds
+    double latency;
+
+    //! The standard deviation of the lateness of each period in seconds
+    double jitter;
+
+    //! The rate of injected overflows or underflows per second of stream time
+    double xrunRate;
+
+    //! Faults injected at scripted times in every stream of the device
+    std::vector<MockAudioFault> faults;
+
+    /*!
+     * A timing trace recorded by the setTimingTrace() of an audio block.
+     * Streams of the device replay the recorded available frames,
+     * the time that each read or write returns, and the xrun flags,
+     * then continue as a simulated device at the end of the trace.
+     */
+    std::string replay;
+};
+
+/*!
+ * The clock that drives the simulated devices.
+ * The real-time clock sleeps in blocking calls like real hardware.
+ * The virtual clock advances instantly to the time that a blocking call
+ * would wake up, so results are reproducible and independent of the machine load.
+ */
+enum MockAudioClock
+{
+    MOCK_CLOCK_REALTIME,
+    MOCK_CLOCK_VIRTUAL,
+};
+
+struct MockAudioConfig
+{
+    MockAudioConfig(void);
+
+    std::vector<MockAudioDevice> devices;
+    MockAudioClock clock;
+
+    //! The seed for the jitter and xrun injection of each stream
+    unsigned seed;
+};
+
+//! Statistics summed over all streams since the last reset
+struct MockAudioStats
+{
+    unsigned long long numReads;
+    unsigned long long numWrites;
+    unsigned long long framesRead;
+    unsigned long long framesWritten;
+    unsigned long long numOverflows;
+    unsigned long long numUnderflows;
+    unsigned long long numBlockingWaits;
+
+    //! The sum and the maximum of the age of captured samples when a read begins
+    unsigned long long readLatencyNs;
+    unsigned long long maxReadLatencyNs;
+
+    //! Captured frames lost to overflows and silent frames played in underflows
+    unsigned long long framesDropped;
+
+    //! Device calls failed by a scripted error
+    unsigned long long numErrors;
+
+    //! The stream time of the most recent overflow or underflow in seconds
+    double lastXrunTime;
+};
+
+/*!
+ * Replace the simulated devices.
+ * The default configuration has one full-duplex stereo device at 48 kHz.
+ * When the POTHOS_AUDIO_MOCK environment variable is set, it is loaded
+ * on the first Pa_Initialize(), either as JSON text or as the path of a JSON file.
+ * Call before opening streams, the device info of open streams is not updated.
+ */
+void mockAudioConfigure(const MockAudioConfig &config);
+
+/*!
+ * Parse a JSON configuration:
+ * {"clock": "VIRTUAL", "seed": 1, "devices": [{"name": "Mock", "inputs": 2, "outputs": 2,
+ * "rate": 48000, "rates": [44100, 48000], "ppm": 0, "bufferFrames": 4096,
+ * "periodFrames": 256, "latency": 0.01, "jitter": 0.0, "xrunRate": 0.0,
+ * "faults": [{"type": "XRUN", "time": 1.0}, {"type": "ERROR", "time": 2.0, "duration": 0.1}],
+ * "replay": "trace.bin"}]}
+ * Omitted keys keep the defaults of MockAudioDevice and MockAudioConfig.
+ */
+MockAudioConfig mockAudioConfigFromJson(const std::string &jsonText);
+
+MockAudioStats mockAudioGetStats(void);
+
+void mockAudioResetStats(void);
@@ -0,0 +1,592 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include "AudioHandoff.hpp"
+#include <Pothos/Plugin.hpp>
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#include <spa/utils/ringbuffer.h>
+#include <algorithm> //min/max
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+/***********************************************************************
+ * Native PipeWire backend
+ *
+ * Every stream is a PipeWire stream node on the thread loop of the backend.
+ * The node latency property asks the graph for a quantum near the
+ * chunk size of the block, half of the requested latency,
+ * so the graph wakes the stream once per chunk instead of
+ * going through the buffering of the ALSA or PulseAudio emulation.
+ * The process callback exchanges the buffers with the stream
+ * through a lock-free ring that only holds a few quanta,
+ * and the latency and timing come from pw_stream_get_time_n().
+ * The devices are the audio nodes of the graph, like a null sink
+ * of a headless daemon, and "default" lets the session manager decide.
+ **********************************************************************/
+
+//the stream ring holds this many quanta
+static const size_t PW_NUM_QUANTA = 2;
+
+//the limits of the quantum request, and the largest quantum the ring accepts
+static const size_t PW_MIN_QUANTUM = 32;
+static const size_t PW_MAX_QUANTUM = 8192;
+
+//give up on a blocking call or a server roundtrip after this long
+static const long PW_TIMEOUT_MS = 2000;
+
+//negative status codes of the stream
+static const int PW_ERROR_TIMEOUT = -1;
+static const int PW_ERROR_STREAM = -2;
+
+static spa_audio_format pipeWireFormat(const AudioSampleType type, const bool interleaved)
+{
+    switch (type)
+    {
+    case AUDIO_FLOAT32: return interleaved?SPA_AUDIO_FORMAT_F32:SPA_AUDIO_FORMAT_F32P;
+    case AUDIO_INT32: return interleaved?SPA_AUDIO_FORMAT_S32:SPA_AUDIO_FORMAT_S32P;
+    case AUDIO_INT24: return interleaved?SPA_AUDIO_FORMAT_S24:SPA_AUDIO_FORMAT_S24P;
+    case AUDIO_INT16: return interleaved?SPA_AUDIO_FORMAT_S16:SPA_AUDIO_FORMAT_S16P;
+    case AUDIO_INT8: return interleaved?SPA_AUDIO_FORMAT_S8:SPA_AUDIO_FORMAT_S8P;
+    case AUDIO_UINT8: return interleaved?SPA_AUDIO_FORMAT_U8:SPA_AUDIO_FORMAT_U8P;
+    }
+    return SPA_AUDIO_FORMAT_UNKNOWN;
+}
+
+/***********************************************************************
+ * The thread loop and server connection shared by a backend and its streams
+ **********************************************************************/
+struct PipeWireCore
+{
+    PipeWireCore(void):
+        loop(nullptr),
+        context(nullptr),
+        core(nullptr)
+    {
+        pw_init(nullptr, nullptr);
+        try
+        {
+            loop = pw_thread_loop_new("pothos_audio", nullptr);
+            if (loop == nullptr) throw Pothos::Exception("PipeWireCore()", "pw_thread_loop_new failed");
+            context = pw_context_new(pw_thread_loop_get_loop(loop), nullptr, 0);
+            if (context == nullptr) throw Pothos::Exception("PipeWireCore()", "pw_context_new failed");
+            if (pw_thread_loop_start(loop) != 0) throw Pothos::Exception("PipeWireCore()", "pw_thread_loop_start failed");
+            pw_thread_loop_lock(loop);
+            core = pw_context_connect(context, nullptr, 0);
+            pw_thread_loop_unlock(loop);
+            if (core == nullptr) throw Pothos::Exception("PipeWireCore()", "pw_context_connect: no PipeWire daemon running");
+        }
+        catch (...)
+        {
+            this->cleanup();
+            throw;
+        }
+    }
+
+    ~PipeWireCore(void)
+    {
+        this->cleanup();
+    }
+
+    void cleanup(void)
+    {
+        if (loop != nullptr) pw_thread_loop_stop(loop);
+        if (core != nullptr) pw_core_disconnect(core);
+        if (context != nullptr) pw_context_destroy(context);
+        if (loop != nullptr) pw_thread_loop_destroy(loop);
+        pw_deinit();
+    }
+
+    pw_thread_loop *loop;
+    pw_context *context;
+    pw_core *core;
+};
+
+/***********************************************************************
+ * PipeWire stream
+ **********************************************************************/
+class PipeWireStream : public AudioStream
+{
+public:
+    PipeWireStream(const std::shared_ptr<PipeWireCore> &core, const std::string &target, const AudioStreamArgs &args):
+        _core(core),
+        _stream(nullptr),
+        _isSink(args.isSink),
+        _interleaved(args.interleaved),
+        _numChans(args.numChans),
+        _rate(args.sampleRate),
+        _frameBytes(audioSampleSize(args.sampleType)*(args.interleaved?args.numChans:1)),
+        _ringFrames(1),
+        _quantum(0),
+        _primed(false),
+        _xrun(false),
+        _error(false),
+        _cycleTime(0)
+    {
+        //the chunk size of the block, rounded down to a power of two quantum
+        size_t quantum = PW_MIN_QUANTUM;
+        while (quantum*2 <= std::min(PW_MAX_QUANTUM, size_t(args.latency*_rate/PW_NUM_QUANTA))) quantum *= 2;
+        _quantum = quantum;
+
+        //room for the largest quantum that another node could force on the graph
+        while (_ringFrames < PW_MAX_QUANTUM*PW_NUM_QUANTA) _ringFrames *= 2;
+        spa_ringbuffer_init(&_ring);
+        _planes.resize(_interleaved?1:_numChans, std::vector<char>(_ringFrames*_frameBytes));
+
+        const auto latency = std::to_string(quantum) + "/" + std::to_string(unsigned(_rate));
+        pw_properties *props = pw_properties_new(
+            PW_KEY_MEDIA_TYPE, "Audio",
+            PW_KEY_MEDIA_CATEGORY, _isSink?"Playback":"Capture",
+            PW_KEY_MEDIA_ROLE, "Production",
+            PW_KEY_NODE_LATENCY, latency.c_str(),
+            nullptr);
+#ifdef PW_KEY_TARGET_OBJECT
+        if (not target.empty()) pw_properties_set(props, PW_KEY_TARGET_OBJECT, target.c_str());
+#else
+        if (not target.empty()) pw_properties_set(props, PW_KEY_NODE_TARGET, target.c_str());
+#endif
+
+        //the requested format matches the Pothos buffers, the graph converts as needed
+        spa_audio_info_raw info;
+        std::memset(&info, 0, sizeof(info));
+        info.format = pipeWireFormat(args.sampleType, _interleaved);
+        info.rate = uint32_t(_rate);
+        info.channels = uint32_t(_numChans);
+        if (_numChans == 1) info.position[0] = SPA_AUDIO_CHANNEL_MONO;
+        else if (_numChans == 2)
+        {
+            info.position[0] = SPA_AUDIO_CHANNEL_FL;
+            info.position[1] = SPA_AUDIO_CHANNEL_FR;
+        }
+        else for (size_t i = 0; i < _numChans and i < SPA_AUDIO_MAX_CHANNELS; i++)
+        {
+            info.position[i] = uint32_t(SPA_AUDIO_CHANNEL_AUX0 + i);
+        }
+        uint8_t podBuffer[1024];
+        spa_pod_builder builder;
+        spa_pod_builder_init(&builder, podBuffer, sizeof(podBuffer));
+        const spa_pod *params[1];
+        params[0] = spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info);
+
+        std::memset(&_events, 0, sizeof(_events));
+        _events.version = PW_VERSION_STREAM_EVENTS;
+        _events.state_changed = &PipeWireStream::stateChangedCallback;
+        _events.process = &PipeWireStream::processCallback;
+
+        pw_thread_loop_lock(_core->loop);
+        _stream = pw_stream_new(_core->core, _isSink?"pothos_sink":"pothos_source", props);
+        int err = (_stream == nullptr)?-ENOMEM:0;
+        if (err == 0)
+        {
+            pw_stream_add_listener(_stream, &_listener, &_events, this);
+            err = pw_stream_connect(_stream,
+                _isSink?PW_DIRECTION_OUTPUT:PW_DIRECTION_INPUT, PW_ID_ANY,
+                pw_stream_flags(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS |
+                    PW_STREAM_FLAG_RT_PROCESS | PW_STREAM_FLAG_INACTIVE),
+                params, 1);
+        }
+        pw_thread_loop_unlock(_core->loop);
+        if (err < 0)
+        {
+            this->destroy();
+            throw Pothos::Exception("PipeWireStream()", "pw_stream_connect: " + std::string(std::strerror(-err)));
+        }
+    }
+
+    ~PipeWireStream(void)
+    {
+        this->destroy();
+    }
+
+    void start(void)
+    {
+        //the stream is inactive, so the ring can be emptied
+        spa_ringbuffer_init(&_ring);
+        _primed = false;
+        _xrun = false;
+        pw_thread_loop_lock(_core->loop);
+        const int err = pw_stream_set_active(_stream, true);
+        pw_thread_loop_unlock(_core->loop);
+        if (err < 0) throw Pothos::Exception("PipeWireStream::start()", "pw_stream_set_active: " + std::string(std::strerror(-err)));
+    }
+
+    void stop(void)
+    {
+        pw_thread_loop_lock(_core->loop);
+        const int err = pw_stream_set_active(_stream, false);
+        pw_thread_loop_unlock(_core->loop);
+        if (err < 0) throw Pothos::Exception("PipeWireStream::stop()", "pw_stream_set_active: " + std::string(std::strerror(-err)));
+    }
+
+    long available(void)
+    {
+        if (_error) return PW_ERROR_STREAM;
+        return long(this->ringAvailable());
+    }
+
+    int read(void *buffer, const unsigned long frames)
+    {
+        return this->transfer(buffer, frames);
+    }
+
+    int write(const void *buffer, const unsigned long frames)
+    {
+        _primed = true;
+        return this->transfer(const_cast<void *>(buffer), frames);
+    }
+
+    //! The graph clock, pw_time.now is on the monotonic clock
+    double time(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec*1e-9;
+    }
+
+    //! The pw_time.now of the last process cycle, when the last frames entered or left the ring
+    double availableTime(void)
+    {
+        return _cycleTime.load(std::memory_order_acquire)*1e-9;
+    }
+
+    double sampleRate(void)
+    {
+        return _rate;
+    }
+
+    //! The graph delay to the device and the frames in the resampler from pw_time
+    double latency(void)
+    {
+        pw_time t;
+        std::memset(&t, 0, sizeof(t));
+        if (pw_stream_get_time_n(_stream, &t, sizeof(t)) != 0 or t.rate.denom == 0)
+        {
+            return double(_quantum)/_rate;
+        }
+        return double(t.delay)*t.rate.num/t.rate.denom + t.buffered/_rate;
+    }
+
+    std::string errorText(const int status)
+    {
+        if (status == AUDIO_XRUN) return _isSink?"Output underflowed":"Input overflowed";
+        if (status == PW_ERROR_TIMEOUT) return "PipeWire process callback timed out";
+        if (status == PW_ERROR_STREAM) return "PipeWire stream error";
+        return "Unknown PipeWire error " + std::to_string(status);
+    }
+
+private:
+    void destroy(void)
+    {
+        if (_stream == nullptr) return;
+        pw_thread_loop_lock(_core->loop);
+        pw_stream_destroy(_stream);
+        pw_thread_loop_unlock(_core->loop);
+        _stream = nullptr;
+    }
+
+    static void stateChangedCallback(void *arg, pw_stream_state, pw_stream_state state, const char *)
+    {
+        auto self = static_cast<PipeWireStream *>(arg);
+        if (state != PW_STREAM_STATE_ERROR) return;
+        self->_error = true;
+        self->_handoff.notify();
+    }
+
+    /*******************************************************************
+     * Real-time process callback on the data thread of the node
+     ******************************************************************/
+    static void processCallback(void *arg)
+    {
+        auto self = static_cast<PipeWireStream *>(arg);
+        pw_buffer *b = pw_stream_dequeue_buffer(self->_stream);
+        if (b == nullptr) return;
+        if (self->_isSink) self->processOutput(b);
+        else self->processInput(b);
+        pw_stream_queue_buffer(self->_stream, b);
+
+        pw_time t;
+        if (pw_stream_get_time_n(self->_stream, &t, sizeof(t)) == 0)
+        {
+            self->_cycleTime.store(t.now, std::memory_order_release);
+        }
+        self->_handoff.notify();
+    }
+
+    void processInput(pw_buffer *b)
+    {
+        spa_buffer *buf = b->buffer;
+        const size_t frames = buf->datas[0].chunk->size/_frameBytes;
+        _quantum = frames;
+
+        //drop the whole buffer when the ring is full to keep the channels aligned
+        uint32_t index = 0;
+        const int32_t filled = spa_ringbuffer_get_write_index(&_ring, &index);
+        if (size_t(filled) + frames > _ringFrames)
+        {
+            _xrun = true;
+            return;
+        }
+        for (size_t p = 0; p < _planes.size(); p++)
+        {
+            const spa_data &d = buf->datas[p];
+            if (d.data == nullptr) continue;
+            this->ringCopy(index, p, (char *)d.data + d.chunk->offset, frames, false);
+        }
+        spa_ringbuffer_write_update(&_ring, int32_t(index + frames));
+    }
+
+    void processOutput(pw_buffer *b)
+    {
+        spa_buffer *buf = b->buffer;
+        size_t frames = buf->datas[0].maxsize/_frameBytes;
+        if (b->requested != 0) frames = std::min<size_t>(frames, b->requested);
+        _quantum = frames;
+
+        //buffers go out silent before the first write,
+        //and the frames missing from the ring afterwards are an underflow
+        uint32_t index = 0;
+        const int32_t filled = spa_ringbuffer_get_read_index(&_ring, &index);
+        const size_t n = _primed?std::min<size_t>(std::max<int32_t>(filled, 0), frames):0;
+        if (_primed and n < frames) _xrun = true;
+        for (size_t p = 0; p < _planes.size(); p++)
+        {
+            spa_data &d = buf->datas[p];
+            if (d.data == nullptr) continue;
+            this->ringCopy(index, p, (char *)d.data, n, true);
+            std::memset((char *)d.data + n*_frameBytes, 0, (frames-n)*_frameBytes);
+            d.chunk->offset = 0;
+            d.chunk->stride = int32_t(_frameBytes);
+            d.chunk->size = uint32_t(frames*_frameBytes);
+        }
+        spa_ringbuffer_read_update(&_ring, int32_t(index + n));
+    }
+
+    /*******************************************************************
+     * Ring access from both sides
+     ******************************************************************/
+    //! Copy frames between one ring plane and a buffer, in two segments across the wrap
+    void ringCopy(const uint32_t index, const size_t plane, char *buff, const size_t frames, const bool fromRing)
+    {
+        char *ring = _planes[plane].data();
+        const size_t offset = index & (_ringFrames-1);
+        const size_t n0 = std::min(frames, _ringFrames - offset);
+        if (fromRing)
+        {
+            std::memcpy(buff, ring + offset*_frameBytes, n0*_frameBytes);
+            std::memcpy(buff + n0*_frameBytes, ring, (frames-n0)*_frameBytes);
+        }
+        else
+        {
+            std::memcpy(ring + offset*_frameBytes, buff, n0*_frameBytes);
+            std::memcpy(ring, buff + n0*_frameBytes, (frames-n0)*_frameBytes);
+        }
+    }
+
+    //! Readable frames for a source, free frames within a few quanta for a sink
+    size_t ringAvailable(void)
+    {
+        uint32_t index = 0;
+        if (not _isSink) return size_t(std::max<int32_t>(spa_ringbuffer_get_read_index(&_ring, &index), 0));
+        const size_t filled = size_t(std::max<int32_t>(spa_ringbuffer_get_write_index(&_ring, &index), 0));
+        const size_t limit = std::min(_ringFrames, PW_NUM_QUANTA*_quantum.load());
+        return limit - std::min(limit, filled);
+    }
+
+    //! Copy between the ring and the Pothos buffer, blocking until all are done
+    int transfer(void *buffer, const unsigned long frames)
+    {
+        const int status = _handoff.transfer(frames, std::chrono::milliseconds(PW_TIMEOUT_MS), PW_ERROR_TIMEOUT,
+            [this](void) -> long
+            {
+                if (_error) return PW_ERROR_STREAM;
+                return long(this->ringAvailable());
+            },
+            [this, buffer](const size_t offset, const size_t n)
+            {
+                uint32_t index = 0;
+                if (_isSink) spa_ringbuffer_get_write_index(&_ring, &index);
+                else spa_ringbuffer_get_read_index(&_ring, &index);
+                for (size_t p = 0; p < _planes.size(); p++)
+                {
+                    char *user = _interleaved?(char *)buffer:((char **)buffer)[p];
+                    this->ringCopy(index, p, user + offset*_frameBytes, n, not _isSink);
+                }
+                if (_isSink) spa_ringbuffer_write_update(&_ring, int32_t(index + n));
+                else spa_ringbuffer_read_update(&_ring, int32_t(index + n));
+            });
+        if (status < 0) return status;
+        return _xrun.exchange(false)?AUDIO_XRUN:AUDIO_OK;
+    }
+
+    std::shared_ptr<PipeWireCore> _core;
+    pw_stream *_stream;
+    pw_stream_events _events;
+    spa_hook _listener;
+    const bool _isSink;
+    const bool _interleaved;
+    const size_t _numChans;
+    const double _rate;
+    const size_t _frameBytes;
+    size_t _ringFrames;
+    spa_ringbuffer _ring;
+    std::vector<std::vector<char>> _planes;
+
+    //shared with the process callback
+    std::atomic<size_t> _quantum;
+    std::atomic<bool> _primed;
+    std::atomic<bool> _xrun;
+    std::atomic<bool> _error;
+    std::atomic<int64_t> _cycleTime;
+    AudioHandoff _handoff;
+};
+
+/***********************************************************************
+ * PipeWire backend
+ **********************************************************************/
+class PipeWireBackend : public AudioBackend
+{
+public:
+    PipeWireBackend(void):
+        _core(new PipeWireCore()),
+        _syncSeq(0),
+        _synced(false)
+    {
+        return;
+    }
+
+    std::vector<AudioDeviceInfo> devices(void)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_devices.empty()) this->enumerate();
+        return _devices;
+    }
+
+    //! The "default" entry leaves the routing to the session manager
+    int defaultDevice(const bool)
+    {
+        return 0;
+    }
+
+    //! Enumerate the graph again for a node that appeared since the last enumeration
+    int lookupDevice(const std::string &name)
+    {
+        const int index = AudioBackend::lookupDevice(name);
+        if (index >= 0) return index;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            this->enumerate();
+        }
+        return AudioBackend::lookupDevice(name);
+    }
+
+    std::unique_ptr<AudioStream> open(const AudioStreamArgs &args)
+    {
+        const auto devices = this->devices();
+        if (args.device < 0 or args.device >= int(devices.size())) throw Pothos::RangeException(
+            "PipeWireBackend::open()", "Device index out of range");
+        const auto target = (args.device == 0)?std::string():devices[args.device].name;
+        return std::unique_ptr<AudioStream>(new PipeWireStream(_core, target, args));
+    }
+
+private:
+    static AudioDeviceInfo makeDevice(const std::string &name, const int inputs, const int outputs, const double rate)
+    {
+        AudioDeviceInfo device;
+        device.name = name;
+        device.hostApi = "PipeWire";
+        device.maxInputChannels = inputs;
+        device.maxOutputChannels = outputs;
+        device.defaultSampleRate = rate;
+        device.defaultLowInputLatency = device.defaultLowOutputLatency = PW_NUM_QUANTA*256/rate;
+        device.defaultHighInputLatency = device.defaultHighOutputLatency = PW_NUM_QUANTA*1024/rate;
+        return device;
+    }
+
+    //! Collect the audio nodes from the registry with one roundtrip
+    void enumerate(void)
+    {
+        _devices.clear();
+        _devices.push_back(makeDevice("default", SPA_AUDIO_MAX_CHANNELS, SPA_AUDIO_MAX_CHANNELS, 48000));
+
+        pw_registry_events registryEvents;
+        std::memset(&registryEvents, 0, sizeof(registryEvents));
+        registryEvents.version = PW_VERSION_REGISTRY_EVENTS;
+        registryEvents.global = &PipeWireBackend::globalCallback;
+        pw_core_events coreEvents;
+        std::memset(&coreEvents, 0, sizeof(coreEvents));
+        coreEvents.version = PW_VERSION_CORE_EVENTS;
+        coreEvents.done = &PipeWireBackend::doneCallback;
+
+        pw_thread_loop_lock(_core->loop);
+        pw_registry *registry = pw_core_get_registry(_core->core, PW_VERSION_REGISTRY, 0);
+        spa_hook registryListener, coreListener;
+        spa_zero(registryListener);
+        spa_zero(coreListener);
+        pw_registry_add_listener(registry, &registryListener, &registryEvents, this);
+        pw_core_add_listener(_core->core, &coreListener, &coreEvents, this);
+
+        //the registry announces every global before the sync is done
+        _synced = false;
+        _syncSeq = pw_core_sync(_core->core, PW_ID_CORE, 0);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PW_TIMEOUT_MS);
+        while (not _synced and std::chrono::steady_clock::now() < deadline)
+        {
+            pw_thread_loop_timed_wait(_core->loop, 1);
+        }
+
+        spa_hook_remove(&coreListener);
+        spa_hook_remove(&registryListener);
+        pw_proxy_destroy((pw_proxy *)registry);
+        pw_thread_loop_unlock(_core->loop);
+    }
+
+    static void globalCallback(void *arg, uint32_t, uint32_t, const char *type, uint32_t, const spa_dict *props)
+    {
+        auto self = static_cast<PipeWireBackend *>(arg);
+        if (props == nullptr or std::strcmp(type, PW_TYPE_INTERFACE_Node) != 0) return;
+        const char *mediaClass = spa_dict_lookup(props, PW_KEY_MEDIA_CLASS);
+        const char *name = spa_dict_lookup(props, PW_KEY_NODE_NAME);
+        if (mediaClass == nullptr or name == nullptr) return;
+
+        //capture from sources, play to sinks, duplex nodes do both
+        const std::string cls(mediaClass);
+        const bool isSource = (cls == "Audio/Source" or cls == "Audio/Duplex" or cls == "Audio/Source/Virtual");
+        const bool isSink = (cls == "Audio/Sink" or cls == "Audio/Duplex");
+        if (not isSource and not isSink) return;
+        const char *channels = spa_dict_lookup(props, PW_KEY_AUDIO_CHANNELS);
+        const char *rate = spa_dict_lookup(props, PW_KEY_AUDIO_RATE);
+        const int numChans = (channels == nullptr)?2:std::atoi(channels);
+        self->_devices.push_back(makeDevice(name, isSource?numChans:0, isSink?numChans:0,
+            (rate == nullptr)?48000:std::atof(rate)));
+    }
+
+    static void doneCallback(void *arg, uint32_t id, int seq)
+    {
+        auto self = static_cast<PipeWireBackend *>(arg);
+        if (id != PW_ID_CORE or seq != self->_syncSeq) return;
+        self->_synced = true;
+        pw_thread_loop_signal(self->_core->loop, false);
+    }
+
+    std::shared_ptr<PipeWireCore> _core;
+    std::mutex _mutex;
+    std::vector<AudioDeviceInfo> _devices;
+    int _syncSeq;
+    bool _synced;
+};
+
+static std::shared_ptr<AudioBackend> makePipeWireBackend(void)
+{
+    return std::shared_ptr<AudioBackend>(new PipeWireBackend());
+}
+
+pothos_static_block(registerPipeWireBackend)
+{
+    Pothos::PluginRegistry::add("/audio/backends/pipewire", Pothos::Callable(&makePipeWireBackend));
+}
@@ -0,0 +1,212 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "AudioBackend.hpp"
+#include <Pothos/Plugin.hpp>
+#include <Poco/Logger.h>
+#include <portaudio.h>
+
+/***********************************************************************
+ * Blocking PortAudio stream
+ **********************************************************************/
+class PortAudioStream : public AudioStream
+{
+public:
+    PortAudioStream(PaStream *stream, const bool isSink):
+        _stream(stream),
+        _isSink(isSink)
+    {
+        return;
+    }
+
+    ~PortAudioStream(void)
+    {
+        PaError err = Pa_CloseStream(_stream);
+        if (err != paNoError)
+        {
+            poco_error_f1(Poco::Logger::get("PortAudioBackend"), "Pa_CloseStream: %s", std::string(Pa_GetErrorText(err)));
+        }
+    }
+
+    void start(void)
+    {
+        PaError err = Pa_StartStream(_stream);
+        if (err != paNoError)
+        {
+            throw Pothos::Exception("PortAudioStream::start()", "Pa_StartStream: " + std::string(Pa_GetErrorText(err)));
+        }
+    }
+
+    void stop(void)
+    {
+        PaError err = Pa_StopStream(_stream);
+        if (err != paNoError)
+        {
+            throw Pothos::Exception("PortAudioStream::stop()", "Pa_StopStream: " + std::string(Pa_GetErrorText(err)));
+        }
+    }
+
+    long available(void)
+    {
+        return _isSink?Pa_GetStreamWriteAvailable(_stream):Pa_GetStreamReadAvailable(_stream);
+    }
+
+    int read(void *buffer, const unsigned long frames)
+    {
+        return status(Pa_ReadStream(_stream, buffer, frames));
+    }
+
+    int write(const void *buffer, const unsigned long frames)
+    {
+        return status(Pa_WriteStream(_stream, buffer, frames));
+    }
+
+    double time(void)
+    {
+        return Pa_GetStreamTime(_stream);
+    }
+
+    double sampleRate(void)
+    {
+        return Pa_GetStreamInfo(_stream)->sampleRate;
+    }
+
+    double latency(void)
+    {
+        const auto info = Pa_GetStreamInfo(_stream);
+        return _isSink?info->outputLatency:info->inputLatency;
+    }
+
+    std::string errorText(const int status)
+    {
+        if (status == AUDIO_XRUN) return _isSink?"Output underflowed":"Input overflowed";
+        return Pa_GetErrorText(status);
+    }
+
+private:
+    static int status(const PaError err)
+    {
+        if (err == paInputOverflowed or err == paOutputUnderflowed) return AUDIO_XRUN;
+        return err;
+    }
+
+    PaStream *_stream;
+    const bool _isSink;
+};
+
+/***********************************************************************
+ * PortAudio backend
+ **********************************************************************/
+class PortAudioBackend : public AudioBackend
+{
+public:
+    PortAudioBackend(void)
+    {
+        PaError err = Pa_Initialize();
+        if (err != paNoError)
+        {
+            throw Pothos::Exception("PortAudioBackend()", "Pa_Initialize: " + std::string(Pa_GetErrorText(err)));
+        }
+    }
+
+    ~PortAudioBackend(void)
+    {
+        PaError err = Pa_Terminate();
+        if (err != paNoError)
+        {
+            poco_error_f1(Poco::Logger::get("PortAudioBackend"), "Pa_Terminate: %s", std::string(Pa_GetErrorText(err)));
+        }
+    }
+
+    std::vector<AudioDeviceInfo> devices(void)
+    {
+        std::vector<AudioDeviceInfo> devices;
+        for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++)
+        {
+            const auto info = Pa_GetDeviceInfo(i);
+            AudioDeviceInfo device;
+            device.name = info->name;
+            device.hostApi = Pa_GetHostApiInfo(info->hostApi)->name;
+            device.maxInputChannels = info->maxInputChannels;
+            device.maxOutputChannels = info->maxOutputChannels;
+            device.defaultSampleRate = info->defaultSampleRate;
+            device.defaultLowInputLatency = info->defaultLowInputLatency;
+            device.defaultHighInputLatency = info->defaultHighInputLatency;
+            device.defaultLowOutputLatency = info->defaultLowOutputLatency;
+            device.defaultHighOutputLatency = info->defaultHighOutputLatency;
+            devices.push_back(device);
+        }
+        return devices;
+    }
+
+    int defaultDevice(const bool isSink)
+    {
+        return isSink?Pa_GetDefaultOutputDevice():Pa_GetDefaultInputDevice();
+    }
+
+    std::unique_ptr<AudioStream> open(const AudioStreamArgs &args)
+    {
+        PaStreamParameters params;
+        params.device = args.device;
+        params.channelCount = int(args.numChans);
+        params.sampleFormat = sampleFormat(args.sampleType);
+        if (not args.interleaved) params.sampleFormat |= paNonInterleaved;
+        params.suggestedLatency = args.latency;
+        params.hostApiSpecificStreamInfo = nullptr;
+        const int requestedSize = Pa_GetSampleSize(params.sampleFormat);
+
+        //try stream
+        PaError err = Pa_IsFormatSupported(args.isSink?nullptr:&params, args.isSink?&params:nullptr, args.sampleRate);
+        if (err != paNoError)
+        {
+            throw Pothos::Exception("PortAudioBackend::open()", "Pa_IsFormatSupported: " + std::string(Pa_GetErrorText(err)));
+        }
+
+        //open stream
+        PaStream *stream = nullptr;
+        err = Pa_OpenStream(
+            &stream, // stream
+            args.isSink?nullptr:&params, // inputParameters
+            args.isSink?&params:nullptr, // outputParameters
+            args.sampleRate,  //sampleRate
+            paFramesPerBufferUnspecified, // framesPerBuffer
+            0, // streamFlags
+            nullptr, //streamCallback
+            nullptr); //userData
+        if (err != paNoError)
+        {
+            throw Pothos::Exception("PortAudioBackend::open()", "Pa_OpenStream: " + std::string(Pa_GetErrorText(err)));
+        }
+        std::unique_ptr<AudioStream> audioStream(new PortAudioStream(stream, args.isSink));
+        if (Pa_GetSampleSize(params.sampleFormat) != requestedSize)
+        {
+            throw Pothos::Exception("PortAudioBackend::open()", "Pa_GetSampleSize mismatch");
+        }
+        return audioStream;
+    }
+
+private:
+    static PaSampleFormat sampleFormat(const AudioSampleType type)
+    {
+        switch (type)
+        {
+        case AUDIO_FLOAT32: return paFloat32;
+        case AUDIO_INT32: return paInt32;
+        case AUDIO_INT24: return paInt24;
+        case AUDIO_INT16: return paInt16;
+        case AUDIO_INT8: return paInt8;
+        case AUDIO_UINT8: return paUInt8;
+        }
+        return paFloat32;
+    }
+};
+
+static std::shared_ptr<AudioBackend> makePortAudioBackend(void)
+{
+    return std::shared_ptr<AudioBackend>(new PortAudioBackend());
+}
+
+pothos_static_block(registerPortAudioBackend)
+{
+    Pothos::PluginRegistry::add("/audio/backends/portaudio", Pothos::Callable(&makePortAudioBackend));
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "RealtimeCheck.hpp"
+#include <atomic>
+#include <cstddef>
+#include <dlfcn.h>
+#include <pthread.h>
+
+/***********************************************************************
+ * Violation state, nothing here may allocate or lock
+ **********************************************************************/
+static thread_local const char *currentScope = nullptr;
+static std::atomic<bool> checkArmed(false);
+static std::atomic<unsigned long long> numAllocs(0);
+static std::atomic<unsigned long long> numLocks(0);
+static std::atomic<const char *> firstScope(nullptr);
+static std::atomic<const char *> firstCall(nullptr);
+
+static bool realtimeViolation(const char *call)
+{
+    if (currentScope == nullptr or not checkArmed.load(std::memory_order_relaxed)) return false;
+    const char *expected = nullptr;
+    if (firstScope.compare_exchange_strong(expected, currentScope)) firstCall = call;
+    return true;
+}
+
+RealtimeScope::RealtimeScope(const char *name):
+    _outer(currentScope)
+{
+    currentScope = name;
+}
+
+RealtimeScope::~RealtimeScope(void)
+{
+    currentScope = _outer;
+}
+
+void realtimeCheckArm(const bool armed)
+{
+    checkArmed = armed;
+}
+
+void realtimeCheckReset(void)
+{
+    numAllocs = 0;
+    numLocks = 0;
+    firstScope = nullptr;
+    firstCall = nullptr;
+}
+
+RealtimeViolations realtimeCheckResults(void)
+{
+    RealtimeViolations results;
+    results.numAllocs = numAllocs;
+    results.numLocks = numLocks;
+    const char *scope = firstScope;
+    const char *call = firstCall;
+    if (scope != nullptr) results.firstScope = scope;
+    if (call != nullptr) results.firstCall = call;
+    return results;
+}
+
+/***********************************************************************
+ * Allocation interposer, forwards to the glibc allocator
+ **********************************************************************/
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void __libc_free(void *ptr);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    if (realtimeViolation("malloc")) numAllocs++;
+    return __libc_malloc(size);
+}
+
+extern "C" void free(void *ptr)
+{
+    if (ptr != nullptr and realtimeViolation("free")) numAllocs++;
+    __libc_free(ptr);
+}
+
+extern "C" void *calloc(size_t num, size_t size)
+{
+    if (realtimeViolation("calloc")) numAllocs++;
+    return __libc_calloc(num, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (realtimeViolation("realloc")) numAllocs++;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    if (realtimeViolation("memalign")) numAllocs++;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (realtimeViolation("aligned_alloc")) numAllocs++;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    if (realtimeViolation("posix_memalign")) numAllocs++;
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr == nullptr)?12/*ENOMEM*/:0;
+}
+
+/***********************************************************************
+ * Mutex interposer, forwards to the next definition in the search order
+ **********************************************************************/
+typedef int (*MutexLockFcn)(pthread_mutex_t *);
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    static std::atomic<MutexLockFcn> next(nullptr);
+    MutexLockFcn fcn = next.load(std::memory_order_acquire);
+    if (fcn == nullptr)
+    {
+        fcn = reinterpret_cast<MutexLockFcn>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        next.store(fcn, std::memory_order_release);
+    }
+    if (realtimeViolation("pthread_mutex_lock")) numLocks++;
+    return fcn(mutex);
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+
+/***********************************************************************
+ * Real-time path verification
+ *
+ * When built with POTHOS_AUDIO_RT_CHECK, the check interposes malloc/free
+ * and pthread_mutex_lock for the whole process. A call is a violation when
+ * it happens on a thread inside an AUDIO_REALTIME_SCOPE while the check is armed.
+ * Arm the check once the stream reached steady state, so one time setup
+ * like the first rate label is not reported.
+ * In the normal module build the scope macro expands to nothing.
+ **********************************************************************/
+#ifdef POTHOS_AUDIO_RT_CHECK
+
+#include <string>
+
+//! Marks the calling thread as inside a real-time path for the lifetime of the scope
+class RealtimeScope
+{
+public:
+    RealtimeScope(const char *name);
+    ~RealtimeScope(void);
+private:
+    const char *_outer;
+};
+
+#define AUDIO_REALTIME_SCOPE(name) RealtimeScope realtimeScope(name)
+
+struct RealtimeViolations
+{
+    unsigned long long numAllocs;
+    unsigned long long numLocks;
+
+    //! The scope and the call of the first violation, empty when none
+    std::string firstScope;
+    std::string firstCall;
+};
+
+void realtimeCheckArm(const bool armed);
+
+void realtimeCheckReset(void);
+
+RealtimeViolations realtimeCheckResults(void);
+
+#else
+
+#define AUDIO_REALTIME_SCOPE(name)
+
+#endif //POTHOS_AUDIO_RT_CHECK
@@ -0,0 +1,343 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "ShmAudioRing.hpp"
+#include "AudioHandoff.hpp"
+#include <Pothos/Exception.hpp>
+#include <algorithm> //min/max
+#include <cstring>
+#include <cerrno>
+#include <new>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h> //kill
+#endif
+
+static const uint32_t SHM_MAGIC = 0x504f4155; //"POAU"
+static const uint32_t SHM_VERSION = 1;
+
+struct ShmLabelEntry
+{
+    unsigned long long index;
+    double value;
+    char id[24];
+};
+
+/*!
+ * The segment header, the data follows at dataOffset.
+ * The writer and reader counters live on separate cache lines.
+ */
+struct ShmRingHeader
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t sampleType;
+    uint32_t numChans;
+    uint64_t capacity;
+    uint64_t dataOffset;
+    std::atomic<double> sampleRate;
+    std::atomic<uint32_t> closed;
+    std::atomic<int32_t> writerPid;
+    std::atomic<int32_t> readerPid;
+
+    alignas(64) std::atomic<unsigned long long> writeCount;
+    std::atomic<uint32_t> writeSeq;
+    std::atomic<uint32_t> writeWaiters;
+
+    alignas(64) std::atomic<unsigned long long> readCount;
+    std::atomic<uint32_t> readSeq;
+    std::atomic<uint32_t> readWaiters;
+
+    alignas(64) std::atomic<unsigned long long> labelWrite;
+    std::atomic<unsigned long long> labelRead;
+    ShmLabelEntry labels[SHM_LABEL_TABLE_SIZE];
+};
+
+static const size_t SHM_DATA_OFFSET = (sizeof(ShmRingHeader) + 4095)/4096*4096;
+
+#ifndef _WIN32
+static bool processAlive(const int32_t pid)
+{
+    if (pid == 0) return false;
+    return kill(pid, 0) == 0 or errno == EPERM;
+}
+
+//! Is the named segment an open ring of a live writer?
+static bool liveWriter(const std::string &name)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 and size_t(st.st_size) >= sizeof(ShmRingHeader))
+    {
+        mapping = mmap(nullptr, sizeof(ShmRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    const auto header = reinterpret_cast<const ShmRingHeader *>(mapping);
+    const bool live = header->magic.load(std::memory_order_acquire) == SHM_MAGIC and
+        header->closed.load() == 0 and processAlive(header->writerPid.load());
+    munmap(mapping, sizeof(ShmRingHeader));
+    return live;
+}
+#endif
+
+/***********************************************************************
+ * Creation and attachment
+ **********************************************************************/
+std::shared_ptr<ShmAudioRing> ShmAudioRing::create(const std::string &name,
+    const AudioSampleType sampleType, const size_t numChans, const size_t capacity)
+{
+    #ifdef _WIN32
+    throw Pothos::NotImplementedException("ShmAudioRing::create("+name+")", "POSIX shared memory is not supported on this platform");
+    #else
+    //replace a stale segment from a previous writer, but never a live one,
+    //its readers would silently stay on the orphaned mapping
+    if (liveWriter(name)) throw Pothos::IllegalStateException("ShmAudioRing::create("+name+")", "ring already has a live writer");
+    shm_unlink(name.c_str());
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 and errno == EEXIST) throw Pothos::IllegalStateException("ShmAudioRing::create("+name+")", "ring already has a live writer");
+    if (fd < 0) throw Pothos::OpenFileException("ShmAudioRing::create("+name+")", std::strerror(errno));
+
+    const size_t size = SHM_DATA_OFFSET + capacity*numChans*audioSampleSize(sampleType);
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0) mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        throw Pothos::OutOfMemoryException("ShmAudioRing::create("+name+")", std::strerror(error));
+    }
+
+    auto header = new (mapping) ShmRingHeader();
+    header->version = SHM_VERSION;
+    header->sampleType = uint32_t(sampleType);
+    header->numChans = uint32_t(numChans);
+    header->capacity = capacity;
+    header->dataOffset = SHM_DATA_OFFSET;
+    header->sampleRate = 0.0;
+    header->closed = 0;
+    header->writerPid = int32_t(getpid());
+    header->readerPid = 0;
+    header->writeCount = 0;
+    header->writeSeq = 0;
+    header->writeWaiters = 0;
+    header->readCount = 0;
+    header->readSeq = 0;
+    header->readWaiters = 0;
+    header->labelWrite = 0;
+    header->labelRead = 0;
+
+    //the magic number is published last, readers only attach to initialized rings
+    header->magic.store(SHM_MAGIC, std::memory_order_release);
+    return std::shared_ptr<ShmAudioRing>(new ShmAudioRing(name, mapping, size, true));
+    #endif
+}
+
+std::shared_ptr<ShmAudioRing> ShmAudioRing::open(const std::string &name)
+{
+    #ifdef _WIN32
+    throw Pothos::NotImplementedException("ShmAudioRing::open("+name+")", "POSIX shared memory is not supported on this platform");
+    #else
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 and size_t(st.st_size) >= SHM_DATA_OFFSET)
+    {
+        mapping = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return nullptr;
+
+    const size_t size = size_t(st.st_size);
+    auto header = reinterpret_cast<ShmRingHeader *>(mapping);
+    if (header->magic.load(std::memory_order_acquire) != SHM_MAGIC or header->version != SHM_VERSION or
+        header->dataOffset + header->capacity*header->numChans*audioSampleSize(AudioSampleType(header->sampleType)) > size)
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    //claim the reader slot unless a live reader holds it
+    int32_t reader = header->readerPid.load();
+    if (processAlive(reader))
+    {
+        munmap(mapping, size);
+        throw Pothos::RuntimeException("ShmAudioRing::open("+name+")", "ring already has a reader");
+    }
+    if (not header->readerPid.compare_exchange_strong(reader, int32_t(getpid())))
+    {
+        munmap(mapping, size);
+        throw Pothos::RuntimeException("ShmAudioRing::open("+name+")", "ring already has a reader");
+    }
+
+    //a new reader starts at the live edge
+    header->readCount.store(header->writeCount.load());
+    header->labelRead.store(header->labelWrite.load());
+    return std::shared_ptr<ShmAudioRing>(new ShmAudioRing(name, mapping, size, false));
+    #endif
+}
+
+ShmAudioRing::ShmAudioRing(const std::string &name, void *mapping, const size_t mappingSize, const bool isWriter):
+    _name(name),
+    _mapping(mapping),
+    _mappingSize(mappingSize),
+    _isWriter(isWriter),
+    _header(reinterpret_cast<ShmRingHeader *>(mapping)),
+    _data(reinterpret_cast<char *>(mapping) + _header->dataOffset)
+{
+    return;
+}
+
+ShmAudioRing::~ShmAudioRing(void)
+{
+    #ifndef _WIN32
+    if (_isWriter)
+    {
+        //wake the reader so it notices the closed ring
+        _header->closed = 1;
+        audioFutexWake(_header->writeSeq, _header->writeWaiters);
+        shm_unlink(_name.c_str());
+    }
+    else
+    {
+        _header->readerPid = 0;
+        audioFutexWake(_header->readSeq, _header->readWaiters);
+    }
+    munmap(_mapping, _mappingSize);
+    #endif
+}
+
+/***********************************************************************
+ * Ring accessors
+ **********************************************************************/
+AudioSampleType ShmAudioRing::sampleType(void) const
+{
+    return AudioSampleType(_header->sampleType);
+}
+
+size_t ShmAudioRing::numChans(void) const
+{
+    return _header->numChans;
+}
+
+size_t ShmAudioRing::frameSize(void) const
+{
+    return _header->numChans*audioSampleSize(this->sampleType());
+}
+
+size_t ShmAudioRing::capacity(void) const
+{
+    return size_t(_header->capacity);
+}
+
+char *ShmAudioRing::frame(const unsigned long long index) const
+{
+    return _data + size_t(index % _header->capacity)*this->frameSize();
+}
+
+unsigned long long ShmAudioRing::writeCount(void) const
+{
+    return _header->writeCount.load(std::memory_order_acquire);
+}
+
+unsigned long long ShmAudioRing::readCount(void) const
+{
+    return _header->readCount.load(std::memory_order_acquire);
+}
+
+void ShmAudioRing::commitWrite(const unsigned long long count)
+{
+    _header->writeCount.store(count, std::memory_order_release);
+    audioFutexWake(_header->writeSeq, _header->writeWaiters);
+}
+
+void ShmAudioRing::commitRead(const unsigned long long count)
+{
+    _header->readCount.store(count, std::memory_order_release);
+    audioFutexWake(_header->readSeq, _header->readWaiters);
+}
+
+bool ShmAudioRing::waitData(const unsigned long long readCount, const long timeoutUs)
+{
+    const uint32_t seq = _header->writeSeq.load();
+    if (this->writeCount() > readCount) return true;
+    if (_header->closed.load() != 0) return false;
+    audioFutexWait(_header->writeSeq, _header->writeWaiters, seq, timeoutUs);
+    return this->writeCount() > readCount;
+}
+
+bool ShmAudioRing::waitSpace(const unsigned long long writeCount, const long timeoutUs)
+{
+    const uint32_t seq = _header->readSeq.load();
+    if (writeCount - this->readCount() < _header->capacity) return true;
+    audioFutexWait(_header->readSeq, _header->readWaiters, seq, timeoutUs);
+    return writeCount - this->readCount() < _header->capacity;
+}
+
+/***********************************************************************
+ * Rate and labels
+ **********************************************************************/
+double ShmAudioRing::sampleRate(void) const
+{
+    return _header->sampleRate.load();
+}
+
+void ShmAudioRing::setSampleRate(const double rate)
+{
+    _header->sampleRate.store(rate);
+}
+
+bool ShmAudioRing::pushLabel(const ShmLabel &label)
+{
+    //the writer only fills entries that the reader has released
+    const auto write = _header->labelWrite.load(std::memory_order_relaxed);
+    if (write - _header->labelRead.load(std::memory_order_acquire) >= SHM_LABEL_TABLE_SIZE) return false;
+    auto &entry = _header->labels[write % SHM_LABEL_TABLE_SIZE];
+    entry.index = label.index;
+    entry.value = label.value;
+    std::strncpy(entry.id, label.id.c_str(), sizeof(entry.id)-1);
+    entry.id[sizeof(entry.id)-1] = '\0';
+    _header->labelWrite.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+bool ShmAudioRing::popLabel(const unsigned long long before, ShmLabel &label)
+{
+    const auto read = _header->labelRead.load(std::memory_order_relaxed);
+    if (read == _header->labelWrite.load(std::memory_order_acquire)) return false;
+    const auto &entry = _header->labels[read % SHM_LABEL_TABLE_SIZE];
+    if (entry.index >= before) return false;
+    label.index = entry.index;
+    label.value = entry.value;
+    label.id = entry.id;
+    _header->labelRead.store(read + 1, std::memory_order_release);
+    return true;
+}
+
+bool ShmAudioRing::hasReader(void) const
+{
+    #ifdef _WIN32
+    return false;
+    #else
+    return processAlive(_header->readerPid.load());
+    #endif
+}
+
+bool ShmAudioRing::writerGone(void) const
+{
+    #ifdef _WIN32
+    return true;
+    #else
+    return _header->closed.load() != 0 or not processAlive(_header->writerPid.load());
+    #endif
+}
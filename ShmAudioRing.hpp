@@ -0,0 +1,116 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include "AudioFormats.hpp"
+#include <atomic>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+//! The number of pending labels that the ring can carry
+static const size_t SHM_LABEL_TABLE_SIZE = 64;
+
+//! A numeric stream label carried through the ring
+struct ShmLabel
+{
+    unsigned long long index; //!< the absolute frame index
+    std::string id;
+    double value;
+};
+
+struct ShmRingHeader;
+
+/*!
+ * A single-writer, single-reader ring of interleaved audio frames in POSIX shared memory.
+ * The writer (shm sink) creates the named segment and the reader (shm source) attaches to it.
+ * The frame counters are lock-free atomics in the segment itself,
+ * and waiting sides sleep on futexes (Linux) so a commit wakes them immediately.
+ * Other systems fall back to short sleeps between polls.
+ *
+ * The segment header also carries the stream rate and a small table
+ * of numeric labels, so the rate and timestamp labels survive the transport.
+ */
+class ShmAudioRing
+{
+public:
+    /*!
+     * Create a named ring for the writer, replacing a stale ring of a writer that exited.
+     * \param name the shared memory name, like "/pothos_audio"
+     * \param sampleType the sample type of the frames
+     * \param numChans the number of interleaved channels per frame
+     * \param capacity the number of frames in the ring
+     * \throws Pothos::IllegalStateException when a live writer owns the ring
+     */
+    static std::shared_ptr<ShmAudioRing> create(const std::string &name,
+        const AudioSampleType sampleType, const size_t numChans, const size_t capacity);
+
+    /*!
+     * Open an existing ring as its reader.
+     * \return nullptr when the ring does not exist yet or is not initialized
+     * \throws Pothos::RuntimeException when another live reader is attached
+     */
+    static std::shared_ptr<ShmAudioRing> open(const std::string &name);
+
+    ~ShmAudioRing(void);
+
+    AudioSampleType sampleType(void) const;
+    size_t numChans(void) const;
+    size_t frameSize(void) const;
+    size_t capacity(void) const;
+
+    //! Get a pointer to the frame at an absolute frame index
+    char *frame(const unsigned long long index) const;
+
+    unsigned long long writeCount(void) const;
+    unsigned long long readCount(void) const;
+
+    //! Publish frames up to the new write count and wake the reader
+    void commitWrite(const unsigned long long count);
+
+    //! Release frames up to the new read count and wake the writer
+    void commitRead(const unsigned long long count);
+
+    /*!
+     * Wait until the write count passes the given count.
+     * \return true when data is available
+     */
+    bool waitData(const unsigned long long readCount, const long timeoutUs);
+
+    /*!
+     * Wait until the writer has space past the given write count.
+     * \return true when space is available
+     */
+    bool waitSpace(const unsigned long long writeCount, const long timeoutUs);
+
+    double sampleRate(void) const;
+    void setSampleRate(const double rate);
+
+    /*!
+     * Queue a label for frames that are not yet committed.
+     * \return false when the label table is full and the label is dropped
+     */
+    bool pushLabel(const ShmLabel &label);
+
+    /*!
+     * Pop the next label with an index before the given frame index.
+     * \return false when there is no such label
+     */
+    bool popLabel(const unsigned long long before, ShmLabel &label);
+
+    //! Is a live reader attached to the ring?
+    bool hasReader(void) const;
+
+    //! Is the writer gone, either closed cleanly or exited?
+    bool writerGone(void) const;
+
+private:
+    ShmAudioRing(const std::string &name, void *mapping, const size_t mappingSize, const bool isWriter);
+
+    const std::string _name;
+    void *_mapping;
+    const size_t _mappingSize;
+    const bool _isWriter;
+    ShmRingHeader *_header;
+    char *_data;
+};
@@ -0,0 +1,304 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "MockPortAudio.hpp"
+#include <Pothos/Framework.hpp>
+#include <Pothos/Init.hpp>
+#include <algorithm> //min/max
+#include <chrono>
+#include <cmath>
+#include <cstdlib> //EXIT_SUCCESS
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * Audio source and sink tests on the PortAudio mock
+ *
+ * The test is linked against the audio block sources and the PortAudio
+ * mock library like the benchmark, and registered with ctest.
+ * The mock devices run on the virtual clock, so the runs are short
+ * and do not depend on the load of the build machine.
+ *
+ * - source: the captured test tone arrives intact on the output port
+ * - sink: the frames fed to the sink are written to the device
+ * - error: the source recovers after a scripted device error
+ *
+ * With the "alsa" argument, the test runs the source and the sink
+ * on the ALSA "null" device instead, which needs no hardware,
+ * once with blocking calls and once through the reactor,
+ * so the memory-mapped transfers and the poll descriptors are covered.
+ **********************************************************************/
+
+static const double TEST_SAMPLE_RATE = 48000.0;
+static const double TEST_RUN_TIME = 0.2;
+
+static void check(const bool condition, const std::string &what)
+{
+    if (not condition) throw Pothos::AssertionViolationException("TestAudioMock", what);
+}
+
+/***********************************************************************
+ * Blocks at the other end of the audio block
+ **********************************************************************/
+class TestToneCheck : public Pothos::Block
+{
+public:
+    TestToneCheck(const size_t numChans):
+        _numChans(numChans),
+        _numFrames(0),
+        _peak(0.0f),
+        _numBad(0)
+    {
+        this->setupInput(0, Pothos::DType::fromDType(Pothos::DType("float32"), numChans));
+        this->registerCall(this, POTHOS_FCN_TUPLE(TestToneCheck, getNumFrames));
+        this->registerCall(this, POTHOS_FCN_TUPLE(TestToneCheck, getPeak));
+        this->registerCall(this, POTHOS_FCN_TUPLE(TestToneCheck, getNumBad));
+    }
+
+    static Block *make(const size_t numChans)
+    {
+        return new TestToneCheck(numChans);
+    }
+
+    unsigned long long getNumFrames(void) const
+    {
+        return _numFrames;
+    }
+
+    float getPeak(void) const
+    {
+        return _peak;
+    }
+
+    //! Frames out of the tone range or with different channels
+    unsigned long long getNumBad(void) const
+    {
+        return _numBad;
+    }
+
+    void work(void)
+    {
+        auto port = this->input(0);
+        const size_t num = port->elements();
+        if (num == 0) return;
+        const auto in = port->buffer().as<const float *>();
+        for (size_t i = 0; i < num; i++)
+        {
+            const float x = in[i*_numChans];
+            bool bad = std::abs(x) > 0.501f;
+            for (size_t c = 1; c < _numChans; c++) bad = bad or in[i*_numChans + c] != x;
+            if (bad) _numBad++;
+            _peak = std::max(_peak, std::abs(x));
+        }
+        _numFrames += num;
+        port->consume(num);
+    }
+
+private:
+    const size_t _numChans;
+    unsigned long long _numFrames;
+    float _peak;
+    unsigned long long _numBad;
+};
+
+class TestFeed : public Pothos::Block
+{
+public:
+    TestFeed(const size_t numChans):
+        _numFrames(0)
+    {
+        this->setupOutput(0, Pothos::DType::fromDType(Pothos::DType("float32"), numChans));
+        this->registerCall(this, POTHOS_FCN_TUPLE(TestFeed, getNumFrames));
+    }
+
+    static Block *make(const size_t numChans)
+    {
+        return new TestFeed(numChans);
+    }
+
+    unsigned long long getNumFrames(void) const
+    {
+        return _numFrames;
+    }
+
+    void work(void)
+    {
+        auto port = this->output(0);
+        const size_t num = std::min<size_t>(port->elements(), MIN_FRAMES_BLOCKING);
+        if (num == 0) return;
+        std::fill(port->buffer().as<float *>(), port->buffer().as<float *>() + num*port->dtype().dimension(), 0.25f);
+        _numFrames += num;
+        port->produce(num);
+    }
+
+private:
+    unsigned long long _numFrames;
+};
+
+static Pothos::BlockRegistry registerTestToneCheck(
+    "/audio/test/tone_check", &TestToneCheck::make);
+
+static Pothos::BlockRegistry registerTestFeed(
+    "/audio/test/feed", &TestFeed::make);
+
+/***********************************************************************
+ * Test runs
+ **********************************************************************/
+static void configureMock(const std::string &deviceJson)
+{
+    mockAudioConfigure(mockAudioConfigFromJson("{\"clock\": \"VIRTUAL\", \"devices\": [" + deviceJson + "]}"));
+    mockAudioResetStats();
+}
+
+static Pothos::Proxy makeAudio(const std::string &path)
+{
+    auto audio = Pothos::BlockRegistry::make(path, std::string("float32"), size_t(2), std::string("INTERLEAVED"));
+    audio.call("setupDevice", std::string());
+    audio.call("setupStream", TEST_SAMPLE_RATE);
+    return audio;
+}
+
+static void runFlow(Pothos::Topology &topology)
+{
+    topology.commit();
+    std::this_thread::sleep_for(std::chrono::duration<double>(TEST_RUN_TIME));
+    topology.disconnectAll();
+    topology.commit();
+}
+
+static void testSource(void)
+{
+    configureMock("{\"inputs\": 2, \"outputs\": 2}");
+    auto audio = makeAudio("/audio/source");
+    auto check0 = Pothos::BlockRegistry::make("/audio/test/tone_check", size_t(2));
+    Pothos::Topology topology;
+    topology.connect(audio, 0, check0, 0);
+    runFlow(topology);
+
+    const auto stats = mockAudioGetStats();
+    const auto numFrames = check0.call<unsigned long long>("getNumFrames");
+    check(numFrames >= MIN_FRAMES_BLOCKING, "source produced no frames");
+    check(numFrames <= stats.framesRead, "source produced more frames than it captured");
+    check(check0.call<unsigned long long>("getNumBad") == 0, "source corrupted the test tone");
+    check(check0.call<float>("getPeak") > 0.49f, "source lost the test tone");
+    check(stats.numOverflows == 0, "source overflowed on the virtual clock");
+}
+
+static void testSink(void)
+{
+    configureMock("{\"inputs\": 2, \"outputs\": 2}");
+    auto audio = makeAudio("/audio/sink");
+    auto feed = Pothos::BlockRegistry::make("/audio/test/feed", size_t(2));
+    Pothos::Topology topology;
+    topology.connect(feed, 0, audio, 0);
+    runFlow(topology);
+
+    const auto stats = mockAudioGetStats();
+    check(stats.framesWritten >= MIN_FRAMES_BLOCKING, "sink wrote no frames");
+    check(stats.framesWritten <= feed.call<unsigned long long>("getNumFrames"), "sink wrote more frames than it was fed");
+    check(audio.call<unsigned long long>("getNumFrames") == stats.framesWritten, "sink frame count differs from the device");
+    check(stats.numErrors == 0, "sink device calls failed");
+}
+
+static void testErrorRecovery(void)
+{
+    configureMock("{\"inputs\": 2, \"outputs\": 2, \"faults\": [{\"type\": \"ERROR\", \"time\": 0.1, \"duration\": 0.05}]}");
+    auto audio = makeAudio("/audio/source");
+    audio.call("setReportMode", std::string("DISABLED"));
+    auto check0 = Pothos::BlockRegistry::make("/audio/test/tone_check", size_t(2));
+    Pothos::Topology topology;
+    topology.connect(audio, 0, check0, 0);
+    runFlow(topology);
+
+    //the fault is a few device calls long, the capture carries on past it
+    const auto stats = mockAudioGetStats();
+    check(stats.numErrors != 0, "the scripted device error did not happen");
+    check(stats.numErrors < 100, "source did not recover from the device error");
+    check(stats.framesRead > size_t(0.15*TEST_SAMPLE_RATE), "source stopped capturing after the device error");
+    check(check0.call<unsigned long long>("getNumBad") == 0, "source corrupted the test tone");
+}
+
+/***********************************************************************
+ * ALSA backend runs on the null device
+ **********************************************************************/
+static Pothos::Proxy makeAlsa(const std::string &path, const std::string &ioMode)
+{
+    auto audio = Pothos::BlockRegistry::make(path, std::string("float32"), size_t(2), std::string("INTERLEAVED"));
+    audio.call("setupBackend", std::string("alsa"));
+    audio.call("setupDevice", std::string("null"));
+    audio.call("setupIoMode", ioMode, std::vector<int>());
+    audio.call("setupStream", TEST_SAMPLE_RATE);
+    return audio;
+}
+
+static void testAlsaSource(const std::string &ioMode)
+{
+    auto audio = makeAlsa("/audio/source", ioMode);
+    auto check0 = Pothos::BlockRegistry::make("/audio/test/tone_check", size_t(2));
+    Pothos::Topology topology;
+    topology.connect(audio, 0, check0, 0);
+    runFlow(topology);
+
+    //the null device captures silence
+    const auto numFrames = check0.call<unsigned long long>("getNumFrames");
+    check(numFrames >= MIN_FRAMES_BLOCKING, "ALSA source produced no frames");
+    check(numFrames <= audio.call<unsigned long long>("getNumFrames"), "ALSA source produced more frames than it captured");
+    check(check0.call<unsigned long long>("getNumBad") == 0, "ALSA source corrupted the silence");
+}
+
+static void testAlsaSink(const std::string &ioMode)
+{
+    auto audio = makeAlsa("/audio/sink", ioMode);
+    auto feed = Pothos::BlockRegistry::make("/audio/test/feed", size_t(2));
+    Pothos::Topology topology;
+    topology.connect(feed, 0, audio, 0);
+    runFlow(topology);
+
+    const auto numFrames = audio.call<unsigned long long>("getNumFrames");
+    check(numFrames >= MIN_FRAMES_BLOCKING, "ALSA sink wrote no frames");
+    check(numFrames <= feed.call<unsigned long long>("getNumFrames"), "ALSA sink wrote more frames than it was fed");
+}
+
+int main(int argc, char **argv)
+{
+    Pothos::ScopedInit init;
+
+    const std::vector<std::pair<std::string, void(*)(void)>> mockTests = {
+        {"source", &testSource},
+        {"sink", &testSink},
+        {"error", &testErrorRecovery},
+    };
+
+    const std::vector<std::pair<std::string, void(*)(void)>> alsaTests = {
+        {"alsa source", []{testAlsaSource("BLOCKING");}},
+        {"alsa sink", []{testAlsaSink("BLOCKING");}},
+        {"alsa reactor source", []{testAlsaSource("REACTOR");}},
+        {"alsa reactor sink", []{testAlsaSink("REACTOR");}},
+    };
+
+    const std::string group = (argc > 1)?argv[1]:"mock";
+    if (group != "mock" and group != "alsa")
+    {
+        std::cerr << "Usage: TestAudioMock [mock|alsa]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const auto &tests = (group == "alsa")?alsaTests:mockTests;
+
+    bool pass = true;
+    for (const auto &test : tests)
+    {
+        try
+        {
+            test.second();
+            std::cout << "TestAudioMock: " << test.first << " OK" << std::endl;
+        }
+        catch (const Pothos::Exception &ex)
+        {
+            std::cerr << "TestAudioMock: " << test.first << " FAILED: " << ex.displayText() << std::endl;
+            pass = false;
+        }
+    }
+    return pass?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Stream timing trace file format
+ *
+ * A trace records the device calls of one audio stream:
+ * the result of each available frames query, and the start time,
+ * end time, frame count and status of each read or write.
+ * Times are seconds of stream time since the stream started.
+ * The PortAudio mock replays a trace as a simulated device.
+ * The file is a header followed by fixed size events, in host byte order.
+ **********************************************************************/
+static const char TIMING_TRACE_MAGIC[8] = {'P', 'A', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TimingTraceHeader
+{
+    char magic[8];
+    uint32_t isSink;
+    uint32_t numChans;
+    double sampleRate;
+    double reserved;
+};
+
+enum TimingTraceEventType
+{
+    TIMING_TRACE_AVAILABLE = 1,
+    TIMING_TRACE_IO = 2,
+};
+
+//! The status of a read or write with an xrun, the same as AUDIO_XRUN
+static const int32_t TIMING_TRACE_XRUN = 1;
+
+struct TimingTraceEvent
+{
+    double time;
+    double endTime;
+    int32_t type;
+
+    /*!
+     * The available frames or the status of the read or write:
+     * zero, TIMING_TRACE_XRUN, or a negative backend error code
+     */
+    int32_t value;
+    uint32_t frames;
+    uint32_t reserved;
+};
+
+/*!
+ * Writes the events of one stream to a trace file.
+ * The events are buffered in memory and written when the buffer fills
+ * and when the trace is closed, so the writes are infrequent.
+ */
+class TimingTraceWriter
+{
+public:
+    TimingTraceWriter(void):
+        _file(nullptr)
+    {
+        return;
+    }
+
+    ~TimingTraceWriter(void)
+    {
+        this->close();
+    }
+
+    //! Start a new trace, false when the file cannot be created
+    bool open(const std::string &path, const bool isSink, const size_t numChans, const double sampleRate)
+    {
+        this->close();
+        _file = std::fopen(path.c_str(), "wb");
+        if (_file == nullptr) return false;
+        TimingTraceHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, TIMING_TRACE_MAGIC, sizeof(header.magic));
+        header.isSink = isSink?1:0;
+        header.numChans = uint32_t(numChans);
+        header.sampleRate = sampleRate;
+        std::fwrite(&header, sizeof(header), 1, _file);
+        _events.reserve(4096);
+        return true;
+    }
+
+    bool isOpen(void) const
+    {
+        return _file != nullptr;
+    }
+
+    void push(const TimingTraceEvent &event)
+    {
+        if (_events.size() == _events.capacity()) this->flush();
+        _events.push_back(event);
+    }
+
+    void close(void)
+    {
+        if (_file == nullptr) return;
+        this->flush();
+        std::fclose(_file);
+        _file = nullptr;
+    }
+
+private:
+    void flush(void)
+    {
+        if (not _events.empty()) std::fwrite(_events.data(), sizeof(TimingTraceEvent), _events.size(), _file);
+        _events.clear();
+    }
+
+    std::FILE *_file;
+    std::vector<TimingTraceEvent> _events;
+};
+
+//! Load a trace file, false when the file is missing or not a trace
+static inline bool timingTraceLoad(const std::string &path, TimingTraceHeader &header, std::vector<TimingTraceEvent> &events)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 and
+        std::memcmp(header.magic, TIMING_TRACE_MAGIC, sizeof(header.magic)) == 0;
+    events.clear();
+    TimingTraceEvent event;
+    while (ok and std::fread(&event, sizeof(event), 1, file) == 1) events.push_back(event);
+    std::fclose(file);
+    return ok;
+}
@@ -0,0 +1,195 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "WavFile.hpp"
+#include <cstring>
+#include <cstdint>
+
+static const uint16_t WAVE_FORMAT_PCM = 0x0001;
+static const uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+static const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+static uint16_t loadLE16(const uint8_t *p)
+{
+    return uint16_t(p[0] | p[1] << 8);
+}
+
+static uint32_t loadLE32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t loadLE64(const uint8_t *p)
+{
+    return uint64_t(loadLE32(p)) | uint64_t(loadLE32(p+4)) << 32;
+}
+
+static bool isChunk(const uint8_t *p, const char *id)
+{
+    return std::memcmp(p, id, 4) == 0;
+}
+
+WavHeader wavParseHeader(const void *data, const unsigned long long length)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    if (length < 12) throw Pothos::DataFormatException("wavParseHeader()", "file too short");
+
+    const bool rf64 = isChunk(p, "RF64") or isChunk(p, "BW64");
+    if (not rf64 and not isChunk(p, "RIFF")) throw Pothos::DataFormatException("wavParseHeader()", "not a RIFF file");
+    if (not isChunk(p+8, "WAVE")) throw Pothos::DataFormatException("wavParseHeader()", "not a WAVE file");
+
+    WavHeader header;
+    uint64_t dataSize64 = 0;
+    bool foundFormat = false;
+
+    //walk the chunk list until the data chunk
+    unsigned long long offset = 12;
+    while (offset + 8 <= length)
+    {
+        const uint8_t *chunk = p + offset;
+        const uint32_t chunkSize = loadLE32(chunk+4);
+        const uint8_t *body = chunk + 8;
+        const unsigned long long bodyAvailable = length - offset - 8;
+
+        if (isChunk(chunk, "ds64"))
+        {
+            if (chunkSize < 24 or bodyAvailable < 24) throw Pothos::DataFormatException("wavParseHeader()", "short ds64 chunk");
+            dataSize64 = loadLE64(body+8);
+        }
+
+        else if (isChunk(chunk, "fmt "))
+        {
+            if (chunkSize < 16 or bodyAvailable < 16) throw Pothos::DataFormatException("wavParseHeader()", "short fmt chunk");
+            uint16_t formatTag = loadLE16(body+0);
+            header.numChans = loadLE16(body+2);
+            header.sampleRate = loadLE32(body+4);
+            const uint16_t bitsPerSample = loadLE16(body+14);
+
+            //the sub-format GUID starts with the format tag
+            if (formatTag == WAVE_FORMAT_EXTENSIBLE)
+            {
+                if (chunkSize < 40 or bodyAvailable < 40) throw Pothos::DataFormatException("wavParseHeader()", "short extensible fmt chunk");
+                formatTag = loadLE16(body+24);
+            }
+
+            if (formatTag == WAVE_FORMAT_IEEE_FLOAT and bitsPerSample == 32) header.sampleType = AUDIO_FLOAT32;
+            else if (formatTag == WAVE_FORMAT_PCM and bitsPerSample == 32) header.sampleType = AUDIO_INT32;
+            else if (formatTag == WAVE_FORMAT_PCM and bitsPerSample == 24) header.sampleType = AUDIO_INT24;
+            else if (formatTag == WAVE_FORMAT_PCM and bitsPerSample == 16) header.sampleType = AUDIO_INT16;
+            else if (formatTag == WAVE_FORMAT_PCM and bitsPerSample == 8) header.sampleType = AUDIO_UINT8;
+            else throw Pothos::DataFormatException("wavParseHeader()", "unsupported sample format");
+
+            if (header.numChans == 0) throw Pothos::DataFormatException("wavParseHeader()", "no channels");
+            foundFormat = true;
+        }
+
+        else if (isChunk(chunk, "data"))
+        {
+            if (not foundFormat) throw Pothos::DataFormatException("wavParseHeader()", "data before fmt chunk");
+            header.dataOffset = offset + 8;
+            header.dataSize = (rf64 and chunkSize == 0xFFFFFFFF)?dataSize64:chunkSize;
+
+            //clip truncated files to whole frames
+            header.dataSize = std::min<unsigned long long>(header.dataSize, bodyAvailable);
+            header.dataSize -= header.dataSize % header.frameSize();
+            return header;
+        }
+
+        //chunks are padded to an even size
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    throw Pothos::DataFormatException("wavParseHeader()", "no data chunk");
+}
+
+static void storeLE16(uint8_t *p, const uint16_t x)
+{
+    p[0] = uint8_t(x);
+    p[1] = uint8_t(x >> 8);
+}
+
+static void storeLE32(uint8_t *p, const uint32_t x)
+{
+    storeLE16(p, uint16_t(x));
+    storeLE16(p+2, uint16_t(x >> 16));
+}
+
+static void storeLE64(uint8_t *p, const uint64_t x)
+{
+    storeLE32(p, uint32_t(x));
+    storeLE32(p+4, uint32_t(x >> 32));
+}
+
+static uint8_t *storeChunk(uint8_t *p, const char *id, const uint32_t size)
+{
+    std::memcpy(p, id, 4);
+    storeLE32(p+4, size);
+    return p+8;
+}
+
+void wavWriteHeader(void *out, const WavHeader &header)
+{
+    static const uint32_t ds64Size = 28;
+    const size_t sampleSize = audioSampleSize(header.sampleType);
+    const uint16_t bitsPerSample = uint16_t(sampleSize*8);
+    const bool isFloat = header.sampleType == AUDIO_FLOAT32;
+    if (header.sampleType == AUDIO_INT8) throw Pothos::InvalidArgumentException("wavWriteHeader()", "WAV files store 8-bit samples as unsigned");
+
+    //the extensible format is required for more than 2 channels or 16 bits
+    const bool extensible = header.numChans > 2 or bitsPerSample > 16;
+    const uint32_t fmtSize = extensible?40:16;
+
+    const uint64_t fixedSize = 12 + (8 + ds64Size) + (8 + fmtSize) + 8 + 8;
+    if (header.dataOffset < fixedSize or header.dataOffset % 2 != 0) throw Pothos::InvalidArgumentException(
+        "wavWriteHeader()", "data offset too small for the header");
+
+    const uint64_t riffSize = header.dataOffset + header.dataSize - 8;
+    const bool rf64 = riffSize > 0xFFFFFFFF;
+
+    uint8_t *p = (uint8_t *)out;
+    std::memset(p, 0, header.dataOffset);
+
+    //RIFF or RF64 header
+    p = storeChunk(p, rf64?"RF64":"RIFF", rf64?0xFFFFFFFF:uint32_t(riffSize));
+    std::memcpy(p, "WAVE", 4);
+    p += 4;
+
+    //ds64 chunk or a JUNK chunk that reserves the space for it
+    p = storeChunk(p, rf64?"ds64":"JUNK", ds64Size);
+    if (rf64)
+    {
+        storeLE64(p+0, riffSize);
+        storeLE64(p+8, header.dataSize);
+        storeLE64(p+16, header.dataSize/header.frameSize());
+    }
+    p += ds64Size;
+
+    //format chunk
+    p = storeChunk(p, "fmt ", fmtSize);
+    const uint16_t formatTag = isFloat?WAVE_FORMAT_IEEE_FLOAT:WAVE_FORMAT_PCM;
+    storeLE16(p+0, extensible?WAVE_FORMAT_EXTENSIBLE:formatTag);
+    storeLE16(p+2, uint16_t(header.numChans));
+    storeLE32(p+4, uint32_t(header.sampleRate));
+    storeLE32(p+8, uint32_t(header.sampleRate*header.frameSize()));
+    storeLE16(p+12, uint16_t(header.frameSize()));
+    storeLE16(p+14, bitsPerSample);
+    if (extensible)
+    {
+        static const uint8_t guidTail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+        storeLE16(p+16, 22); //cbSize
+        storeLE16(p+18, bitsPerSample); //valid bits
+        storeLE32(p+20, 0); //channel mask, no speaker positions
+        storeLE16(p+24, formatTag); //sub-format GUID
+        std::memcpy(p+26, guidTail, sizeof(guidTail));
+    }
+    p += fmtSize;
+
+    //pad up to the data chunk
+    const uint8_t *begin = (const uint8_t *)out;
+    const uint32_t padSize = uint32_t(header.dataOffset - (p - begin) - 8 - 8);
+    p = storeChunk(p, "JUNK", padSize);
+    p += padSize;
+
+    //data chunk header
+    storeChunk(p, "data", rf64?0xFFFFFFFF:uint32_t(header.dataSize));
+}
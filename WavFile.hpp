@@ -0,0 +1,63 @@
+// Copyright (c) 2014-2018 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#pragma once
+#include "AudioFormats.hpp"
+#include <cstddef>
+
+/*!
+ * The format and data location of a WAV or RF64 file.
+ */
+struct WavHeader
+{
+    WavHeader(void):
+        sampleType(AUDIO_INT16),
+        numChans(0),
+        sampleRate(0.0),
+        dataOffset(0),
+        dataSize(0)
+    {
+        return;
+    }
+
+    AudioSampleType sampleType;
+    size_t numChans;
+    double sampleRate;
+
+    //! The byte offset of the sample data from the start of the file
+    unsigned long long dataOffset;
+
+    //! The number of bytes of sample data
+    unsigned long long dataSize;
+
+    //! The number of bytes per frame of all channels
+    size_t frameSize(void) const
+    {
+        return numChans*audioSampleSize(sampleType);
+    }
+};
+
+/*!
+ * Parse the header of a RIFF/WAVE, RF64, or BW64 file.
+ * Supports integer PCM (8, 16, 24, 32 bits), IEEE float (32 bits),
+ * and the extensible format tag with either of those sub-formats.
+ * The data size is clipped to the available length for truncated files.
+ * \throws Pothos::DataFormatException for unsupported or malformed files
+ * \param data the start of the file contents
+ * \param length the number of bytes available
+ * \return the format and the location of the sample data
+ */
+WavHeader wavParseHeader(const void *data, const unsigned long long length);
+
+/*!
+ * Write the header of a WAV file that is promoted to RF64 in place.
+ * The header fills exactly header.dataOffset bytes, with a JUNK chunk
+ * reserving room for the ds64 chunk and padding to the data offset.
+ * A RIFF/WAVE header is written while the sizes fit into 32 bits,
+ * otherwise the same space holds an RF64 header with a ds64 chunk.
+ * So the header can be rewritten at any time as the file grows.
+ * \throws Pothos::InvalidArgumentException if the data offset is too small
+ * \param out the output buffer of header.dataOffset bytes
+ * \param header the format, data offset, and current data size
+ */
+void wavWriteHeader(void *out, const WavHeader &header);